@@ -0,0 +1,55 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAIMAN_NET_H
+#define CAIMAN_NET_H
+
+// The format of samples pushed to caiman --net by a network source, such as a microcontroller measuring power. This
+// header is C and depends on nothing else in caiman, so senders need only it.
+//
+// Samples are sent in packets, as UDP datagrams or back to back on a TCP connection. Every number is little endian.
+// A packet is a caiman_net_header, then the field of each source as one byte, padded with zeros to a multiple of 4
+// bytes, then num_samples samples of num_sources int32_t values each: mW for power, mV for voltage and mA for current.
+// A packet is at most CAIMAN_NET_MAX_PACKET bytes.
+//
+// sequence is the index of the packet's first sample since the sender started, so caiman can put packets back in
+// order and tell how many samples were lost. Every packet from a sender has the same sources, fields and rate.
+
+#include <stdint.h>
+
+#define CAIMAN_NET_MAGIC        0x54454e43 // "CNET"
+#define CAIMAN_NET_VERSION      1
+// Fits in an Ethernet frame as a UDP datagram
+#define CAIMAN_NET_MAX_PACKET   1472
+
+// The field of a source
+#define CAIMAN_NET_POWER        1
+#define CAIMAN_NET_VOLTAGE      2
+#define CAIMAN_NET_CURRENT      4
+
+struct caiman_net_header
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t num_sources;
+    uint16_t num_samples;
+    // Samples per second
+    uint32_t rate;
+    uint32_t reserved;
+    uint64_t sequence;
+};
+
+#endif // CAIMAN_NET_H
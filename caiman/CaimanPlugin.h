@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAIMAN_PLUGIN_H
+#define CAIMAN_PLUGIN_H
+
+// The interface between caiman and a source plugin: a shared library, built separately from caiman, that provides
+// samples for caiman's pipeline. This header is C and depends on nothing else in caiman, so plugins need only it.
+//
+// A plugin exports caiman_plugin_entry. caiman calls it once with the ABI version it was built with, and the plugin
+// returns its table of functions for that version, or NULL if it does not support it. Members are only ever added to
+// the end of the table, with the version increased, so a plugin built for an older version keeps working.
+//
+// caiman calls create, describe, prepare and init once, then start and stop around each capture, calling read in a
+// loop on one thread in between. Functions returning int return 0 on
+// success, or a negative value on failure after which caiman reports get_error and exits.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAIMAN_PLUGIN_ABI_VERSION   1
+#define CAIMAN_PLUGIN_ENTRY         "caiman_plugin_entry"
+
+// The field a source provides, as mW, mV or mA respectively
+#define CAIMAN_PLUGIN_POWER         1
+#define CAIMAN_PLUGIN_VOLTAGE       2
+#define CAIMAN_PLUGIN_CURRENT       4
+
+struct caiman_plugin
+{
+    // CAIMAN_PLUGIN_ABI_VERSION and sizeof(struct caiman_plugin) as the plugin was built
+    uint32_t abi_version;
+    uint32_t size;
+    // Shown in caiman's log and as the target of the capture
+    const char *name;
+
+    // Creates an instance configured by args, the text given after the plugin's path or "" if none, returning NULL
+    // on failure
+    void *(*create)(const char *args);
+    void (*destroy)(void *instance);
+    // The last error, or NULL; valid until the next call on instance. instance is NULL after create fails.
+    const char *(*get_error)(void *instance);
+
+    // Fills fields with the field of each source, at most max_sources, and rate with samples per second. Returns the
+    // number of sources, which caiman numbers as its channels, or a negative value on failure.
+    int (*describe)(void *instance, int *fields, int max_sources, uint32_t *rate);
+    // Chooses the sources read, in the order their values appear in each sample
+    int (*prepare)(void *instance, const int *sources, int num_sources);
+    // Opens the hardware
+    int (*init)(void *instance);
+    int (*start)(void *instance);
+    void (*stop)(void *instance);
+    // Waits up to timeout_ms for samples, then writes as many as are available, at most max_samples, to samples. Each
+    // sample is one int32_t per prepared source. Adds any samples the source dropped since the last read to lost.
+    // Returns the number of samples written, 0 if none were ready, or a negative value on failure.
+    int (*read)(void *instance, int32_t *samples, int max_samples, int timeout_ms, uint64_t *lost);
+};
+
+typedef const struct caiman_plugin *(*caiman_plugin_entry_func)(uint32_t abi_version);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAIMAN_PLUGIN_H
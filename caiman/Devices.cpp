@@ -17,22 +17,42 @@
 #include "Devices.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-#include "Fifo.h"
+#include "Latency.h"
 #include "Logging.h"
+#include "Sinks.h"
+#include "Stats.h"
 
-Device::Device(const char *outputPath, FILE* binfile, Fifo *fifo)
-        : mOutputPath(outputPath),
-          mBinfile(binfile),
-          mFifo(fifo)
+Device::Device(const char *outputPath)
+        : mSampleRate(mDefaultSampleRate),
+          mOutputPath(outputPath),
+          mNumSinks(0),
+          mQueued(false),
+          mInput(false),
+          mPreroll(NULL),
+          mPrerollCapacity(0),
+          mPrerollStart(0),
+          mPrerollUsed(0),
+          mPrerollDropped(0),
+          mPrerolling(false),
+          mPrerollFlush(false)
 {
-    if (fifo != NULL) {
-        mBuffer = fifo->start();
-    }
 }
 
 Device::~Device()
 {
+    free(mPreroll);
+}
+
+void Device::addSink(Sink *sink)
+{
+    if (mNumSinks >= MAX_SINKS) {
+        logg.logError("Too many outputs, at most %d are supported", MAX_SINKS);
+        handleException();
+    }
+    mSinks[mNumSinks++] = sink;
+    mQueued = mQueued || sink->isQueued();
 }
 
 char *Device::getXML(int * const length) const
@@ -79,16 +99,126 @@ void Device::writeXML() const
     fclose(xmlout);
 }
 
+void Device::startPreroll(unsigned int seconds)
+{
+    if (!mQueued) {
+        logg.logError("Pre-roll requires a connection to Streamline");
+        handleException();
+    }
+
+    // A whole number of samples, so the oldest kept byte always starts a sample
+    const size_t sampleSize = mNumFields * mDatasize;
+    mPrerollCapacity = (size_t) seconds * mSampleRate * sampleSize;
+    mPreroll = (char *) malloc(mPrerollCapacity);
+    if (mPreroll == NULL) {
+        logg.logError("Unable to allocate %llu bytes for %u seconds of pre-roll", (unsigned long long) mPrerollCapacity, seconds);
+        handleException();
+    }
+    mPrerolling = true;
+}
+
+void Device::flushPreroll()
+{
+    mPrerollFlush.store(true, std::memory_order_release);
+}
+
+void Device::resetOutput()
+{
+    for (int i = 0; i < mNumSinks; i++) {
+        mSinks[i]->reset();
+    }
+}
+
+void Device::writePreroll(const char *buf, size_t size)
+{
+    const size_t sampleSize = mNumFields * mDatasize;
+
+    // Drop the oldest whole samples to make room. The capacity is whole samples and mPrerollStart always starts one,
+    // so if more is dropped than is kept, as when what is kept ends part way through a sample or the write is larger
+    // than the capacity, the rest is skipped from the start of buf
+    if (mPrerollUsed + size > mPrerollCapacity) {
+        size_t drop = mPrerollUsed + size - mPrerollCapacity;
+        drop = (drop + sampleSize - 1) / sampleSize * sampleSize;
+        const size_t skip = drop > mPrerollUsed ? drop - mPrerollUsed : 0;
+        mPrerollStart = (mPrerollStart + drop) % mPrerollCapacity;
+        mPrerollUsed -= drop - skip;
+        mPrerollDropped += drop;
+        buf += skip;
+        size -= skip;
+    }
+
+    size_t pos = (mPrerollStart + mPrerollUsed) % mPrerollCapacity;
+    while (size > 0) {
+        const size_t length = size < mPrerollCapacity - pos ? size : mPrerollCapacity - pos;
+        memcpy(&mPreroll[pos], buf, length);
+        mPrerollUsed += length;
+        buf += length;
+        size -= length;
+        pos = 0;
+    }
+}
+
+void Device::drainPreroll()
+{
+    const size_t sampleSize = mNumFields * mDatasize;
+    logg.logMessage("Flushing pre-roll starting at sample %llu: %llu samples, %llu dropped", mPrerollDropped / sampleSize,
+                    (unsigned long long) (mPrerollUsed / sampleSize), mPrerollDropped / sampleSize);
+
+    // Account for the data now it is queued, so the sent offsets line up
+    gLatency.markCommit(mPrerollUsed, true);
+    while (mPrerollUsed > 0) {
+        size_t length = mPrerollCapacity - mPrerollStart;
+        if (length > mPrerollUsed) {
+            length = mPrerollUsed;
+        }
+        for (int i = 0; i < mNumSinks; i++) {
+            mSinks[i]->write(&mPreroll[mPrerollStart], length);
+        }
+        mPrerollStart = (mPrerollStart + length) % mPrerollCapacity;
+        mPrerollUsed -= length;
+    }
+
+    free(mPreroll);
+    mPreroll = NULL;
+    mPrerolling = false;
+}
+
+void Device::markRead(uint64_t readTime)
+{
+    if (!mInput) {
+        gLatency.markRead(readTime);
+    }
+}
+
 void Device::writeData(void *buf, size_t size)
 {
-    if (mBinfile != NULL) {
-        if (fwrite(buf, 1, size, mBinfile) != size) {
-            logg.logError("Error writing .apc energy data");
-            handleException();
+    // The fifo takes an empty write to mean the end of the stream
+    if (size == 0) {
+        return;
+    }
+
+    if (mInput) {
+        for (int i = 0; i < mNumSinks; i++) {
+            mSinks[i]->write((const char *) buf, size);
         }
+        return;
     }
-    else {
-        memcpy(mBuffer, buf, size);
-        mBuffer = mFifo->write(size);
+
+    Stats::add(gStats.mBytesCommitted, size);
+
+    if (mPrerolling) {
+        if (!mPrerollFlush.load(std::memory_order_acquire)) {
+            gLatency.markCommit(size, false);
+            writePreroll((const char *) buf, size);
+            return;
+        }
+        drainPreroll();
+    }
+
+    gLatency.markCommit(size, mQueued);
+
+    // Every sink reads the same buffer, so adding one costs only what it does with the data
+    for (int i = 0; i < mNumSinks; i++) {
+        mSinks[i]->write((const char *) buf, size);
     }
 }
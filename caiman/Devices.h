@@ -17,8 +17,11 @@
 #ifndef devices_h
 #define devices_h
 
+#include <stdint.h>
 #include <stdio.h>
 
+#include <atomic>
+
 #if defined(WIN32)
 #include <windows.h>
 #define DEVICE     HANDLE
@@ -28,40 +31,119 @@
 
 #include "SessionData.h"
 
-class Fifo;
+class Sink;
 
 #define EMETER_DATA_SIZE    4
 
+// Largest amount of raw data passed between the stages of a staged pipeline at once
+#define RAW_BLOCK_SIZE      4096
+
+// Most sinks a device can write to
+#define MAX_SINKS           8
+
+// Raw data read from a device by the read stage of a staged pipeline, for the decode stage
+struct RawBlock
+{
+    // When the data was read
+    uint64_t readTime;
+    // Samples lost when the device was restarted after reading the data
+    uint64_t gapFrames;
+    // Bytes of data, or -1 at the end of the stream
+    int length;
+    // The device was restarted after reading the data, so decoding starts afresh
+    bool restarted;
+    // Nothing was read, but decodeRaw has timed work to do, such as writing out samples held waiting for late data
+    bool idle;
+    // 8 byte aligned, so devices may store doubles
+    alignas(8) char data[RAW_BLOCK_SIZE];
+};
+
 class Device
 {
 public:
     // Constructed with an output path, which must stay allocated by the caller
     // for the life of this object ..
-    Device(const char *output_path, FILE *binfile, Fifo *fifo);
+    Device(const char *output_path);
     virtual ~Device();
 
+    // Adds a consumer of the samples, which must stay allocated by the caller for the life of this object. Must be
+    // called before start; with no sinks the samples are discarded, e.g. when benchmarking with caiman_replay.
+    void addSink(Sink *sink);
+
     virtual void prepareChannels() = 0;
     virtual void init(const char *devicename) = 0;
     virtual void start() = 0;
     virtual void stop() = 0;
+    // Stops sampling but keeps the device ready for start to be called again
+    virtual void pause() = 0;
     virtual void processBuffer() = 0;
+    // processBuffer split in two for a staged pipeline: readRaw only reads the device, leaving length 0 if there was
+    // nothing to read, and decodeRaw, which may be called on another thread, does everything else
+    virtual void readRaw(RawBlock *block) = 0;
+    virtual void decodeRaw(const RawBlock *block) = 0;
 
     char *getXML(int * const length) const;
     void writeXML() const;
 
+    // Keeps the most recent seconds of samples in memory instead of sending them, until flushPreroll is called.
+    // Must be called after prepareChannels and before start.
+    void startPreroll(unsigned int seconds);
+    // Asks the thread calling processBuffer to send the kept samples, oldest first, then continue as normal
+    void flushPreroll();
+
+    // Resets every sink between captures, e.g. to continue writing from the start of the fifo after it has been reset
+    void resetOutput();
+
+    // Makes this device an input of another, such as a MergeDevice, which calls processBuffer on a thread of its own.
+    // Samples are then only passed to the sinks, leaving the latency and committed bytes to the device it feeds.
+    void setInput()
+    {
+        mInput = true;
+    }
+
+    int getNumFields() const
+    {
+        return mNumFields;
+    }
+    int getDataSize() const
+    {
+        return mDatasize;
+    }
+    unsigned int getSampleRate() const
+    {
+        return mSampleRate;
+    }
+
 protected:
     void writeData(void *buf, size_t size);
+    // Records when the read that the next samples are decoded from completed, unless this device is an input
+    void markRead(uint64_t readTime);
 
-    static const unsigned int mSampleRate = 10000;
+    static const unsigned int mDefaultSampleRate = 10000;
+    unsigned int mSampleRate;
     int mNumFields;
     const char *mVendor;
     int mDatasize;
 
 private:
     const char *mOutputPath;
-    FILE * const mBinfile;
-    Fifo * const mFifo;
-    char *mBuffer;
+    Sink *mSinks[MAX_SINKS];
+    int mNumSinks;
+    // At least one sink queues samples for the sender thread
+    bool mQueued;
+    bool mInput;
+
+    void writePreroll(const char *buf, size_t size);
+    void drainPreroll();
+
+    // Ring of whole samples, only used by the thread calling processBuffer
+    char *mPreroll;
+    size_t mPrerollCapacity;
+    size_t mPrerollStart;
+    size_t mPrerollUsed;
+    unsigned long long mPrerollDropped;
+    bool mPrerolling;
+    std::atomic<bool> mPrerollFlush;
 
     // Intentionally unimplemented
     Device(const Device &);
@@ -57,3 +57,11 @@ void *load_symbol(DLLHANDLE handle, const char *name) {
 
                   return symbol;
               }
+
+void unload_dll(DLLHANDLE handle) {
+#if defined (WIN32)
+    FreeLibrary(handle);
+#else
+    dlclose(handle);
+#endif
+}
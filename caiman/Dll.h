@@ -28,5 +28,6 @@
 
 DLLHANDLE load_dll(const char *name);
 void * load_symbol(DLLHANDLE handle, const char *name);
+void unload_dll(DLLHANDLE handle);
 
 #endif // DLL_H
@@ -21,8 +21,10 @@
 #if defined(WIN32)
 #include <setupapi.h>
 #else
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #if defined(__linux__) && defined(SUPPORT_UDEV)
 #include <libudev.h>
 #endif
@@ -30,6 +32,8 @@
 
 #include "Dll.h"
 #include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
 
 #if defined(WIN32)
 #define DEVICE                  HANDLE
@@ -48,6 +52,9 @@
 #define tHANDLE                 pthread_t
 #endif
 
+// Failures that restart() retries are not the last error reported on giving up
+#define logFailure(...) (mRecovering ? logg.logMessage(__VA_ARGS__) : logg.logError(__VA_ARGS__))
+
 // This is a compatibility version between caiman and the Arm Energy Probe
 #define ENERGY_PROBE_VERSION 20110803
 
@@ -70,18 +77,37 @@ extern volatile bool gQuit;
 // Responses from the energy probe
 #define RESP_ACK        0xac
 
+// How long to wait for the response to a command
+#define CONTROL_TIMEOUT_MS  1000
+// How long to wait for the magic sequence, which may follow samples still being sent
+#define SYNC_TIMEOUT_MS     3000
+// The probe sends samples continuously once started, so this long without any is a stall
+#define STALL_TIMEOUT_MS    1000
+// Longest single wait for samples, so gQuit is noticed promptly
+#define READ_POLL_MS        100
+// How long to wait between attempts to reopen a stalled device, doubling up to the maximum
+#define RECOVERY_RETRY_MS       500
+#define RECOVERY_RETRY_MAX_MS   8000
+
 // Define channels
 #define EN_POWER        (1<<0)
 #define EN_VOLTAGE      (1<<1)
 #define EN_CURRENT      (1<<2)
-#define EMETER_BUFFER_SIZE  64
 
 // Public interface implementation
 
-EnergyProbe::EnergyProbe(const char *outputPath, FILE *binfile, Fifo *fifo)
-        : Device(outputPath, binfile, fifo)
+EnergyProbe::EnergyProbe(const char *outputPath)
+        : Device(outputPath)
 {
     mIsRunning = false;
+    mIsPaused = false;
+    mTapFile = NULL;
+    mStream = INVALID_HANDLE_VALUE;
+    mCtrlStart = mCtrlEnd = 0;
+    mLastDataTime = 0;
+    mReadTimeoutMs = -1;
+    mRecovering = false;
+    resetDecoder();
 }
 
 EnergyProbe::~EnergyProbe()
@@ -98,35 +124,21 @@ void EnergyProbe::init(const char *devicename)
     mComport = NULL;
     mComport = (devicename == NULL) ? autoDetectDevice() : devicename;
 
-#ifdef __linux__
-    // Set device to raw mode (remove interaction with line discipline)
-    char command[80];
-    snprintf(command, sizeof(command) - 1, "stty -F %s raw -echo", mComport);
-    if (system(command) != 0) {
-        logg.logError("Unable to set %s to raw mode, please verify the device exists", mComport);
-        handleException();
-    }
-#endif
-
     if (mComport == NULL || *mComport == 0) {
         logg.logError("Unable to detect the energy probe. Verify that it is attached to the computer and properly enumerated with the OS. If it is enumerated, you can override auto-detection by specifying the 'Device' in the options dialog.");
         handleException();
     }
 
-    // Make connection to the energy metering device
-    mStream = OPEN_DEVICE(mComport);
-    if (mStream == INVALID_HANDLE_VALUE) {
-        logg.logError("Unable to open the energy probe at %s - consider overriding auto-detection by specifying the 'Device' in the options dialog.", mComport);
+    // Make connection to the energy metering device, then sync and reset the interface
+    if (!openDevice() || !syncToDevice()) {
         handleException();
     }
 
-    // Sync and reset the interface, then read data until the magic sequence is found
-    syncToDevice();
-
     // Get and check the version
     unsigned int version;
-    writeChar(CMD_VERSION);
-    readAll((char*) &version, 4);
+    if (!writeChar(CMD_VERSION, "the version command") || !readControl((char*) &version, 4, "the version")) {
+        handleException();
+    }
     logg.logMessage("energy probe version is %d", version);
     if (version != ENERGY_PROBE_VERSION) {
         // Version mismatch
@@ -136,14 +148,16 @@ void EnergyProbe::init(const char *devicename)
 
     // Get the vendor
     char vendor[80];
-    writeChar(CMD_VENDOR);
-    readString(vendor, sizeof(vendor));
+    if (!writeChar(CMD_VENDOR, "the vendor command") || !readString(vendor, sizeof(vendor), "the vendor")) {
+        handleException();
+    }
     logg.logMessage("energy probe vendor is %s", vendor);
 
     // Get the sample rate
     unsigned int sampleRate;
-    writeChar(CMD_RATE);
-    readAll((char*) &sampleRate, 4);
+    if (!writeChar(CMD_RATE, "the rate command") || !readControl((char*) &sampleRate, 4, "the sample rate")) {
+        handleException();
+    }
     logg.logMessage("energy probe sample rate is %d", sampleRate);
     if (sampleRate != mSampleRate) {
         logg.logError("Unexpected sample rate %i, expected %i\n", sampleRate, mSampleRate);
@@ -151,13 +165,33 @@ void EnergyProbe::init(const char *devicename)
     }
 
     // Enable the channels
-    enableChannels();
+    if (!enableChannels()) {
+        handleException();
+    }
     logg.logMessage("Number of fields is %d", mNumFields);
 }
 
 void EnergyProbe::start()
 {
-    writeChar(CMD_START);
+    if (mIsPaused) {
+        // Discard samples left over from the last capture. The sync resets the interface, so send the configuration again.
+        // The device is closed if recovering from a stall was abandoned.
+        if ((mStream == INVALID_HANDLE_VALUE && !openDevice()) || !syncToDevice() || !enableChannels()) {
+            handleException();
+        }
+        mIsPaused = false;
+    }
+
+    resetDecoder();
+    if (!writeChar(CMD_START, "the start command")) {
+        handleException();
+    }
+    mLastDataTime = getTime();
+
+    // Everything read from here on is sample data
+    if (mTapFile != NULL) {
+        writeTapHeader();
+    }
 
     mIsRunning = true;
 }
@@ -170,60 +204,130 @@ void EnergyProbe::stop()
     // the stop this time around
     mIsRunning = false;
 
+    // Recovery from a stall may have given up on reopening the device
+    if (mStream == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
     // Stop the device and do not search for an ACK as it will be mixed with the data
     char c = CMD_STOP;
     int n;
     WRITE_DEVICE(mStream, &c, 1, n);
 
     CLOSE_DEVICE(mStream);
+    mStream = INVALID_HANDLE_VALUE;
 
     // Silence variable ‘n’ set but not used warning
     (void) n;
 }
 
+void EnergyProbe::pause()
+{
+    // As for stop, but keep the device open
+    mIsRunning = false;
+    mIsPaused = true;
+
+    if (mStream == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    char c = CMD_STOP;
+    int n;
+    WRITE_DEVICE(mStream, &c, 1, n);
+    (void) n;
+}
+
 void EnergyProbe::processBuffer()
 {
     // Was 1024, now 64+8 .. +8 padding shouldn't be needed
     static char inBuffer[EMETER_BUFFER_SIZE + 8];
-    int inLength = readAll(inBuffer, EMETER_BUFFER_SIZE);
+    bool stalled;
+    int inLength = readAll(inBuffer, EMETER_BUFFER_SIZE, &stalled);
+    markRead(getTime());
+    Stats::add(gStats.mBytesRead, inLength);
+
+    decodeBuffer(inBuffer, inLength);
+    if (stalled) {
+        writeGap(restart());
+    }
+}
+
+void EnergyProbe::readRaw(RawBlock *block)
+{
+    block->length = 0;
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+
+    // Wait for the first few samples, then take whatever else has already arrived
+    do {
+        bool stalled;
+        const int inLength = readAll(&block->data[block->length], EMETER_BUFFER_SIZE, &stalled);
+        block->length += inLength;
+        if (stalled) {
+            block->gapFrames = restart();
+            block->restarted = true;
+            break;
+        }
+    } while (!gQuit && block->length + EMETER_BUFFER_SIZE <= RAW_BLOCK_SIZE && hasData());
+
+    block->readTime = getTime();
+    Stats::add(gStats.mBytesRead, block->length);
+}
+
+void EnergyProbe::decodeRaw(const RawBlock *block)
+{
+    decodeBuffer(block->data, block->length);
+    if (block->restarted) {
+        writeGap(block->gapFrames);
+    }
+}
+
+void EnergyProbe::resetDecoder()
+{
+    mRemaining = 0;
+    mOutFrame = 0;
+    memset(mLastValue, 0, sizeof(mLastValue));
+}
 
+void EnergyProbe::decodeBuffer(const char *inBuffer, int inLength)
+{
     char data1, data2, data3, data4;
     unsigned int outLength = 0;
     int location = 0;
     unsigned short inframe;
-    static int remaining = 0;
-    static unsigned short outframe = 0;
-    static unsigned char last_value[MAX_FIELDS][EMETER_DATA_SIZE] = { { 0 } };
-    static char outBuffer[2 * EMETER_BUFFER_SIZE];
+    unsigned int frames = 0, missingFrames = 0;
 
     while (location < inLength) {
-        if (remaining == 0) {
+        if (mRemaining == 0) {
             // read frame
             data1 = inBuffer[location++];
             data2 = inBuffer[location++];
             inframe = (unsigned char) data1 + ((unsigned char) data2 << 8);
+            frames++;
             // output missing frames
-            if (outframe != inframe) {
-                logg.logMessage("Missing frames %d-%d (%d frames)", outframe, inframe, inframe-outframe);
+            if (mOutFrame != inframe) {
+                logg.logDeferred("Missing frames %d-%d (%d frames)", mOutFrame, inframe, inframe-mOutFrame);
+                missingFrames += (unsigned short) (inframe - mOutFrame);
             }
-            while (outframe != inframe) {
-                outframe++;
+            while (mOutFrame != inframe) {
+                mOutFrame++;
                 for (int index = 0; index < mNumFields; index++) {
-                    outBuffer[outLength++] = last_value[index][0];
-                    outBuffer[outLength++] = last_value[index][1];
-                    outBuffer[outLength++] = last_value[index][2];
-                    outBuffer[outLength++] = last_value[index][3];
+                    mOutBuffer[outLength++] = mLastValue[index][0];
+                    mOutBuffer[outLength++] = mLastValue[index][1];
+                    mOutBuffer[outLength++] = mLastValue[index][2];
+                    mOutBuffer[outLength++] = mLastValue[index][3];
 
                     // write data
-                    if (outLength >= sizeof(outBuffer)) {
-                        writeData(outBuffer, outLength);
+                    if (outLength >= sizeof(mOutBuffer)) {
+                        writeData(mOutBuffer, outLength);
                         outLength = 0;
                     }
                 }
-            } // while outframe != inframe
-            outframe++;
+            } // while mOutFrame != inframe
+            mOutFrame++;
             // mNumFields data fields should follow the frame
-            remaining = mNumFields;
+            mRemaining = mNumFields;
         }
         else {
             // read data
@@ -232,14 +336,15 @@ void EnergyProbe::processBuffer()
 
             // account for scale factor of different shunt resistors
             int value = (unsigned char) data1 + ((unsigned char) data2 << 8);
-            value = (int) ((float) value * gSessionData.mSourceScaleFactor[mNumFields - remaining]);
+            value = (int) ((float) value * mScaleFactors[mNumFields - mRemaining]);
             // Check for overflow
             if (value & ~0x7FFFFFFF) {
                 value = 0x7FFFFFFF;
+                Stats::add(gStats.mOverflowClamps, 1);
                 static bool neverOverflowed = true;
                 if (neverOverflowed) {
                     neverOverflowed = false;
-                    logg.logMessage("Power overflow detected");
+                    logg.logDeferred("Power overflow detected");
                 }
             }
             data1 = value & 0xFF;
@@ -248,132 +353,444 @@ void EnergyProbe::processBuffer()
             data4 = (value >> 24) & 0xFF;
 
             // output data
-            outBuffer[outLength++] = data1;
-            outBuffer[outLength++] = data2;
-            outBuffer[outLength++] = data3;
-            outBuffer[outLength++] = data4;
+            mOutBuffer[outLength++] = data1;
+            mOutBuffer[outLength++] = data2;
+            mOutBuffer[outLength++] = data3;
+            mOutBuffer[outLength++] = data4;
             // save data
-            last_value[mNumFields - remaining][0] = data1;
-            last_value[mNumFields - remaining][1] = data2;
-            last_value[mNumFields - remaining][2] = data3;
-            last_value[mNumFields - remaining][3] = data4;
+            mLastValue[mNumFields - mRemaining][0] = data1;
+            mLastValue[mNumFields - mRemaining][1] = data2;
+            mLastValue[mNumFields - mRemaining][2] = data3;
+            mLastValue[mNumFields - mRemaining][3] = data4;
             // update remaining data fields
-            remaining--;
+            mRemaining--;
 
             // write data
-            if (outLength >= sizeof(outBuffer)) {
-                writeData(outBuffer, outLength);
+            if (outLength >= sizeof(mOutBuffer)) {
+                writeData(mOutBuffer, outLength);
                 outLength = 0;
             }
         }
     }
 
     if (location != inLength) {
-        logg.logMessage("INVESTIGATE: misaligned length");
+        logg.logDeferred("INVESTIGATE: misaligned length");
+    }
+
+    Stats::add(gStats.mFramesRead, frames);
+    if (missingFrames > 0) {
+        Stats::add(gStats.mMissingFrames, missingFrames);
     }
 
     // write data
-    writeData(outBuffer, outLength);
+    writeData(mOutBuffer, outLength);
 }
 
-int EnergyProbe::readAll(char *ptr, size_t size)
+int EnergyProbe::readAll(char *ptr, size_t size, bool *stalled)
 {
     int remain = size, n;
+
+    *stalled = false;
+
+    // Samples may have been read along with the last response
+    if (mCtrlStart < mCtrlEnd) {
+        n = mCtrlEnd - mCtrlStart < remain ? mCtrlEnd - mCtrlStart : remain;
+        memcpy(ptr, &mCtrlBuffer[mCtrlStart], n);
+        mCtrlStart += n;
+        if (mTapFile != NULL && mIsRunning && fwrite(ptr, 1, n, mTapFile) != (size_t) n) {
+            logg.logError("Error writing the energy probe tap file");
+            handleException();
+        }
+        remain -= n;
+        ptr += n;
+    }
+
     while (!gQuit && remain > 0) {
-        if (!READ_DEVICE(mStream, ptr, remain, n)) {
-            logg.logError("Error reading from the energy probe; data will be incomplete");
+        const uint64_t now = getTime();
+        const uint64_t deadline = mLastDataTime + STALL_TIMEOUT_MS * 1000000ULL;
+        if (now >= deadline) {
+            logg.logDeferred("No data from the energy probe for %d ms", STALL_TIMEOUT_MS);
+            *stalled = true;
+            break;
+        }
+
+        const int timeoutMs = (int) ((deadline - now + 999999) / 1000000);
+        n = readTimeout(ptr, remain, timeoutMs < READ_POLL_MS ? timeoutMs : READ_POLL_MS);
+        if (n < 0) {
+            *stalled = true;
+            break;
+        }
+        if (n == 0) {
+            continue;
+        }
+        mLastDataTime = getTime();
+        if (mTapFile != NULL && mIsRunning && n > 0 && fwrite(ptr, 1, n, mTapFile) != (size_t) n) {
+            logg.logError("Error writing the energy probe tap file");
             handleException();
         }
         remain -= n;
         ptr += n;
     }
+
+    // Keep what was read before a stall, except half of a value, which the restarted device will not complete
+    if (*stalled) {
+        return (size - remain) & ~1;
+    }
     return size - remain;
 }
 
-void EnergyProbe::readAck()
+void EnergyProbe::writeTapHeader()
+{
+    const char magic[8] = EMETER_TAP_MAGIC;
+    const uint32_t version = EMETER_TAP_VERSION;
+    const uint32_t channels = MAX_EPROBE_CHANNELS;
+    int32_t resistors[MAX_EPROBE_CHANNELS];
+
+    for (int i = 0; i < MAX_EPROBE_CHANNELS; i++) {
+        resistors[i] = gSessionData.mResistors[i];
+    }
+
+    // Values are in host byte order, which is little endian on all supported hosts
+    if (fwrite(magic, sizeof(magic), 1, mTapFile) != 1 ||
+            fwrite(&version, sizeof(version), 1, mTapFile) != 1 ||
+            fwrite(&channels, sizeof(channels), 1, mTapFile) != 1 ||
+            fwrite(resistors, sizeof(resistors), 1, mTapFile) != 1) {
+        logg.logError("Error writing the energy probe tap file");
+        handleException();
+    }
+}
+
+int EnergyProbe::readTapHeader(const char *tap, unsigned int size)
+{
+    const char magic[8] = EMETER_TAP_MAGIC;
+    uint32_t version, channels;
+    const unsigned int fixedSize = sizeof(magic) + sizeof(version) + sizeof(channels);
+
+    if (size < fixedSize || memcmp(tap, magic, sizeof(magic)) != 0) {
+        return -1;
+    }
+    memcpy(&version, tap + sizeof(magic), sizeof(version));
+    memcpy(&channels, tap + sizeof(magic) + sizeof(version), sizeof(channels));
+    if (version != EMETER_TAP_VERSION || channels > MAX_CHANNELS || size < fixedSize + channels * sizeof(int32_t)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < channels; i++) {
+        int32_t resistor;
+        memcpy(&resistor, tap + fixedSize + i * sizeof(resistor), sizeof(resistor));
+        gSessionData.mResistors[i] = resistor;
+    }
+
+    return fixedSize + channels * sizeof(int32_t);
+}
+
+bool EnergyProbe::hasData()
+{
+    if (mCtrlStart < mCtrlEnd) {
+        return true;
+    }
+
+#if defined(WIN32)
+    DWORD errors;
+    COMSTAT status;
+    return ClearCommError(mStream, &errors, &status) && status.cbInQue > 0;
+#else
+    struct pollfd pfd;
+    pfd.fd = mStream;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0;
+#endif
+}
+
+int EnergyProbe::readTimeout(char *ptr, size_t size, int timeoutMs)
+{
+#if defined(WIN32)
+    // Return as soon as any bytes are available, or after timeoutMs. Samples are read with the same timeout until
+    // close to a stall, so it rarely needs setting again.
+    if (timeoutMs != mReadTimeoutMs) {
+        COMMTIMEOUTS timeouts = { MAXDWORD, MAXDWORD, (DWORD) timeoutMs, 0, 0 };
+        if (!SetCommTimeouts(mStream, &timeouts)) {
+            logg.logMessage("Error setting the energy probe timeouts");
+            return -1;
+        }
+        mReadTimeoutMs = timeoutMs;
+    }
+    DWORD n;
+    if (!ReadFile(mStream, ptr, size, &n, NULL)) {
+        logg.logMessage("Error reading from the energy probe");
+        return -1;
+    }
+    return n;
+#else
+    struct pollfd pfd;
+    pfd.fd = mStream;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    const int result = poll(&pfd, 1, timeoutMs);
+    if (result == 0 || (result < 0 && errno == EINTR)) {
+        return 0;
+    }
+    if (result < 0) {
+        logg.logMessage("Error waiting for the energy probe");
+        return -1;
+    }
+
+    const ssize_t n = read(mStream, ptr, size);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return 0;
+    }
+    if (n <= 0) {
+        logg.logMessage("Error reading from the energy probe, it may have been disconnected");
+        return -1;
+    }
+    return n;
+#endif
+}
+
+// Reads as much as is available into mCtrlBuffer, waiting until deadline for at least one byte
+bool EnergyProbe::fillControl(uint64_t deadline, const char *what)
+{
+    if (mCtrlStart == mCtrlEnd) {
+        mCtrlStart = mCtrlEnd = 0;
+    }
+
+    for (;;) {
+        const uint64_t now = getTime();
+        if (now >= deadline) {
+            logFailure("Timed out waiting for %s from the energy probe at %s", what, mComport);
+            return false;
+        }
+
+        const int n = readTimeout(&mCtrlBuffer[mCtrlEnd], EMETER_CONTROL_BUFFER_SIZE - mCtrlEnd, (int) ((deadline - now + 999999) / 1000000));
+        if (n < 0) {
+            logFailure("Unable to read %s from the energy probe at %s", what, mComport);
+            return false;
+        }
+        if (n > 0) {
+            mCtrlEnd += n;
+            return true;
+        }
+    }
+}
+
+bool EnergyProbe::readControlByte(uint64_t deadline, const char *what, unsigned char *c)
+{
+    if (mCtrlStart == mCtrlEnd && !fillControl(deadline, what)) {
+        return false;
+    }
+    *c = mCtrlBuffer[mCtrlStart++];
+    return true;
+}
+
+bool EnergyProbe::readControl(char *ptr, size_t size, const char *what)
+{
+    const uint64_t deadline = getTime() + CONTROL_TIMEOUT_MS * 1000000ULL;
+    for (size_t i = 0; i < size; i++) {
+        if (!readControlByte(deadline, what, (unsigned char *) &ptr[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EnergyProbe::readAck(const char *what)
 {
-    bool found = false;
+    const uint64_t deadline = getTime() + CONTROL_TIMEOUT_MS * 1000000ULL;
     unsigned char ack;
 
     // Discard all zeros; error on a char other than RESP_ACK
-    while (!found) {
-        readAll((char*) &ack, sizeof(ack));
+    for (;;) {
+        if (!readControlByte(deadline, what, &ack)) {
+            return false;
+        }
 
         if (ack == 0) {
             continue;
         }
         else if (ack == RESP_ACK) {
-            found = true;
+            return true;
         }
         else {
-            logg.logError("Expected an ack from device but received %02x", ack);
-            handleException();
+            logFailure("Expected an ack from device for %s but received %02x", what, ack);
+            return false;
         }
     }
 }
 
-void EnergyProbe::readString(char *buffer, int limit)
+bool EnergyProbe::readString(char *buffer, int limit, const char *what)
 {
+    const uint64_t deadline = getTime() + CONTROL_TIMEOUT_MS * 1000000ULL;
+    unsigned char ch;
     while (--limit) {
-        char ch;
-        readAll(&ch, 1);
+        if (!readControlByte(deadline, what, &ch)) {
+            *buffer = 0;
+            return false;
+        }
         *buffer++ = ch;
         if (!ch) {
-            *buffer = 0;
             break;
         }
     }
+    *buffer = 0;
+    return true;
 }
 
-int EnergyProbe::writeAll(char *ptr, size_t size)
+bool EnergyProbe::writeAll(const char *ptr, size_t size)
 {
     int remain = size, n;
 
     while (!gQuit && remain > 0) {
-        if (!WRITE_DEVICE(mStream, ptr, remain, n)) {
-            logg.logError("Write failure when communicating with the energy probe");
-            handleException();
+        if (!WRITE_DEVICE(mStream, ptr, remain, n) || n < 0) {
+            logFailure("Write failure when communicating with the energy probe");
+            return false;
         }
         remain -= n;
         ptr += n;
     }
 
-    if (remain != 0) {
-        return size - remain;
-    }
+    return remain == 0;
+}
 
-    return size;
+bool EnergyProbe::writeChar(char c, const char *what)
+{
+    return writeAll(&c, 1) && readAck(what);
 }
 
-void EnergyProbe::writeChar(char c)
+bool EnergyProbe::openDevice()
 {
-    writeAll(&c, 1);
-    readAck();
+#ifdef __linux__
+    // Set device to raw mode (remove interaction with line discipline)
+    char command[80];
+    snprintf(command, sizeof(command) - 1, "stty -F %s raw -echo", mComport);
+    if (system(command) != 0) {
+        logFailure("Unable to set %s to raw mode, please verify the device exists", mComport);
+        return false;
+    }
+#endif
+
+    mStream = OPEN_DEVICE(mComport);
+    if (mStream == INVALID_HANDLE_VALUE) {
+        logFailure("Unable to open the energy probe at %s - consider overriding auto-detection by specifying the 'Device' in the options dialog.", mComport);
+        return false;
+    }
+
+    mCtrlStart = mCtrlEnd = 0;
+    mReadTimeoutMs = -1;
+    return true;
 }
 
-void EnergyProbe::syncToDevice()
+bool EnergyProbe::syncToDevice()
 {
-    unsigned char sync[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, CMD_RESET };
+    const unsigned char sync[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, CMD_RESET };
+    const uint64_t deadline = getTime() + SYNC_TIMEOUT_MS * 1000000ULL;
     int found = 0;
-    unsigned char byte;
 
-    writeAll((char*) sync, sizeof(sync));
+    if (!writeAll((const char*) sync, sizeof(sync))) {
+        return false;
+    }
+
+    // Anything already read was sent before the reset
+    mCtrlStart = mCtrlEnd = 0;
 
     // Repeat until eight 0xFFs are found in a row
     logg.logMessage("Read the energy probe for the magic sequence");
-    while (1) {
-        readAll((char*) &byte, sizeof(byte));
+    for (;;) {
+        if (!fillControl(deadline, "the magic sequence")) {
+            return false;
+        }
 
-        if (byte == 0xff) {
-            if (++found == 8) {
-                break;
+        const unsigned char *pos = (const unsigned char *) &mCtrlBuffer[mCtrlStart];
+        const unsigned char * const end = (const unsigned char *) &mCtrlBuffer[mCtrlEnd];
+        while (pos < end) {
+            if (found == 0) {
+                // Skip straight to the next candidate
+                pos = (const unsigned char *) memchr(pos, 0xff, end - pos);
+                if (pos == NULL) {
+                    break;
+                }
+            }
+            if (*pos++ == 0xff) {
+                if (++found == 8) {
+                    // Keep anything after the magic sequence for the next response
+                    mCtrlStart = (const char *) pos - mCtrlBuffer;
+                    logg.logMessage("Sync successful and magic detected on the energy probe");
+                    return true;
+                }
+            }
+            else {
+                found = 0;
             }
         }
-        else {
-            found = 0;
+        mCtrlStart = mCtrlEnd;
+    }
+}
+
+uint64_t EnergyProbe::restart()
+{
+    Stats::add(gStats.mStalls, 1);
+    logg.logMessage("The energy probe at %s stopped sending data, reopening it", mComport);
+
+    int retryMs = RECOVERY_RETRY_MS;
+    mRecovering = true;
+    for (int attempt = 1; !gQuit; attempt++) {
+        if (mStream != INVALID_HANDLE_VALUE) {
+            CLOSE_DEVICE(mStream);
+            mStream = INVALID_HANDLE_VALUE;
+        }
+
+        // The device resets its frame counter when started again
+        if (openDevice() && syncToDevice() && enableChannels() && writeChar(CMD_START, "the start command")) {
+            const uint64_t now = getTime();
+            const uint64_t frames = (now - mLastDataTime) / 1000 * mSampleRate / 1000000;
+            mLastDataTime = now;
+            Stats::add(gStats.mRecoveries, 1);
+            logg.logMessage("Recovered the energy probe after %d attempt(s); %llu samples are missing and repeat the last sample", attempt, (unsigned long long) frames);
+            mRecovering = false;
+            return frames;
+        }
+        logg.logMessage("Attempt %d to reopen the energy probe failed, retrying in %d ms", attempt, retryMs);
+
+        for (int slept = 0; slept < retryMs && !gQuit; slept += READ_POLL_MS) {
+#if defined(WIN32)
+            Sleep(READ_POLL_MS);
+#else
+            usleep(READ_POLL_MS * 1000);
+#endif
+        }
+        retryMs = retryMs * 2 < RECOVERY_RETRY_MAX_MS ? retryMs * 2 : RECOVERY_RETRY_MAX_MS;
+    }
+
+    mRecovering = false;
+    return 0;
+}
+
+// Completes any partially read sample and writes the frames lost during a stall, all repeating the last value of each
+// field, so later samples keep their place on the timeline
+void EnergyProbe::writeGap(uint64_t frames)
+{
+    uint64_t fields = mRemaining + frames * mNumFields;
+    int field = mRemaining > 0 ? mNumFields - mRemaining : 0;
+    unsigned int outLength = 0;
+
+    while (fields > 0) {
+        memcpy(&mOutBuffer[outLength], mLastValue[field], EMETER_DATA_SIZE);
+        outLength += EMETER_DATA_SIZE;
+        field = field + 1 < mNumFields ? field + 1 : 0;
+        fields--;
+
+        if (outLength >= sizeof(mOutBuffer)) {
+            writeData(mOutBuffer, outLength);
+            outLength = 0;
         }
     }
-    logg.logMessage("Sync successful and magic detected on the energy probe");
+    writeData(mOutBuffer, outLength);
+    Stats::add(gStats.mGapFrames, frames);
+
+    // The device counts frames from zero again, and the last values carry on in case it starts by missing some
+    mRemaining = 0;
+    mOutFrame = 0;
 }
 
 void EnergyProbe::prepareChannels()
@@ -392,6 +809,8 @@ void EnergyProbe::prepareChannels()
     for (index = 0; index < MAX_EPROBE_CHANNELS; index++) {
         mFields[index] = 0;
     }
+    // Kept, as gSessionData describes every merged device once they are all prepared
+    memcpy(mScaleFactors, gSessionData.mSourceScaleFactor, sizeof(mScaleFactors));
 
     for (index = 0; index < MAX_COUNTERS; index++) {
         if (gSessionData.mCounterEnabled[index]) {
@@ -409,17 +828,26 @@ void EnergyProbe::prepareChannels()
     mDatasize = EMETER_DATA_SIZE;
 }
 
-void EnergyProbe::enableChannels()
+bool EnergyProbe::enableChannels()
 {
     int index;
+    char commands[MAX_EPROBE_CHANNELS * 3];
 
+    // Send every channel's configuration at once, then check the acks, which arrive in order
+    for (index = 0; index < MAX_EPROBE_CHANNELS; index++) {
+        commands[index * 3 + 0] = CMD_CONFIG;
+        commands[index * 3 + 1] = index;
+        commands[index * 3 + 2] = mFields[index];
+    }
+    if (!writeAll(commands, sizeof(commands))) {
+        return false;
+    }
     for (index = 0; index < MAX_EPROBE_CHANNELS; index++) {
-        char command[] = { CMD_CONFIG, 0, 0 };
-        command[1] = index;
-        command[2] = mFields[index];
-        writeAll(command, sizeof(command));
-        readAck();
+        if (!readAck("the channel configuration")) {
+            return false;
+        }
     }
+    return true;
 }
 
 #if defined(WIN32)
@@ -19,26 +19,61 @@
 
 #include "Devices.h"
 
+#define EMETER_BUFFER_SIZE  64
+// Responses to commands are read ahead into a buffer of this size
+#define EMETER_CONTROL_BUFFER_SIZE 256
+
+// Raw serial taps start with this header, followed by the bytes read from the device after CMD_START
+#define EMETER_TAP_MAGIC    "CAIMTAP"
+#define EMETER_TAP_VERSION  1
+
 class EnergyProbe : public Device
 {
 public:
-    EnergyProbe(const char *outputPath, FILE *binfile, Fifo *fifo);
+    EnergyProbe(const char *outputPath);
     virtual ~EnergyProbe();
 
     virtual void prepareChannels();
     virtual void init(const char *devicename);
     virtual void start();
     virtual void stop();
+    virtual void pause();
     virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+    // Decodes raw bytes as read from the device; used by processBuffer and caiman_replay
+    void decodeBuffer(const char *inBuffer, int inLength);
+    void resetDecoder();
+
+    // Tee raw bytes read while running to tap, which must stay open for the life of this object
+    void setTapFile(FILE *tap)
+    {
+        mTapFile = tap;
+    }
+    // Returns the length of the tap header and configures gSessionData from it, or -1 if invalid
+    static int readTapHeader(const char *tap, unsigned int size);
 
 private:
-    int readAll(char *ptr, size_t size); // returns number of bytes read
-    void readAck();
-    void readString(char *buffer, int limit);
-    int writeAll(char *ptr, size_t size); // returns num bytes written
-    void writeChar(char c);
-    void syncToDevice();
-    void enableChannels();
+    int readAll(char *ptr, size_t size, bool *stalled); // returns number of bytes read, setting stalled if the stream stopped first
+    int readTimeout(char *ptr, size_t size, int timeoutMs); // returns number of bytes read, 0 on timeout or -1 on error
+    bool hasData(); // returns true if a read would not wait
+    // The following log an error and return false on failure, leaving the caller to decide whether it is fatal
+    bool fillControl(uint64_t deadline, const char *what);
+    bool readControlByte(uint64_t deadline, const char *what, unsigned char *c);
+    bool readControl(char *ptr, size_t size, const char *what);
+    bool readAck(const char *what);
+    bool readString(char *buffer, int limit, const char *what);
+    bool writeAll(const char *ptr, size_t size);
+    bool writeChar(char c, const char *what);
+    bool openDevice();
+    bool syncToDevice();
+    bool enableChannels();
+    void writeTapHeader();
+    // Reopens and restarts the device after the stream stalls, returning the number of samples lost meanwhile
+    uint64_t restart();
+    // Fills the gap left by restart in the samples by repeating the last sample
+    void writeGap(uint64_t frames);
 
     // Returns pointer to device string
     char* autoDetectDevice();
@@ -48,11 +83,34 @@ private:
 
     // Initialized on construction
     bool mIsRunning;
+    bool mIsPaused;
+    FILE *mTapFile;
+    DEVICE mStream;
+
+    // Decoder state, reset on start()
+    int mRemaining;
+    unsigned short mOutFrame;
+    unsigned char mLastValue[MAX_FIELDS][EMETER_DATA_SIZE];
+    char mOutBuffer[2 * EMETER_BUFFER_SIZE];
+
+    // Bytes read from the device but not yet consumed, mCtrlStart to mCtrlEnd
+    char mCtrlBuffer[EMETER_CONTROL_BUFFER_SIZE];
+    int mCtrlStart;
+    int mCtrlEnd;
+
+    // When sample data was last read, to size the gap after recovering from a stall
+    uint64_t mLastDataTime;
+    // Timeout the device was last set to wait for reads on Windows, or -1 once opened
+    int mReadTimeoutMs;
+    // restart() is retrying, so failures are logged as messages rather than errors
+    bool mRecovering;
 
     // Initialized on init()
-    DEVICE mStream;
     const char *mComport;
+
+    // Initialized on prepareChannels()
     char mFields[MAX_EPROBE_CHANNELS];
+    float mScaleFactors[MAX_FIELDS];
 
     // Intentionally unimplemented
     EnergyProbe(const EnergyProbe &);
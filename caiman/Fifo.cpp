@@ -26,6 +26,8 @@
 Fifo::Fifo(int singleBufferSize, int bufferSize, sem_t* readerSem)
 {
     mWrite = mRead = mReadCommit = mRaggedEnd = 0;
+    mOccupancy.store(0);
+    mHighWater.store(0);
     mWrapThreshold = bufferSize;
     mSingleBufferSize = singleBufferSize;
     mReaderSem = readerSem;
@@ -103,6 +105,12 @@ char* Fifo::write(int length)
         mWrite = 0;
     }
 
+    // track the most data ever waiting to be read
+    const int filled = mOccupancy.fetch_add(length, std::memory_order_relaxed) + length;
+    if (filled > mHighWater.load(std::memory_order_relaxed)) {
+        mHighWater.store(filled, std::memory_order_relaxed);
+    }
+
     // send a notification that data is ready
     sem_post(mReaderSem);
 
@@ -117,6 +125,7 @@ char* Fifo::write(int length)
 void Fifo::release()
 {
     // update the read pointer now that the data has been handled
+    mOccupancy.fetch_sub(mReadCommit - mRead, std::memory_order_relaxed);
     mRead = mReadCommit;
 
     // handle the wrap-around
@@ -128,6 +137,13 @@ void Fifo::release()
     sem_post(&mWaitForSpaceSem);
 }
 
+void Fifo::reset()
+{
+    mWrite = mRead = mReadCommit = mRaggedEnd = 0;
+    mOccupancy.store(0);
+    mEnd = false;
+}
+
 // This function will return null if no data is available
 char* Fifo::read(int * const length)
 {
@@ -28,12 +28,27 @@
 #include <semaphore.h>
 #endif
 
+#include <atomic>
+
 class Fifo
 {
 public:
     Fifo(int singleBufferSize, int totalBufferSize, sem_t* readerSem);
     ~Fifo();
     int numBytesFilled() const;
+    int getSize() const
+    {
+        return mWrapThreshold;
+    }
+    // Unlike numBytesFilled, safe to call from any thread
+    int getOccupancy() const
+    {
+        return mOccupancy.load(std::memory_order_relaxed);
+    }
+    int getHighWater() const
+    {
+        return mHighWater.load(std::memory_order_relaxed);
+    }
     bool isEmpty() const;
     bool isFull() const;
     bool willFill(int additional) const;
@@ -41,9 +56,14 @@ public:
     char* write(int length);
     void release();
     char* read(int * const length);
+    // Discards all data; only call while neither the reader nor the writer is active
+    void reset();
 
 private:
     int mSingleBufferSize, mWrite, mRead, mReadCommit, mRaggedEnd, mWrapThreshold;
+    // Kept for other threads, as the positions above are only consistent to the reader and writer
+    std::atomic<int> mOccupancy;
+    std::atomic<int> mHighWater;
     sem_t mWaitForSpaceSem;
     sem_t* mReaderSem;
     char* mBuffer;
@@ -0,0 +1,315 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorder.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <direct.h>
+#define MKDIR(PATH) _mkdir(PATH)
+#else
+#include <sys/stat.h>
+#define MKDIR(PATH) mkdir(PATH, 0755)
+#endif
+
+#include "Logging.h"
+#include "Markers.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+#include "Thread.h"
+
+FlightRecorderSink::FlightRecorderSink(const char *outputPath, const char *xml, unsigned int sampleRate, int numFields,
+                                       unsigned int preSeconds, unsigned int postSeconds)
+        : mOutputPath(outputPath),
+          mXML(xml),
+          mSampleRate(sampleRate),
+          mSampleSize(numFields * sizeof(int32_t)),
+          mPreSamples((uint64_t) preSeconds * sampleRate),
+          mPostSamples((uint64_t) postSeconds * sampleRate),
+          mCondition(NULL),
+          mMarkers(NULL),
+          mRing(NULL),
+          // One dump, as it is copied out as soon as the last sample after a trigger is added, plus one so the ring is never empty
+          mRingSamples((uint64_t) (preSeconds + postSeconds) * sampleRate + 1),
+          mSamples(0),
+          mPartialLength(0),
+          mMarkersSeen(0),
+          mRequest(NULL),
+          mTriggered(false),
+          mReason(NULL),
+          mTriggerSample(0),
+          mDump(NULL),
+          mDumpFirst(0),
+          mDumpSamples(0),
+          mDumpTrigger(0),
+          mDumpReason(NULL),
+          mNextDump(1),
+          mWriterBusy(false),
+          mStopping(false),
+          mTriggers(0),
+          mMerged(0),
+          mDumps(0),
+          mDropped(0)
+{
+    // Allocated up front, so a trigger never waits for memory
+    const size_t bytes = mRingSamples * mSampleSize;
+    mRing = (char *) malloc(bytes);
+    mDump = (char *) malloc(bytes);
+    if (mRing == NULL || mDump == NULL) {
+        logg.logError("Unable to allocate %llu bytes for the flight recorder", (unsigned long long) (2 * bytes));
+        handleException();
+    }
+
+    if (sem_init(&mWriterSem, 0, 0)) {
+        logg.logError("sem_init() failed");
+        handleException();
+    }
+    if (!THREAD_CREATE(mWriterThread, writerThread, this)) {
+        logg.logError("Failed to create flight recorder thread");
+        handleException();
+    }
+}
+
+FlightRecorderSink::~FlightRecorderSink()
+{
+    finish();
+    sem_destroy(&mWriterSem);
+    free(mRing);
+    free(mDump);
+}
+
+void FlightRecorderSink::trigger(const char *reason)
+{
+    mRequest.store(reason, std::memory_order_release);
+}
+
+void FlightRecorderSink::startTrigger(const char *reason)
+{
+    Stats::add(mTriggers, 1);
+    if (mTriggered) {
+        Stats::add(mMerged, 1);
+        return;
+    }
+
+    mTriggered = true;
+    mReason = reason;
+    mTriggerSample = mSamples;
+    logg.logMessage("Flight recorder triggered by %s at sample %llu", reason, (unsigned long long) mSamples);
+}
+
+void FlightRecorderSink::addSample(const char *sample)
+{
+    if (mCondition != NULL) {
+        int32_t value;
+        // Values are little endian, as are all supported hosts
+        memcpy(&value, sample + mCondition->getSource() * sizeof(value), sizeof(value));
+        if (mCondition->crossed(value)) {
+            startTrigger("threshold");
+        }
+    }
+
+    memcpy(&mRing[(mSamples % mRingSamples) * mSampleSize], sample, mSampleSize);
+    mSamples++;
+
+    if (mTriggered && mSamples >= mTriggerSample + mPostSamples) {
+        dump();
+    }
+}
+
+void FlightRecorderSink::write(const char *buf, size_t size)
+{
+    if (mSampleSize == 0) {
+        return;
+    }
+
+    if (mRequest.load(std::memory_order_relaxed) != NULL) {
+        const char * const reason = mRequest.exchange(NULL, std::memory_order_acquire);
+        if (reason != NULL) {
+            startTrigger(reason);
+        }
+    }
+    if (mMarkers != NULL && mMarkers->getReceived() != mMarkersSeen) {
+        mMarkersSeen = mMarkers->getReceived();
+        startTrigger("marker");
+    }
+
+    // Finish a sample split by the last write
+    if (mPartialLength > 0) {
+        size_t length = mSampleSize - mPartialLength;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(&mPartial[mPartialLength], buf, length);
+        mPartialLength += length;
+        buf += length;
+        size -= length;
+        if (mPartialLength < mSampleSize) {
+            return;
+        }
+        addSample(mPartial);
+        mPartialLength = 0;
+    }
+
+    for (; size >= mSampleSize; size -= mSampleSize) {
+        addSample(buf);
+        buf += mSampleSize;
+    }
+
+    memcpy(mPartial, buf, size);
+    mPartialLength = size;
+}
+
+void FlightRecorderSink::dump()
+{
+    mTriggered = false;
+
+    if (mWriterBusy.load(std::memory_order_acquire)) {
+        logg.logMessage("Flight recorder dump dropped, the previous dump is still being written");
+        Stats::add(mDropped, 1);
+        return;
+    }
+
+    // Older samples may not have been captured yet, or may already be overwritten
+    uint64_t first = mTriggerSample > mPreSamples ? mTriggerSample - mPreSamples : 0;
+    if (mSamples > mRingSamples && first < mSamples - mRingSamples) {
+        first = mSamples - mRingSamples;
+    }
+
+    mDumpFirst = first;
+    mDumpSamples = mSamples - first;
+    mDumpTrigger = mTriggerSample;
+    mDumpReason = mReason;
+    for (uint64_t copied = 0; copied < mDumpSamples;) {
+        const uint64_t pos = (first + copied) % mRingSamples;
+        uint64_t count = mRingSamples - pos;
+        if (count > mDumpSamples - copied) {
+            count = mDumpSamples - copied;
+        }
+        memcpy(&mDump[copied * mSampleSize], &mRing[pos * mSampleSize], count * mSampleSize);
+        copied += count;
+    }
+
+    mWriterBusy.store(true, std::memory_order_release);
+    sem_post(&mWriterSem);
+}
+
+void *FlightRecorderSink::writerThread(void *pVoid)
+{
+    FlightRecorderSink * const recorder = (FlightRecorderSink *) pVoid;
+
+    gStats.registerThread("flight");
+    recorder->writeDumps();
+
+    return 0;
+}
+
+void FlightRecorderSink::writeDumps()
+{
+    for (;;) {
+        sem_wait(&mWriterSem);
+        if (mWriterBusy.load(std::memory_order_acquire)) {
+            writeDump();
+            mWriterBusy.store(false, std::memory_order_release);
+        }
+        if (mStopping) {
+            break;
+        }
+    }
+}
+
+void FlightRecorderSink::writeDump()
+{
+    char path[CAIMAN_PATH_MAX + 1];
+    unsigned long long index = mNextDump;
+
+    // Never write into a dump left by an earlier run
+    for (;; ++index) {
+        snprintf(path, CAIMAN_PATH_MAX, "%sflight_%04llu", mOutputPath, index);
+        if (MKDIR(path) == 0) {
+            break;
+        }
+        if (errno != EEXIST) {
+            logg.logError("Unable to create %s: %s", path, strerror(errno));
+            handleException();
+        }
+    }
+    mNextDump = index + 1;
+
+    snprintf(path, CAIMAN_PATH_MAX, "%sflight_%04llu/0000000000", mOutputPath, index);
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || fwrite(mDump, mSampleSize, mDumpSamples, file) != mDumpSamples) {
+        logg.logError("Unable to write %s", path);
+        handleException();
+    }
+    fclose(file);
+
+    snprintf(path, CAIMAN_PATH_MAX, "%sflight_%04llu/captured.xml", mOutputPath, index);
+    file = fopen(path, "wt");
+    if (file == NULL) {
+        logg.logError("Unable to create %s", path);
+        handleException();
+    }
+    fputs(mXML, file);
+    fclose(file);
+
+    // Sample numbers count from the start of acquisition
+    snprintf(path, CAIMAN_PATH_MAX, "%sflight_%04llu/trigger.xml", mOutputPath, index);
+    file = fopen(path, "wt");
+    if (file == NULL) {
+        logg.logError("Unable to create %s", path);
+        handleException();
+    }
+    fprintf(file, "<?xml version=\"1.0\" encoding='UTF-8'?>\n");
+    fprintf(file, "<trigger version=\"1\" reason=\"%s\" sample=\"%llu\" first_sample=\"%llu\" samples=\"%llu\" sample_rate=\"%u\"/>\n",
+            mDumpReason, (unsigned long long) mDumpTrigger, (unsigned long long) mDumpFirst, (unsigned long long) mDumpSamples,
+            mSampleRate);
+    fclose(file);
+
+    logg.logMessage("Flight recorder wrote %llu samples to %sflight_%04llu", (unsigned long long) mDumpSamples, mOutputPath, index);
+    Stats::add(mDumps, 1);
+}
+
+void FlightRecorderSink::finish()
+{
+    if (mStopping) {
+        return;
+    }
+
+    // The writer finishes any dump it was given before stopping
+    mStopping = true;
+    sem_post(&mWriterSem);
+    THREAD_JOIN(mWriterThread);
+
+    // Keep what there is of the samples after a trigger at shutdown
+    if (mTriggered) {
+        dump();
+        writeDump();
+        mWriterBusy.store(false);
+    }
+}
+
+int FlightRecorderSink::appendXML(char *xml, int pos, int size) const
+{
+    pos = appendFormat(xml, pos, size, "  <flight_recorder pre_samples=\"%llu\" post_samples=\"%llu\" triggers=\"%llu\" merged=\"%llu\" dumps=\"%llu\" dropped=\"%llu\"/>\n",
+                       (unsigned long long) mPreSamples, (unsigned long long) mPostSamples, (unsigned long long) mTriggers.load(),
+                       (unsigned long long) mMerged.load(), (unsigned long long) mDumps.load(), (unsigned long long) mDropped.load());
+
+    return pos;
+}
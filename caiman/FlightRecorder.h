@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "Fifo.h"
+#include "SessionData.h"
+#include "Sinks.h"
+#include "Trigger.h"
+
+class MarkerSink;
+
+// Keeps the most recent samples in memory and writes nothing until triggered. Each trigger writes the samples from
+// preSeconds before it to postSeconds after it as a capture in its own directory, flight_NNNN in the output path, on a
+// background thread. Triggers while the samples after an earlier one are still being kept are merged into it.
+class FlightRecorderSink : public Sink
+{
+public:
+    // xml is the captured.xml for each dump and must stay allocated for the life of this object
+    FlightRecorderSink(const char *outputPath, const char *xml, unsigned int sampleRate, int numFields, unsigned int preSeconds,
+                       unsigned int postSeconds);
+    virtual ~FlightRecorderSink();
+
+    virtual void write(const char *buf, size_t size);
+
+    // Triggers on the next write. reason must be a string literal. Safe to call from a signal handler.
+    void trigger(const char *reason);
+    // Triggers when condition is crossed; condition must stay allocated for the life of this object
+    void setCondition(TriggerCondition *condition)
+    {
+        mCondition = condition;
+    }
+    // Triggers on every marker received by markers
+    void setMarkers(const MarkerSink *markers)
+    {
+        mMarkers = markers;
+    }
+
+    // Writes any dump still being collected and waits for it to be written
+    void finish();
+
+    // Appends a <flight_recorder> element to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    static void *writerThread(void *pVoid);
+    void writeDumps();
+    void addSample(const char *sample);
+    void startTrigger(const char *reason);
+    void dump();
+    void writeDump();
+
+    const char * const mOutputPath;
+    const char * const mXML;
+    const unsigned int mSampleRate;
+    const size_t mSampleSize;
+    const uint64_t mPreSamples;
+    const uint64_t mPostSamples;
+    TriggerCondition *mCondition;
+    const MarkerSink *mMarkers;
+
+    // Ring of whole samples, only used by the thread writing samples
+    char *mRing;
+    uint64_t mRingSamples;
+    uint64_t mSamples;
+    char mPartial[MAX_FIELDS * sizeof(int32_t)];
+    size_t mPartialLength;
+    uint64_t mMarkersSeen;
+
+    std::atomic<const char *> mRequest;
+    // Set while the samples after a trigger are being kept
+    bool mTriggered;
+    const char *mReason;
+    uint64_t mTriggerSample;
+
+    // Handed to the writer thread once complete
+    char *mDump;
+    uint64_t mDumpFirst;
+    uint64_t mDumpSamples;
+    uint64_t mDumpTrigger;
+    const char *mDumpReason;
+    // Only used by the thread writing dumps
+    unsigned long long mNextDump;
+    std::atomic<bool> mWriterBusy;
+    bool mStopping;
+    sem_t mWriterSem;
+#if defined(WIN32)
+    HANDLE mWriterThread;
+#else
+    pthread_t mWriterThread;
+#endif
+
+    std::atomic<uint64_t> mTriggers;
+    std::atomic<uint64_t> mMerged;
+    std::atomic<uint64_t> mDumps;
+    std::atomic<uint64_t> mDropped;
+
+    // Intentionally unimplemented
+    FlightRecorderSink(const FlightRecorderSink &);
+    FlightRecorderSink &operator=(const FlightRecorderSink &);
+};
+
+#endif // FLIGHT_RECORDER_H
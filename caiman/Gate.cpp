@@ -0,0 +1,327 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Gate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Latency.h"
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+
+// Most XML written for one segment
+#define SEGMENT_XML_MAX 160
+
+GateSink::GateSink(TriggerCondition *condition, unsigned int sampleRate, int numFields, unsigned int preMs, unsigned int postMs,
+                   unsigned int holdoffMs)
+        : mCondition(condition),
+          mSampleRate(sampleRate),
+          mSampleSize(numFields * sizeof(int32_t)),
+          mPreSamples((uint64_t) preMs * sampleRate / 1000),
+          mPostSamples((uint64_t) postMs * sampleRate / 1000),
+          mHoldoffSamples((uint64_t) holdoffMs * sampleRate / 1000),
+          mNumSinks(0),
+          mQueued(false),
+          mRing(NULL),
+          mSegments(NULL),
+          mNumSegments(0),
+          mOpened(0),
+          mSamples(0),
+          mSamplesPassed(0),
+          mOpenStart(UINT64_MAX),
+          mOpenOffset(0)
+{
+    if (mPreSamples > 0) {
+        mRing = (char *) malloc(mPreSamples * mSampleSize);
+        if (mRing == NULL) {
+            logg.logError("Unable to allocate %llu bytes for the pre-trigger margin", (unsigned long long) (mPreSamples * mSampleSize));
+            handleException();
+        }
+    }
+
+    mSegments = (Segment *) malloc(MAX_SEGMENTS * sizeof(Segment));
+    if (mSegments == NULL) {
+        logg.logError("Unable to allocate %d bytes for segments", (int) (MAX_SEGMENTS * sizeof(Segment)));
+        handleException();
+    }
+    reset();
+}
+
+GateSink::~GateSink()
+{
+    free(mRing);
+    free(mSegments);
+}
+
+void GateSink::addSink(Sink *sink)
+{
+    if (mNumSinks >= MAX_SINKS) {
+        logg.logError("Too many gated outputs, at most %d are supported", MAX_SINKS);
+        handleException();
+    }
+    mSinks[mNumSinks++] = sink;
+    mQueued = mQueued || sink->isQueued();
+}
+
+void GateSink::reset()
+{
+    for (int i = 0; i < mNumSinks; i++) {
+        mSinks[i]->reset();
+    }
+
+    // Each capture starts closed, waiting for a crossing
+    mCondition->reset();
+    mLocalSamples = 0;
+    mOpen = false;
+    mLastActive = 0;
+    mHoldoffEnd = 0;
+    mPassed = 0;
+    mPartialLength = 0;
+    mRingStart = 0;
+    mRingUsed = 0;
+    mNumSegments.store(0, std::memory_order_release);
+    mOpened.store(0, std::memory_order_relaxed);
+    mSamples.store(0, std::memory_order_relaxed);
+    mSamplesPassed.store(0, std::memory_order_relaxed);
+    mOpenStart.store(UINT64_MAX, std::memory_order_relaxed);
+    mOpenOffset.store(0, std::memory_order_relaxed);
+}
+
+void GateSink::write(const char *buf, size_t size)
+{
+    // Finish a sample split by the last write
+    if (mPartialLength > 0) {
+        size_t length = mSampleSize - mPartialLength;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(&mPartial[mPartialLength], buf, length);
+        mPartialLength += length;
+        buf += length;
+        size -= length;
+        if (mPartialLength < mSampleSize) {
+            return;
+        }
+        process(mPartial, 1);
+        mPartialLength = 0;
+    }
+
+    const uint64_t count = size / mSampleSize;
+    process(buf, count);
+    buf += count * mSampleSize;
+    size -= count * mSampleSize;
+
+    memcpy(mPartial, buf, size);
+    mPartialLength = size;
+
+    mSamples.store(mLocalSamples, std::memory_order_relaxed);
+}
+
+void GateSink::process(const char *buf, uint64_t count)
+{
+    const int source = mCondition->getSource();
+    // Consecutive samples on the same side of the gate are passed on or kept together
+    const char *run = buf;
+
+    for (uint64_t i = 0; i < count; i++) {
+        const char * const sample = buf + i * mSampleSize;
+        int32_t value;
+        // Values are little endian, as are all supported hosts
+        memcpy(&value, sample + source * sizeof(value), sizeof(value));
+        const bool crossed = mCondition->crossed(value);
+
+        if (!mOpen) {
+            if (crossed && mLocalSamples >= mHoldoffEnd) {
+                keep(run, (sample - run) / mSampleSize);
+                open();
+                run = sample;
+                mLastActive = mLocalSamples;
+            }
+        }
+        else if (mCondition->isPast()) {
+            mLastActive = mLocalSamples;
+        }
+        else if (mLocalSamples - mLastActive > mPostSamples) {
+            pass(run, (sample - run) / mSampleSize);
+            close();
+            run = sample;
+        }
+        mLocalSamples++;
+    }
+
+    const uint64_t remaining = (buf + count * mSampleSize - run) / mSampleSize;
+    if (mOpen) {
+        pass(run, remaining);
+    }
+    else {
+        keep(run, remaining);
+    }
+}
+
+void GateSink::keep(const char *buf, uint64_t count)
+{
+    if (mPreSamples == 0 || count == 0) {
+        return;
+    }
+
+    // Only the most recent samples of a long run are needed
+    if (count >= mPreSamples) {
+        memcpy(mRing, buf + (count - mPreSamples) * mSampleSize, mPreSamples * mSampleSize);
+        mRingStart = 0;
+        mRingUsed = mPreSamples;
+        return;
+    }
+
+    // Drop the oldest samples to make room
+    if (mRingUsed + count > mPreSamples) {
+        const uint64_t drop = mRingUsed + count - mPreSamples;
+        mRingStart = (mRingStart + drop) % mPreSamples;
+        mRingUsed -= drop;
+    }
+
+    uint64_t pos = (mRingStart + mRingUsed) % mPreSamples;
+    while (count > 0) {
+        const uint64_t length = count < mPreSamples - pos ? count : mPreSamples - pos;
+        memcpy(&mRing[pos * mSampleSize], buf, length * mSampleSize);
+        mRingUsed += length;
+        buf += length * mSampleSize;
+        count -= length;
+        pos = 0;
+    }
+}
+
+void GateSink::pass(const char *buf, uint64_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    const size_t size = count * mSampleSize;
+    // The device only accounted for the samples reaching the sender thread if they all do
+    if (mQueued) {
+        gLatency.markQueued(size);
+    }
+    for (int i = 0; i < mNumSinks; i++) {
+        mSinks[i]->write(buf, size);
+    }
+    mPassed += count;
+    mSamplesPassed.store(mPassed, std::memory_order_relaxed);
+}
+
+void GateSink::open()
+{
+    mOpen = true;
+    mOpenOffset.store(mPassed, std::memory_order_relaxed);
+    mOpenStart.store(mLocalSamples - mRingUsed, std::memory_order_release);
+    Stats::add(mOpened, 1);
+
+    // The pre-trigger margin, oldest first
+    while (mRingUsed > 0) {
+        uint64_t length = mPreSamples - mRingStart;
+        if (length > mRingUsed) {
+            length = mRingUsed;
+        }
+        pass(&mRing[mRingStart * mSampleSize], length);
+        mRingStart = (mRingStart + length) % mPreSamples;
+        mRingUsed -= length;
+    }
+    mRingStart = 0;
+}
+
+void GateSink::close()
+{
+    mOpen = false;
+    mHoldoffEnd = mLocalSamples + mHoldoffSamples;
+
+    const int numSegments = mNumSegments.load(std::memory_order_relaxed);
+    if (numSegments < MAX_SEGMENTS) {
+        Segment * const segment = &mSegments[numSegments];
+        segment->start = mOpenStart.load(std::memory_order_relaxed);
+        segment->end = mLocalSamples;
+        segment->offset = mOpenOffset.load(std::memory_order_relaxed);
+        mNumSegments.store(numSegments + 1, std::memory_order_release);
+    }
+    mOpenStart.store(UINT64_MAX, std::memory_order_release);
+}
+
+int GateSink::appendSegments(char *xml, int pos, int size, const char *indent, int first) const
+{
+    const int numSegments = mNumSegments.load(std::memory_order_acquire);
+    const uint64_t samples = mSamples.load(std::memory_order_relaxed);
+    const uint64_t openStart = mOpenStart.load(std::memory_order_acquire);
+    const uint64_t openOffset = mOpenOffset.load(std::memory_order_relaxed);
+
+    pos = appendFormat(xml, pos, size, "%s<segments sample_rate=\"%u\" opened=\"%llu\" kept=\"%d\" samples=\"%llu\" passed=\"%llu\">\n",
+                       indent, mSampleRate, (unsigned long long) mOpened.load(), numSegments, (unsigned long long) samples,
+                       (unsigned long long) mSamplesPassed.load());
+    for (int i = first; i < numSegments && size - pos > 2 * SEGMENT_XML_MAX; i++) {
+        const Segment &segment = mSegments[i];
+        pos = appendFormat(xml, pos, size, "%s  <segment start=\"%llu\" end=\"%llu\" offset=\"%llu\" time_s=\"%.6f\"/>\n", indent,
+                           (unsigned long long) segment.start, (unsigned long long) segment.end, (unsigned long long) segment.offset,
+                           (double) segment.start / mSampleRate);
+    }
+    // The segment being passed on, which ends at the latest sample for now
+    if (openStart != UINT64_MAX) {
+        pos = appendFormat(xml, pos, size, "%s  <open start=\"%llu\" offset=\"%llu\" time_s=\"%.6f\"/>\n", indent,
+                           (unsigned long long) openStart, (unsigned long long) openOffset, (double) openStart / mSampleRate);
+    }
+    pos = appendFormat(xml, pos, size, "%s</segments>\n", indent);
+
+    return pos;
+}
+
+int GateSink::appendXML(char *xml, int pos, int size) const
+{
+    // The stats are sent often, so only the latest segments are included; getXML has them all
+    const int numSegments = mNumSegments.load(std::memory_order_acquire);
+    return appendSegments(xml, pos, size, "  ", numSegments > SEGMENT_STATS_COUNT ? numSegments - SEGMENT_STATS_COUNT : 0);
+}
+
+char *GateSink::getXML(int * const length) const
+{
+    const int BUF_SIZE = (MAX_SEGMENTS + 4) * SEGMENT_XML_MAX;
+    char * const xml = (char *) malloc(BUF_SIZE);
+    if (xml == NULL) {
+        logg.logError("Unable to allocate memory for the segments");
+        handleException();
+    }
+
+    int pos = snprintf(xml, BUF_SIZE, "<?xml version=\"1.0\" encoding='UTF-8'?>\n");
+    pos = appendSegments(xml, pos, BUF_SIZE, "", 0);
+
+    *length = pos;
+    return xml;
+}
+
+void GateSink::writeXML(const char *outputPath) const
+{
+    char filename[CAIMAN_PATH_MAX + 1];
+    snprintf(filename, CAIMAN_PATH_MAX, "%ssegments.xml", outputPath);
+    FILE * const xmlout = fopen(filename, "wt");
+    if (xmlout == NULL) {
+        logg.logError("Unable to create %s", filename);
+        handleException();
+    }
+
+    int length;
+    char * const xml = getXML(&length);
+    fputs(xml, xmlout);
+    free(xml);
+    fclose(xmlout);
+}
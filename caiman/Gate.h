@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GATE_H
+#define GATE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "Devices.h"
+#include "SessionData.h"
+#include "Sinks.h"
+#include "Trigger.h"
+
+// Segments kept for segments.xml; later segments are still passed on but not kept
+#define MAX_SEGMENTS        1024
+// Most recent segments included in the stats
+#define SEGMENT_STATS_COUNT 16
+
+// Passes samples on to its own sinks only while a trigger condition holds. The gate opens when the condition is crossed,
+// taking the preceding preMs of samples with it, and closes once the condition has not held for postMs. After closing it
+// ignores crossings for holdoffMs. Each stretch passed on is recorded as a segment, giving the index of its first sample
+// from the start of acquisition and its offset in the gated stream, so the samples can be placed back in time.
+class GateSink : public Sink
+{
+public:
+    // condition must be resolved and stay allocated for the life of this object
+    GateSink(TriggerCondition *condition, unsigned int sampleRate, int numFields, unsigned int preMs, unsigned int postMs,
+             unsigned int holdoffMs);
+    virtual ~GateSink();
+
+    // Adds a consumer of the gated samples, as for Device::addSink
+    void addSink(Sink *sink);
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // Appends a <segments> element with the most recent segments to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+    // Returns a document with every kept segment, which the caller must free
+    char *getXML(int * const length) const;
+    // Writes getXML to segments.xml in outputPath
+    void writeXML(const char *outputPath) const;
+
+private:
+    struct Segment
+    {
+        // Index of the first sample and of the sample after the last, from the start of acquisition
+        uint64_t start;
+        uint64_t end;
+        // Index of the first sample in the gated stream
+        uint64_t offset;
+    };
+
+    void process(const char *buf, uint64_t count);
+    void keep(const char *buf, uint64_t count);
+    void pass(const char *buf, uint64_t count);
+    void open();
+    void close();
+    int appendSegments(char *xml, int pos, int size, const char *indent, int first) const;
+
+    TriggerCondition * const mCondition;
+    const unsigned int mSampleRate;
+    const size_t mSampleSize;
+    const uint64_t mPreSamples;
+    const uint64_t mPostSamples;
+    const uint64_t mHoldoffSamples;
+    Sink *mSinks[MAX_SINKS];
+    int mNumSinks;
+    bool mQueued;
+
+    // Only used by the thread writing samples
+    uint64_t mLocalSamples;
+    bool mOpen;
+    // Last sample at which the condition held while open
+    uint64_t mLastActive;
+    // Crossings before this sample are ignored
+    uint64_t mHoldoffEnd;
+    uint64_t mPassed;
+    // A sample split between writes
+    char mPartial[MAX_FIELDS * sizeof(int32_t)];
+    size_t mPartialLength;
+    // Ring of the most recent whole samples while closed, for the pre-trigger margin
+    char *mRing;
+    uint64_t mRingStart;
+    uint64_t mRingUsed;
+
+    // Entries below mNumSegments are complete and never change again
+    Segment *mSegments;
+    std::atomic<int> mNumSegments;
+    std::atomic<uint64_t> mOpened;
+    std::atomic<uint64_t> mSamples;
+    std::atomic<uint64_t> mSamplesPassed;
+    // Start and offset of the open segment, with start at UINT64_MAX while closed
+    std::atomic<uint64_t> mOpenStart;
+    std::atomic<uint64_t> mOpenOffset;
+
+    // Intentionally unimplemented
+    GateSink(const GateSink &);
+    GateSink &operator=(const GateSink &);
+};
+
+#endif // GATE_H
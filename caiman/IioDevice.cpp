@@ -0,0 +1,494 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "IioDevice.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "Logging.h"
+#include "Stats.h"
+#include "Sysfs.h"
+
+// Longest time readRaw waits for data, so gQuit is noticed promptly
+#define MAX_POLL_MS 10
+#define MAX_SLEEP_US 10000
+// Longest value read from a sysfs attribute
+#define VALUE_SIZE 32
+// Fewest scans the kernel buffer is given room for
+#define MIN_BUFFER_SCANS 128
+
+IioDevice::IioDevice(const char *outputPath, const char *sysfsRoot, const char *devRoot, const char *device, unsigned int rate)
+        : Device(outputPath),
+          mSysfsRoot(sysfsRoot),
+          mDevRoot(devRoot),
+          mRate(rate),
+          mNumElements(0),
+          mNumSources(0),
+          mScanSize(0),
+          mFd(-1),
+          mBufferEnabled(false),
+          mPartialLength(0)
+{
+#if defined(WIN32)
+    (void) device;
+    logg.logError("Linux IIO devices are not supported on Windows");
+    handleException();
+#else
+    findDevice(device);
+    findSources();
+
+    // A requested rate is only written once the channels are prepared, but is needed before then
+    mSampleRate = mRate;
+    if (mSampleRate == 0) {
+        char path[CAIMAN_PATH_MAX];
+        char line[VALUE_SIZE];
+        if (!formatPath(path, "%s/sampling_frequency", mDevicePath) || !readLine(path, line, sizeof(line))) {
+            logg.logError("%s has no sampling_frequency, please give the rate with --iio-rate", mDevicePath);
+            handleException();
+        }
+        mSampleRate = (unsigned int) lround(strtod(line, NULL));
+        if (mSampleRate == 0) {
+            logg.logError("%s has a sampling_frequency of %s, please give the rate with --iio-rate", mDevicePath, line);
+            handleException();
+        }
+    }
+#endif
+}
+
+IioDevice::~IioDevice()
+{
+#if !defined(WIN32)
+    char path[CAIMAN_PATH_MAX];
+    if (mBufferEnabled && formatPath(path, "%s/buffer/enable", mDevicePath)) {
+        writeLine(path, "0");
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+#endif
+}
+
+void IioDevice::findDevice(const char *device)
+{
+    char dirPath[CAIMAN_PATH_MAX];
+    char path[CAIMAN_PATH_MAX];
+    char name[IIO_NAME_SIZE];
+    char *entries[SYSFS_MAX_ENTRIES];
+
+    mDeviceName[0] = '\0';
+    const int count = formatPath(dirPath, "%s/bus/iio/devices", mSysfsRoot) ? listDirectory(dirPath, entries) : 0;
+    for (int i = 0; i < count; i++) {
+        // Either the directory, which is also the name of the character device, or the name of the part
+        if (mDeviceName[0] == '\0' && strlen(entries[i]) < sizeof(mDeviceName) && formatPath(mDevicePath, "%s/%s", dirPath, entries[i]) &&
+            (strcmp(entries[i], device) == 0 ||
+             (formatPath(path, "%s/name", mDevicePath) && readLine(path, name, sizeof(name)) && strcmp(name, device) == 0))) {
+            strcpy(mDeviceName, entries[i]);
+        }
+        free(entries[i]);
+    }
+
+    if (mDeviceName[0] == '\0') {
+        logg.logError("No IIO device named %s found in %s", device, dirPath);
+        handleException();
+    }
+}
+
+void IioDevice::findSources()
+{
+    static const struct
+    {
+        const char *type;
+        int field;
+    } types[] = {
+        { "voltage", VOLTAGE },
+        { "current", CURRENT },
+        { "power", POWER },
+    };
+
+    char dirPath[CAIMAN_PATH_MAX];
+    char path[CAIMAN_PATH_MAX];
+    char line[VALUE_SIZE];
+    char *entries[SYSFS_MAX_ENTRIES];
+
+    const int count = formatPath(dirPath, "%s/scan_elements", mDevicePath) ? listDirectory(dirPath, entries) : 0;
+    for (int i = 0; i < count; i++) {
+        // Each scan element has <name>_en, <name>_index and <name>_type, e.g. in_voltage1_en
+        const size_t length = strlen(entries[i]);
+        if (length < 3 || strcmp(&entries[i][length - 3], "_en") != 0 || length - 3 >= IIO_NAME_SIZE) {
+            free(entries[i]);
+            continue;
+        }
+        if (mNumElements >= IIO_MAX_ELEMENTS) {
+            logg.logError("%s has too many scan elements, at most %d are supported", mDevicePath, IIO_MAX_ELEMENTS);
+            handleException();
+        }
+        char * const name = mElements[mNumElements++];
+        snprintf(name, IIO_NAME_SIZE, "%.*s", (int) (length - 3), entries[i]);
+        free(entries[i]);
+
+        int field = 0;
+        for (size_t j = 0; j < sizeof(types) / sizeof(types[0]); j++) {
+            const size_t typeLength = strlen(types[j].type);
+            if (strncmp(name, "in_", 3) == 0 && strncmp(&name[3], types[j].type, typeLength) == 0 && name[3 + typeLength] >= '0' &&
+                name[3 + typeLength] <= '9') {
+                field = types[j].field;
+            }
+        }
+        if (field == 0) {
+            continue;
+        }
+        if (mNumSources >= MAX_CHANNELS) {
+            logg.logMessage("Ignoring %s, at most %d channels are supported", name, MAX_CHANNELS);
+            continue;
+        }
+
+        Source * const source = &mSources[mNumSources];
+        snprintf(source->name, sizeof(source->name), "%s", name);
+        source->field = field;
+        if (!formatPath(path, "%s/%s_index", dirPath, name) || !readLine(path, line, sizeof(line)) ||
+            !stringToInt(&source->index, line, 10)) {
+            logg.logError("Unable to read the index of %s", name);
+            handleException();
+        }
+        if (!formatPath(path, "%s/%s_type", dirPath, name) || !readLine(path, line, sizeof(line)) || !parseType(line, source)) {
+            logg.logError("Unable to read the type of %s, or it is not supported", name);
+            handleException();
+        }
+        source->scale = readScale(*source, "scale", 1);
+        source->offset = readScale(*source, "offset", 0);
+        mNumSources++;
+    }
+
+    if (mNumSources == 0) {
+        logg.logError("%s has no voltage, current or power scan elements", mDevicePath);
+        handleException();
+    }
+
+    // Channels are numbered in scan order
+    for (int i = 1; i < mNumSources; i++) {
+        for (int j = i; j > 0 && mSources[j - 1].index > mSources[j].index; j--) {
+            const Source source = mSources[j];
+            mSources[j] = mSources[j - 1];
+            mSources[j - 1] = source;
+        }
+    }
+}
+
+bool IioDevice::parseType(const char *type, Source *source)
+{
+    // [be|le]:[s|u]bits/storagebits>>shift, e.g. le:s16/16>>0; repeated elements are not supported
+    char endian[3];
+    char sign;
+    int storageBits;
+    if (sscanf(type, "%2[bel]:%c%d/%d>>%d", endian, &sign, &source->bits, &storageBits, &source->shift) != 5 ||
+        (sign != 's' && sign != 'u') || (storageBits != 8 && storageBits != 16 && storageBits != 32 && storageBits != 64) ||
+        source->bits <= 0 || source->shift < 0 || source->bits + source->shift > storageBits) {
+        return false;
+    }
+    source->bigEndian = strcmp(endian, "be") == 0;
+    source->isSigned = sign == 's';
+    source->storageBytes = storageBits / 8;
+    return true;
+}
+
+double IioDevice::readScale(const Source &source, const char *attribute, double value) const
+{
+    // Either the element's own, e.g. in_voltage1_scale, or shared by its type, e.g. in_voltage_scale
+    char path[CAIMAN_PATH_MAX];
+    char line[VALUE_SIZE];
+    const int typeLength = (int) strcspn(source.name, "0123456789");
+    if ((formatPath(path, "%s/%s_%s", mDevicePath, source.name, attribute) && readLine(path, line, sizeof(line))) ||
+        (formatPath(path, "%s/%.*s_%s", mDevicePath, typeLength, source.name, attribute) && readLine(path, line, sizeof(line)))) {
+        value = strtod(line, NULL);
+    }
+    return value;
+}
+
+void IioDevice::writeAttribute(const char *attribute, const char *value) const
+{
+    char path[CAIMAN_PATH_MAX];
+    if (!formatPath(path, "%s/%s", mDevicePath, attribute) || !writeLine(path, value)) {
+#if !defined(WIN32)
+        if (errno == EACCES) {
+            logg.logError("Permission denied writing %s. caiman's user needs write access to the IIO device's attributes, e.g. "
+                          "'chmod -R a+w %s/scan_elements %s/buffer'.", path, mDevicePath, mDevicePath);
+            handleException();
+        }
+#endif
+        logg.logError("Unable to write %s to %s: %s", value, path, strerror(errno));
+        handleException();
+    }
+}
+
+void IioDevice::enableBuffer(bool enable)
+{
+    writeAttribute("buffer/enable", enable ? "1" : "0");
+    mBufferEnabled = enable;
+}
+
+int IioDevice::getSourceField(int source) const
+{
+    return mSources[source].field;
+}
+
+void IioDevice::prepareChannels()
+{
+    // Each channel has a single field, read from the source of the same number
+    bool used[MAX_CHANNELS] = { false };
+    mNumFields = 0;
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (!gSessionData.mCounterEnabled[index]) {
+            continue;
+        }
+        const int channel = gSessionData.mCounterChannel[index];
+        if (channel >= mNumSources) {
+            logg.logError("Channel %d was enabled but %s only has %d channels", channel, mDeviceName, mNumSources);
+            handleException();
+        }
+        mFieldSources[gSessionData.mCounterSource[index]] = channel;
+        used[channel] = true;
+        mNumFields++;
+    }
+
+    // Scan elements can only be changed while the buffer is disabled, which a previous user may have left enabled
+    enableBuffer(false);
+    char attribute[CAIMAN_PATH_MAX];
+    for (int i = 0; i < mNumElements; i++) {
+        bool enable = false;
+        for (int channel = 0; channel < mNumSources; channel++) {
+            enable = enable || (used[channel] && strcmp(mSources[channel].name, mElements[i]) == 0);
+        }
+        snprintf(attribute, sizeof(attribute), "scan_elements/%s_en", mElements[i]);
+        writeAttribute(attribute, enable ? "1" : "0");
+    }
+
+    // The kernel places each element at a multiple of its size, and pads the scan to a multiple of the largest
+    int size = 0;
+    int alignment = 1;
+    for (int channel = 0; channel < mNumSources; channel++) {
+        Source * const source = &mSources[channel];
+        if (!used[channel]) {
+            continue;
+        }
+        size = (size + source->storageBytes - 1) / source->storageBytes * source->storageBytes;
+        source->position = size;
+        size += source->storageBytes;
+        if (source->storageBytes > alignment) {
+            alignment = source->storageBytes;
+        }
+    }
+    mScanSize = (size + alignment - 1) / alignment * alignment;
+    if (mScanSize > IIO_MAX_SCAN_SIZE) {
+        logg.logError("A scan of %d bytes is too large, at most %d are supported", mScanSize, IIO_MAX_SCAN_SIZE);
+        handleException();
+    }
+
+    char value[VALUE_SIZE];
+    if (mRate > 0) {
+        snprintf(value, sizeof(value), "%u", mRate);
+        writeAttribute("sampling_frequency", value);
+    }
+    // Room for a second of scans, so reads can be large without the buffer overflowing
+    snprintf(value, sizeof(value), "%u", mSampleRate > MIN_BUFFER_SCANS ? mSampleRate : MIN_BUFFER_SCANS);
+    writeAttribute("buffer/length", value);
+
+    mVendor = "Linux IIO";
+    mDatasize = EMETER_DATA_SIZE;
+}
+
+void IioDevice::init(const char *devicename)
+{
+    (void) devicename;
+
+#if !defined(WIN32)
+    if (mFd < 0) {
+        char path[CAIMAN_PATH_MAX];
+        if (!formatPath(path, "%s/%s", mDevRoot, mDeviceName) || (mFd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+            logg.logError("Unable to open %s/%s: %s", mDevRoot, mDeviceName, strerror(errno));
+            handleException();
+        }
+    }
+#endif
+
+    for (int channel = 0; channel < mNumSources; channel++) {
+        const Source &source = mSources[channel];
+        logg.logMessage("Channel %d is %s, with a scale of %g and an offset of %g", channel, source.name, source.scale, source.offset);
+    }
+    logg.logMessage("IIO device %s with %d fields in %d byte scans at %u samples per second", mDeviceName, mNumFields, mScanSize,
+                    mSampleRate);
+}
+
+void IioDevice::start()
+{
+    mPartialLength = 0;
+    enableBuffer(true);
+}
+
+void IioDevice::stop()
+{
+    // Disabling the buffer also empties it, so the next capture starts afresh
+    enableBuffer(false);
+}
+
+void IioDevice::pause()
+{
+    stop();
+}
+
+void IioDevice::processBuffer()
+{
+    readRaw(&mBlock);
+    if (mBlock.length == 0) {
+        return;
+    }
+    markRead(mBlock.readTime);
+    decodeRaw(&mBlock);
+}
+
+void IioDevice::readRaw(RawBlock *block)
+{
+    block->length = 0;
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+
+#if !defined(WIN32)
+    struct pollfd pollFd;
+    pollFd.fd = mFd;
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+    const int ready = poll(&pollFd, 1, MAX_POLL_MS);
+    if (ready < 0 && errno != EINTR) {
+        logg.logError("Unable to poll %s: %s", mDeviceName, strerror(errno));
+        handleException();
+    }
+    if (ready <= 0) {
+        return;
+    }
+
+    // Only whole scans are read from the kernel buffer
+    const ssize_t length = read(mFd, block->data, sizeof(block->data) / mScanSize * mScanSize);
+    if (length < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return;
+        }
+        logg.logError("Unable to read %s: %s", mDeviceName, strerror(errno));
+        handleException();
+    }
+    if (length == 0) {
+        // Only seen when a test fixture stands in for the character device and has no writer
+        usleep(MAX_SLEEP_US);
+        return;
+    }
+
+    block->readTime = getTime();
+    block->length = (int) length;
+    Stats::add(gStats.mBytesRead, length);
+#endif
+}
+
+int32_t IioDevice::convert(const Source &source, const unsigned char *scan) const
+{
+    const unsigned char * const bytes = scan + source.position;
+    uint64_t raw = 0;
+    for (int i = 0; i < source.storageBytes; i++) {
+        raw = (raw << 8) | bytes[source.bigEndian ? i : source.storageBytes - 1 - i];
+    }
+    raw >>= source.shift;
+
+    int64_t value = (int64_t) raw;
+    if (source.bits < 64) {
+        const uint64_t mask = (UINT64_C(1) << source.bits) - 1;
+        raw &= mask;
+        value = (int64_t) raw;
+        if (source.isSigned && (raw >> (source.bits - 1)) != 0) {
+            value = (int64_t) (raw | ~mask);
+        }
+    }
+
+    // Once scaled, voltages are in millivolts, currents in milliamps and powers in milliwatts, as caiman's are
+    const double scaled = floor((value + source.offset) * source.scale + 0.5);
+    if (scaled > INT32_MAX || scaled < INT32_MIN) {
+        Stats::add(gStats.mOverflowClamps, 1);
+        return scaled > 0 ? INT32_MAX : INT32_MIN;
+    }
+    return (int32_t) scaled;
+}
+
+size_t IioDevice::decodeScan(const unsigned char *scan, size_t used)
+{
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+    if (used + sampleSize > IIO_BUFFER_SIZE) {
+        writeData(mOutBuffer, used);
+        used = 0;
+    }
+
+    // Values are little endian, as are all supported hosts
+    for (int field = 0; field < mNumFields; field++) {
+        const int32_t value = convert(mSources[mFieldSources[field]], scan);
+        memcpy(&mOutBuffer[used + field * sizeof(value)], &value, sizeof(value));
+    }
+    return used + sampleSize;
+}
+
+void IioDevice::decodeRaw(const RawBlock *block)
+{
+    const unsigned char *data = (const unsigned char *) block->data;
+    int length = block->length;
+    size_t used = 0;
+    uint64_t scans = 0;
+
+    // Finish a scan split by the last read
+    if (mPartialLength > 0) {
+        int needed = mScanSize - mPartialLength;
+        if (needed > length) {
+            needed = length;
+        }
+        memcpy(&mPartial[mPartialLength], data, needed);
+        mPartialLength += needed;
+        data += needed;
+        length -= needed;
+        if (mPartialLength == mScanSize) {
+            used = decodeScan(mPartial, used);
+            mPartialLength = 0;
+            scans++;
+        }
+    }
+
+    for (; length >= mScanSize; data += mScanSize, length -= mScanSize) {
+        used = decodeScan(data, used);
+        scans++;
+    }
+    if (length > 0) {
+        memcpy(mPartial, data, length);
+        mPartialLength = length;
+    }
+
+    if (used > 0) {
+        writeData(mOutBuffer, used);
+    }
+    Stats::add(gStats.mFramesRead, scans);
+}
@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IIO_DEVICE_H
+#define IIO_DEVICE_H
+
+#include <stdint.h>
+
+#include "Devices.h"
+#include "OlyUtility.h"
+
+// Longest name kept for a scan element, including the terminator
+#define IIO_NAME_SIZE       64
+// Most scan elements of a device, including those that are not used
+#define IIO_MAX_ELEMENTS    64
+// Longest scan, in bytes
+#define IIO_MAX_SCAN_SIZE   256
+// Bytes of samples written at once, must not exceed the fifo's single buffer size
+#define IIO_BUFFER_SIZE     (1 << 14)
+
+// Reads a Linux Industrial I/O device, such as an INA226 or INA3221 power monitor, through its buffer. The voltage,
+// current and power scan elements are each one channel, in scan order, and are enabled and scaled with their sysfs
+// scale and offset; every other scan element, including the timestamp, is disabled. The kernel fills the buffer at the
+// device's sampling frequency, and each read of the character device takes every whole scan available.
+class IioDevice : public Device
+{
+public:
+    // Finds the device under sysfsRoot/bus/iio/devices, by its directory such as iio:device0 or its name such as ina226.
+    // Its character device is in devRoot. A rate of 0 keeps the device's sampling frequency. The strings must stay
+    // allocated for the life of this object.
+    IioDevice(const char *outputPath, const char *sysfsRoot, const char *devRoot, const char *device, unsigned int rate);
+    virtual ~IioDevice();
+
+    int getNumSources() const
+    {
+        return mNumSources;
+    }
+    // Returns the field of source, one of POWER, VOLTAGE or CURRENT
+    int getSourceField(int source) const;
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+private:
+    struct Source
+    {
+        // The scan element, e.g. in_voltage1
+        char name[IIO_NAME_SIZE];
+        int field;
+        // Order in the scan, and position once the scan is laid out
+        int index;
+        int position;
+        // From the element's type, e.g. le:s16/16>>0
+        bool bigEndian;
+        bool isSigned;
+        int bits;
+        int storageBytes;
+        int shift;
+        double scale;
+        double offset;
+    };
+
+    void findDevice(const char *device);
+    void findSources();
+    bool parseType(const char *type, Source *source);
+    double readScale(const Source &source, const char *attribute, double value) const;
+    void writeAttribute(const char *attribute, const char *value) const;
+    void enableBuffer(bool enable);
+    int32_t convert(const Source &source, const unsigned char *scan) const;
+    // Appends the sample from scan to the output buffer at used, writing the buffer out once full, and returns the new used
+    size_t decodeScan(const unsigned char *scan, size_t used);
+
+    const char * const mSysfsRoot;
+    const char * const mDevRoot;
+    const unsigned int mRate;
+    // The device's directory in sysfs and its entry under /dev, e.g. iio:device0
+    char mDevicePath[CAIMAN_PATH_MAX];
+    char mDeviceName[IIO_NAME_SIZE];
+
+    // Every scan element, so those not used can be disabled
+    char mElements[IIO_MAX_ELEMENTS][IIO_NAME_SIZE];
+    int mNumElements;
+    Source mSources[MAX_CHANNELS];
+    int mNumSources;
+    // Source of each field of a sample
+    int mFieldSources[MAX_FIELDS];
+    int mScanSize;
+
+    int mFd;
+    bool mBufferEnabled;
+
+    // Only used by the decode stage, to finish a scan split between reads
+    unsigned char mPartial[IIO_MAX_SCAN_SIZE];
+    int mPartialLength;
+
+    RawBlock mBlock;
+    char mOutBuffer[IIO_BUFFER_SIZE];
+
+    // Intentionally unimplemented
+    IioDevice(const IioDevice &);
+    IioDevice &operator=(const IioDevice &);
+};
+
+#endif // IIO_DEVICE_H
@@ -0,0 +1,210 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Latency.h"
+
+#include <stdio.h>
+
+#include "OlyUtility.h"
+
+// Global sample latency tracking
+Latency gLatency;
+
+static const char * const stage_names[] = { "read_to_commit", "commit_to_send", "read_to_send" };
+
+LatencyHistogram::LatencyHistogram()
+        : mCount(0),
+          mMax(0)
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        mBuckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+int LatencyHistogram::getBucket(uint64_t ns)
+{
+    if (ns < (1ULL << LATENCY_SUB_BITS)) {
+        return (int) ns;
+    }
+    if (ns >= (1ULL << LATENCY_MAX_BITS)) {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    int msb;
+#if defined(__GNUC__)
+    msb = 63 - __builtin_clzll(ns);
+#else
+    msb = 0;
+    for (uint64_t v = ns; v > 1; v >>= 1) {
+        msb++;
+    }
+#endif
+    const int shift = msb - LATENCY_SUB_BITS;
+    return ((shift + 1) << LATENCY_SUB_BITS) + (int) ((ns >> shift) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+// Returns the highest value that falls in bucket
+uint64_t LatencyHistogram::getBucketLimit(int bucket)
+{
+    if (bucket < (1 << LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+    const int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    const uint64_t base = (uint64_t) ((bucket & ((1 << LATENCY_SUB_BITS) - 1)) + (1 << LATENCY_SUB_BITS)) << shift;
+    return base + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    // Single writer, so loads and stores rather than read-modify-writes are sufficient
+    std::atomic<uint64_t> &bucket = mBuckets[getBucket(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    mCount.store(mCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ns > mMax.load(std::memory_order_relaxed)) {
+        mMax.store(ns, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+    const uint64_t count = getCount();
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t) (percentile / 100.0 * count + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += mBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            const uint64_t limit = getBucketLimit(i);
+            // Never report more than was recorded
+            return limit < getMax() ? limit : getMax();
+        }
+    }
+
+    return getMax();
+}
+
+Latency::Latency()
+        : mReadTime(0),
+          mCommitted(0),
+          mSent(0),
+          mHead(0),
+          mTail(0)
+{
+}
+
+void Latency::markRead()
+{
+    mReadTime = getTime();
+}
+
+void Latency::markRead(uint64_t readTime)
+{
+    mReadTime = readTime;
+}
+
+void Latency::markCommit(uint64_t size, bool queued)
+{
+    const uint64_t now = getTime();
+
+    mStages[READ_TO_COMMIT].record(now - mReadTime);
+    if (queued) {
+        markQueued(size, now);
+    }
+}
+
+void Latency::markQueued(uint64_t size)
+{
+    markQueued(size, getTime());
+}
+
+void Latency::markQueued(uint64_t size, uint64_t now)
+{
+    mCommitted += size;
+    const unsigned int head = mHead.load(std::memory_order_relaxed);
+    if (head - mTail.load(std::memory_order_acquire) >= LATENCY_STAMPS) {
+        // The sender is far behind; this block goes unmeasured but the offsets stay correct
+        return;
+    }
+
+    Stamp * const stamp = &mStamps[head & (LATENCY_STAMPS - 1)];
+    stamp->end = mCommitted;
+    stamp->readTime = mReadTime;
+    stamp->commitTime = now;
+    mHead.store(head + 1, std::memory_order_release);
+}
+
+void Latency::markSent(uint64_t size)
+{
+    const uint64_t now = getTime();
+    const unsigned int head = mHead.load(std::memory_order_acquire);
+    unsigned int tail = mTail.load(std::memory_order_relaxed);
+
+    mSent += size;
+    while (tail != head) {
+        const Stamp * const stamp = &mStamps[tail & (LATENCY_STAMPS - 1)];
+        if (stamp->end > mSent) {
+            break;
+        }
+        mStages[COMMIT_TO_SEND].record(now - stamp->commitTime);
+        mStages[READ_TO_SEND].record(now - stamp->readTime);
+        ++tail;
+    }
+    mTail.store(tail, std::memory_order_release);
+}
+
+void Latency::resetStream()
+{
+    mCommitted = 0;
+    mSent = 0;
+    mHead.store(0);
+    mTail.store(0);
+}
+
+int Latency::appendXML(char *xml, int pos, int size) const
+{
+    pos = appendFormat(xml, pos, size, "  <latency>\n");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const LatencyHistogram &stage = mStages[i];
+        pos = appendFormat(xml, pos, size, "    <stage name=\"%s\" count=\"%llu\" p50_ns=\"%llu\" p99_ns=\"%llu\" p999_ns=\"%llu\" max_ns=\"%llu\"/>\n",
+                           stage_names[i], (unsigned long long) stage.getCount(), (unsigned long long) stage.getPercentile(50.0),
+                           (unsigned long long) stage.getPercentile(99.0), (unsigned long long) stage.getPercentile(99.9),
+                           (unsigned long long) stage.getMax());
+    }
+    pos = appendFormat(xml, pos, size, "  </latency>\n");
+
+    return pos;
+}
+
+void Latency::printSummary() const
+{
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const LatencyHistogram &stage = mStages[i];
+        if (stage.getCount() == 0) {
+            continue;
+        }
+        fprintf(stderr, "Latency %s: count %llu, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n", stage_names[i],
+                (unsigned long long) stage.getCount(), (unsigned long long) stage.getPercentile(50.0),
+                (unsigned long long) stage.getPercentile(99.0), (unsigned long long) stage.getPercentile(99.9),
+                (unsigned long long) stage.getMax());
+    }
+}
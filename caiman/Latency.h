@@ -0,0 +1,133 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Log-linear buckets: exact below 2^LATENCY_SUB_BITS ns, then 2^LATENCY_SUB_BITS buckets per power of two (about 3% precision)
+#define LATENCY_SUB_BITS 5
+#define LATENCY_MAX_BITS 40 // ~18 minutes
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+// HDR style histogram of nanosecond latencies. Written by a single thread, readable from any thread.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    uint64_t getCount() const
+    {
+        return mCount.load(std::memory_order_relaxed);
+    }
+    uint64_t getMax() const
+    {
+        return mMax.load(std::memory_order_relaxed);
+    }
+    // Returns the highest value equivalent to the given percentile, 0 if empty
+    uint64_t getPercentile(double percentile) const;
+
+private:
+    static int getBucket(uint64_t ns);
+    static uint64_t getBucketLimit(int bucket);
+
+    std::atomic<uint64_t> mBuckets[LATENCY_BUCKETS];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mMax;
+
+    // Intentionally unimplemented
+    LatencyHistogram(const LatencyHistogram &);
+    LatencyHistogram &operator=(const LatencyHistogram &);
+};
+
+// Must be a power of two
+#define LATENCY_STAMPS 4096
+
+// Follows blocks of samples from the device read, through the fifo, to the completion of the socket send
+class Latency
+{
+public:
+    Latency();
+
+    // Called by the acquisition thread when a device read completes
+    void markRead();
+    // As above, for a read that completed at readTime, e.g. in the read stage of a staged pipeline
+    void markRead(uint64_t readTime);
+    // When the samples now being committed were read; only meaningful to the acquisition thread
+    uint64_t getReadTime() const
+    {
+        return mReadTime;
+    }
+    // Called by the acquisition thread as size bytes from the last read are committed; queued is true if
+    // they will be sent by the sender thread
+    void markCommit(uint64_t size, bool queued);
+    // Called by the acquisition thread as size bytes committed earlier without being queued are queued after all,
+    // e.g. by a sink that only passes some samples on to the sender thread
+    void markQueued(uint64_t size);
+    // Called by the sender thread once size bytes have been sent
+    void markSent(uint64_t size);
+    // Forgets blocks that were never sent, once the acquisition and sender threads have stopped
+    void resetStream();
+
+    // Appends a <latency> element to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+    // Prints the percentiles of each stage that saw samples to stderr
+    void printSummary() const;
+
+    enum
+    {
+        READ_TO_COMMIT,
+        COMMIT_TO_SEND,
+        READ_TO_SEND,
+        NUM_STAGES
+    };
+
+private:
+    struct Stamp
+    {
+        uint64_t end; // offset in the stream just after the block
+        uint64_t readTime;
+        uint64_t commitTime;
+    };
+
+    void markQueued(uint64_t size, uint64_t now);
+
+    LatencyHistogram mStages[NUM_STAGES];
+
+    // Acquisition thread only
+    uint64_t mReadTime;
+    uint64_t mCommitted;
+
+    // Sender thread only
+    uint64_t mSent;
+
+    // Single producer, single consumer queue of committed blocks
+    Stamp mStamps[LATENCY_STAMPS];
+    std::atomic<unsigned int> mHead;
+    std::atomic<unsigned int> mTail;
+
+    // Intentionally unimplemented
+    Latency(const Latency &);
+    Latency &operator=(const Latency &);
+};
+
+extern Latency gLatency;
+
+#endif // LATENCY_H
@@ -19,23 +19,74 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include "Thread.h"
+
 #ifdef WIN32
 #define MUTEX_INIT()    mLoggingMutex = CreateMutex(NULL, false, NULL);
 #define MUTEX_LOCK()    WaitForSingleObject(mLoggingMutex, 0xFFFFFFFF);
 #define MUTEX_UNLOCK()  ReleaseMutex(mLoggingMutex);
+#define SLEEP_MS(MS)    Sleep(MS)
 #else
+#include <unistd.h>
 #define MUTEX_INIT()    pthread_mutex_init(&mLoggingMutex, NULL)
 #define MUTEX_LOCK()    pthread_mutex_lock(&mLoggingMutex)
 #define MUTEX_UNLOCK()  pthread_mutex_unlock(&mLoggingMutex)
+#define SLEEP_MS(MS)    usleep((MS) * 1000)
 #endif
 
+// Must be a power of two
+#define LOG_RING_SIZE 256
+#define LOG_STRING_SPACE 64
+// How often the background thread looks for deferred messages
+#define LOG_POLL_MS 10
+// At most LOG_RATE_LIMIT messages with the same format are output per LOG_RATE_PERIOD
+#define LOG_RATE_LIMIT 10
+#define LOG_RATE_PERIOD 1000000000ULL
+#define LOG_RATE_SLOTS 64
+
+struct LogEntry
+{
+    const char *function;
+    const char *file;
+    const char *fmt;
+    int line;
+    int numArgs;
+    LogArg args[LOG_MAX_ARGS];
+    // String arguments are copied here as the caller's buffer may not outlive the entry
+    char strings[LOG_STRING_SPACE];
+};
+
+// Single producer, single consumer ring owned by one logging thread and drained by the background thread
+struct LogRing
+{
+    LogEntry entries[LOG_RING_SIZE];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    std::atomic<unsigned int> dropped;
+    LogRing *next;
+};
+
+struct RateSlot
+{
+    const char *fmt;
+    uint64_t periodStart;
+    unsigned int count;
+    unsigned int suppressed;
+};
+
+static thread_local LogRing *tlsRing = NULL;
+static RateSlot rateSlots[LOG_RATE_SLOTS];
+
 // Global thread-safe logging
 Logging logg;
 
 Logging::Logging()
-        : mDebug(true)
+        : mDebug(true),
+          mRings(NULL),
+          mAsyncRunning(false)
 {
     mFileCreated = false;
+    mWarningFile = NULL;
     mWarningXMLPath[0] = 0;
     mPrintMessages = true;
     MUTEX_INIT();
@@ -45,7 +96,12 @@ Logging::Logging()
 
 Logging::~Logging()
 {
-    if (mFileCreated) {
+    stopAsync();
+    if (mWarningFile != NULL) {
+        fputs("</warnings>", mWarningFile);
+        fclose(mWarningFile);
+    }
+    else if (mFileCreated) {
         appendToDisk(mWarningXMLPath, "</warnings>");
     }
 }
@@ -61,10 +117,11 @@ bool Logging::logWarning(const char* warning)
             mFileCreated = true;
         }
 
-        FILE *fh = fopen(mWarningXMLPath, "a");
-        if (fh == NULL) {
+        // Keep the file open rather than reopening it for every warning
+        if (mWarningFile == NULL && (mWarningFile = fopen(mWarningXMLPath, "a")) == NULL) {
             return false;
         }
+        FILE *fh = mWarningFile;
 
         fputs("  <warning text=\"", fh);
         for (; *warning != '\0'; ++warning) {
@@ -82,7 +139,7 @@ bool Logging::logWarning(const char* warning)
         }
         fputs("\"/>\n", fh);
 
-        fclose(fh);
+        fflush(fh);
 
         return true;
     }
@@ -127,13 +184,269 @@ void Logging::_logMessage(const char *function, const char *file, int line, cons
         vsnprintf(logBuf + strlen(logBuf), sizeof(logBuf) - 2 - strlen(logBuf), fmt, args); //  subtract 2 for \n and \0
         va_end(args);
 
-        bool warningLogged = logWarning(logBuf);
+        outputMessage(logBuf);
+
+        MUTEX_UNLOCK();
+    }
+}
+
+// Must be called with mLoggingMutex held
+void Logging::outputMessage(const char *message)
+{
+    bool warningLogged = logWarning(message);
+
+    if (mPrintMessages || !warningLogged) {
+        fprintf(stdout, "%s\n", message);
+        fflush(stdout);
+    }
+}
+
+// Formats a deferred message one conversion at a time, as the arguments are no longer a va_list
+static void formatEntry(const LogEntry *entry, char *buf, int size)
+{
+    int pos = snprintf(buf, size, "INFO: %s(%s:%i): ", entry->function, entry->file, entry->line);
+    int arg = 0;
+    const char *fmt = entry->fmt;
+
+    // Leave room for \n and \0 as _logMessage does
+    size -= 2;
+    while (*fmt != '\0' && pos < size) {
+        if (*fmt != '%') {
+            buf[pos++] = *fmt++;
+            continue;
+        }
+        if (fmt[1] == '%') {
+            buf[pos++] = '%';
+            fmt += 2;
+            continue;
+        }
 
-        if (mPrintMessages || !warningLogged) {
-            fprintf(stdout, "%s\n", logBuf);
-            fflush(stdout);
+        // Copy flags, width and precision, then drop any length modifier as the argument type is known
+        char spec[32];
+        int specLen = 0;
+        const char *start = fmt++;
+        while (*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != NULL && specLen < (int) sizeof(spec) - 4) {
+            spec[specLen++] = *fmt++;
         }
+        while (*fmt != '\0' && strchr("hlqjztL", *fmt) != NULL) {
+            fmt++;
+        }
+        const char conversion = *fmt;
+        if (conversion == '\0' || strchr("diouxXeEfFgGaAcsp", conversion) == NULL || arg >= entry->numArgs) {
+            // Unsupported or missing argument, output the specification verbatim
+            const int length = (conversion == '\0' ? fmt : fmt + 1) - start;
+            pos += snprintf(buf + pos, size - pos, "%.*s", length, start);
+            fmt = (conversion == '\0' ? fmt : fmt + 1);
+            continue;
+        }
+        fmt++;
+
+        char format[40];
+        const LogArg &value = entry->args[arg++];
+        int n;
+        if (strchr("diouxXc", conversion) != NULL) {
+            if (conversion == 'c') {
+                snprintf(format, sizeof(format), "%%%.*sc", specLen, spec);
+                n = snprintf(buf + pos, size - pos, format, (int) value.value.i);
+            }
+            else {
+                snprintf(format, sizeof(format), "%%%.*sll%c", specLen, spec, conversion);
+                n = snprintf(buf + pos, size - pos, format, value.type == LogArg::DOUBLE ? (long long) value.value.d : value.value.i);
+            }
+        }
+        else if (conversion == 's') {
+            snprintf(format, sizeof(format), "%%%.*ss", specLen, spec);
+            n = snprintf(buf + pos, size - pos, format, value.type == LogArg::STRING && value.value.s != NULL ? value.value.s : "(null)");
+        }
+        else if (conversion == 'p') {
+            n = snprintf(buf + pos, size - pos, "%p", value.value.p);
+        }
+        else {
+            snprintf(format, sizeof(format), "%%%.*s%c", specLen, spec, conversion);
+            n = snprintf(buf + pos, size - pos, format, value.type == LogArg::DOUBLE ? value.value.d : (double) value.value.i);
+        }
+        pos += n;
+    }
+    if (pos > size) {
+        pos = size;
+    }
+    buf[pos] = '\0';
+}
+
+void Logging::deferMessage(const char *function, const char *file, int line, const char *fmt, const LogArg *args, int numArgs)
+{
+    LogEntry local;
+    LogEntry *entry = &local;
+    LogRing *ring = NULL;
+
+    if (mAsyncRunning.load(std::memory_order_relaxed)) {
+        ring = tlsRing;
+        if (ring == NULL) {
+            // First deferred message from this thread, register a ring for it. Rings are never freed.
+            ring = new LogRing;
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->dropped.store(0);
+            ring->next = mRings.load();
+            while (!mRings.compare_exchange_weak(ring->next, ring)) {
+            }
+            tlsRing = ring;
+        }
+
+        const unsigned int head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        entry = &ring->entries[head & (LOG_RING_SIZE - 1)];
+    }
+
+    entry->function = function;
+    entry->file = file;
+    entry->fmt = fmt;
+    entry->line = line;
+    entry->numArgs = numArgs;
+    int stringPos = 0;
+    for (int i = 0; i < numArgs; i++) {
+        entry->args[i] = args[i];
+        if (args[i].type == LogArg::STRING && args[i].value.s != NULL) {
+            char * const dst = entry->strings + stringPos;
+            const int space = LOG_STRING_SPACE - stringPos;
+            const int length = space > 0 ? snprintf(dst, space, "%s", args[i].value.s) : 0;
+            entry->args[i].value.s = space > 0 ? dst : "";
+            stringPos += (length < space ? length : space - 1) + 1;
+        }
+    }
 
+    if (ring != NULL) {
+        ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    else {
+        char logBuf[4096];
+        formatEntry(entry, logBuf, sizeof(logBuf));
+        MUTEX_LOCK();
+        outputMessage(logBuf);
         MUTEX_UNLOCK();
     }
 }
+
+// Returns true if a message with this format may be output now. Only called from the background thread.
+bool Logging::rateLimit(const char *fmt, unsigned int *suppressed)
+{
+    const uint64_t now = getTime();
+    RateSlot *slot = &rateSlots[((uintptr_t) fmt >> 3) % LOG_RATE_SLOTS];
+
+    *suppressed = 0;
+    if (slot->fmt != fmt || now - slot->periodStart >= LOG_RATE_PERIOD) {
+        // Report what was suppressed in the previous period before starting a new one
+        *suppressed = slot->fmt == fmt ? slot->suppressed : 0;
+        slot->fmt = fmt;
+        slot->periodStart = now;
+        slot->count = 0;
+        slot->suppressed = 0;
+    }
+
+    if (slot->count >= LOG_RATE_LIMIT) {
+        slot->suppressed++;
+        return false;
+    }
+    slot->count++;
+    return true;
+}
+
+// Returns true if any messages were found
+bool Logging::drainDeferred()
+{
+    bool found = false;
+
+    for (LogRing *ring = mRings.load(); ring != NULL; ring = ring->next) {
+        const unsigned int head = ring->head.load(std::memory_order_acquire);
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        char logBuf[4096];
+
+        while (tail != head) {
+            const LogEntry *entry = &ring->entries[tail & (LOG_RING_SIZE - 1)];
+            unsigned int suppressed;
+            const bool output = rateLimit(entry->fmt, &suppressed);
+            if (suppressed > 0) {
+                snprintf(logBuf, sizeof(logBuf), "INFO: %s(%s:%i): Suppressed %u similar messages", entry->function, entry->file, entry->line, suppressed);
+                MUTEX_LOCK();
+                outputMessage(logBuf);
+                MUTEX_UNLOCK();
+            }
+            if (output) {
+                formatEntry(entry, logBuf, sizeof(logBuf));
+                MUTEX_LOCK();
+                outputMessage(logBuf);
+                MUTEX_UNLOCK();
+            }
+            ++tail;
+            ring->tail.store(tail, std::memory_order_release);
+            found = true;
+        }
+
+        const unsigned int dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            snprintf(logBuf, sizeof(logBuf), "INFO: %s(%s:%i): Dropped %u deferred log messages", __FUNCTION__, __FILE__, __LINE__, dropped);
+            MUTEX_LOCK();
+            outputMessage(logBuf);
+            MUTEX_UNLOCK();
+        }
+    }
+
+    return found;
+}
+
+// Reports messages suppressed in the current rate limiting period
+void Logging::reportSuppressed()
+{
+    for (int i = 0; i < LOG_RATE_SLOTS; i++) {
+        if (rateSlots[i].suppressed > 0) {
+            char logBuf[4096];
+            snprintf(logBuf, sizeof(logBuf), "INFO: Suppressed %u further messages like \"%s\"", rateSlots[i].suppressed, rateSlots[i].fmt);
+            MUTEX_LOCK();
+            outputMessage(logBuf);
+            MUTEX_UNLOCK();
+            rateSlots[i].suppressed = 0;
+        }
+    }
+}
+
+void *Logging::asyncThread(void *pVoid)
+{
+    Logging * const logging = (Logging *) pVoid;
+
+    while (logging->mAsyncRunning.load()) {
+        if (!logging->drainDeferred()) {
+            SLEEP_MS(LOG_POLL_MS);
+        }
+    }
+
+    // Output anything logged while stopping
+    logging->drainDeferred();
+
+    logging->reportSuppressed();
+
+    return 0;
+}
+
+void Logging::startAsync()
+{
+    if (mAsyncRunning.exchange(true)) {
+        return;
+    }
+
+    if (!THREAD_CREATE(mAsyncThread, asyncThread, this)) {
+        // Fall back to formatting deferred messages immediately
+        mAsyncRunning.store(false);
+    }
+}
+
+void Logging::stopAsync()
+{
+    if (!mAsyncRunning.exchange(false)) {
+        return;
+    }
+
+    THREAD_JOIN(mAsyncThread);
+}
@@ -17,6 +17,7 @@
 #ifndef __LOGGING_H__
 #define __LOGGING_H__
 
+#include <stdio.h>
 #include <string.h>
 #ifdef WIN32
 #include <windows.h>
@@ -24,8 +25,49 @@
 #include <pthread.h>
 #endif
 
+#include <atomic>
+
 #include "OlyUtility.h"
 
+#define LOG_MAX_ARGS 6
+
+// An argument to a deferred log message, captured by value so formatting can happen later on another thread
+struct LogArg
+{
+    enum Type
+    {
+        NONE,
+        SIGNED,
+        UNSIGNED,
+        DOUBLE,
+        STRING,
+        POINTER
+    };
+
+    LogArg() : type(NONE) { value.u = 0; }
+    LogArg(int v) : type(SIGNED) { value.i = v; }
+    LogArg(long v) : type(SIGNED) { value.i = v; }
+    LogArg(long long v) : type(SIGNED) { value.i = v; }
+    LogArg(unsigned int v) : type(UNSIGNED) { value.u = v; }
+    LogArg(unsigned long v) : type(UNSIGNED) { value.u = v; }
+    LogArg(unsigned long long v) : type(UNSIGNED) { value.u = v; }
+    LogArg(double v) : type(DOUBLE) { value.d = v; }
+    LogArg(const char *v) : type(STRING) { value.s = v; }
+    LogArg(const void *v) : type(POINTER) { value.p = v; }
+
+    Type type;
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char *s;
+        const void *p;
+    } value;
+};
+
+struct LogRing;
+
 class Logging
 {
 public:
@@ -40,6 +82,22 @@ public:
     void _logError(const char *function, const char *file, int line, const char* fmt, ...);
 #define logMessage(...) _logMessage(__FUNCTION__, __FILE__, __LINE__, __VA_ARGS__)
     void _logMessage(const char *function, const char *file, int line, const char* fmt, ...);
+    // For hot paths: records the format string and up to LOG_MAX_ARGS arguments in a per-thread ring and
+    // leaves formatting and output to a background thread. Repeated messages are rate limited.
+    // Formats and prints immediately if the background thread has not been started.
+#define logDeferred(...) _logDeferred(__FUNCTION__, __FILE__, __LINE__, __VA_ARGS__)
+    template<typename... Args>
+    void _logDeferred(const char *function, const char *file, int line, const char* fmt, Args... args)
+    {
+        static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many arguments for a deferred log message");
+        if (mDebug) {
+            const LogArg packed[sizeof...(args) + 1] = { LogArg(args)..., LogArg() };
+            deferMessage(function, file, line, fmt, packed, sizeof...(args));
+        }
+    }
+    void startAsync();
+    // Outputs all pending deferred messages and stops the background thread
+    void stopAsync();
     void SetWarningFile(const char* path)
     {
         strncpy(mWarningXMLPath, path, CAIMAN_PATH_MAX);
@@ -56,8 +114,15 @@ public:
 
 private:
     bool logWarning(const char* warning);
+    void outputMessage(const char* message);
+    void deferMessage(const char *function, const char *file, int line, const char *fmt, const LogArg *args, int numArgs);
+    bool drainDeferred();
+    bool rateLimit(const char *fmt, unsigned int *suppressed);
+    void reportSuppressed();
+    static void *asyncThread(void *pVoid);
 
     char mWarningXMLPath[CAIMAN_PATH_MAX];
+    FILE *mWarningFile;
     char mErrBuf[4096]; // Arbitrarily large buffer to hold a string
     bool mDebug;
     bool mFileCreated;
@@ -67,6 +132,15 @@ private:
     pthread_mutex_t mLoggingMutex;
 #endif
     bool mPrintMessages;
+
+    // Deferred messages
+    std::atomic<LogRing *> mRings;
+    std::atomic<bool> mAsyncRunning;
+#ifdef WIN32
+    HANDLE mAsyncThread;
+#else
+    pthread_t mAsyncThread;
+#endif
 };
 
 extern Logging logg;
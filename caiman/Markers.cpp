@@ -0,0 +1,345 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Markers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "Latency.h"
+#include "Logging.h"
+#include "Stats.h"
+
+// How often the receive thread checks whether it should stop
+#define RECEIVE_POLL_MS 100
+// Most XML written for one marker
+#define MARKER_XML_MAX  (256 + MARKER_LABEL_SIZE + MAX_CHANNELS * 64)
+
+MarkerSink::MarkerSink(const char *socketPath, unsigned int sampleRate, int numFields)
+        : mSampleRate(sampleRate),
+          mNumFields(numFields),
+          mNumPower(0),
+          mSocket(-1),
+          mRunning(false),
+          mQueueHead(0),
+          mQueueTail(0),
+          mDropped(0),
+          mLocalSamples(0),
+          mPartialLength(0),
+          mMarkers(NULL),
+          mNumMarkers(0),
+          mReceived(0),
+          mSamples(0),
+          mRegionStart(0)
+{
+    strncpy(mSocketPath, socketPath, CAIMAN_PATH_MAX);
+    mSocketPath[CAIMAN_PATH_MAX - 1] = '\0';
+
+    // The power field of each enabled channel, as described in captured.xml
+    for (int i = 0; i < MAX_COUNTERS; i++) {
+        if (gSessionData.mCounterEnabled[i] && gSessionData.mCounterField[i] == POWER && mNumPower < MAX_CHANNELS &&
+            gSessionData.mCounterSource[i] < mNumFields) {
+            mPowerSources[mNumPower] = gSessionData.mCounterSource[i];
+            mPowerChannels[mNumPower] = gSessionData.mCounterChannel[i];
+            mNumPower++;
+        }
+    }
+
+    mMarkers = (Marker *) malloc(MAX_MARKERS * sizeof(Marker));
+    if (mMarkers == NULL) {
+        logg.logError("Unable to allocate %d bytes for markers", (int) (MAX_MARKERS * sizeof(Marker)));
+        handleException();
+    }
+    reset();
+
+#if defined(WIN32)
+    logg.logError("Markers are not supported on Windows");
+    handleException();
+#else
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(mSocketPath) >= sizeof(address.sun_path)) {
+        logg.logError("Marker socket path %s is longer than the %d characters supported", mSocketPath, (int) sizeof(address.sun_path) - 1);
+        handleException();
+    }
+    strcpy(address.sun_path, mSocketPath);
+
+    mSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (mSocket < 0) {
+        logg.logError("Unable to create the marker socket: %s", strerror(errno));
+        handleException();
+    }
+    // A socket left by an earlier run would prevent binding
+    unlink(mSocketPath);
+    if (bind(mSocket, (const struct sockaddr *) &address, sizeof(address)) != 0) {
+        logg.logError("Unable to bind the marker socket to %s: %s", mSocketPath, strerror(errno));
+        handleException();
+    }
+
+    mRunning.store(true);
+    if (pthread_create(&mReceiveThread, NULL, receiveThread, this) != 0) {
+        logg.logError("Failed to create marker thread");
+        handleException();
+    }
+    logg.logMessage("Receiving markers on %s", mSocketPath);
+#endif
+}
+
+MarkerSink::~MarkerSink()
+{
+#if !defined(WIN32)
+    if (mRunning.exchange(false)) {
+        pthread_join(mReceiveThread, NULL);
+    }
+    if (mSocket >= 0) {
+        close(mSocket);
+        unlink(mSocketPath);
+    }
+#endif
+    free(mMarkers);
+}
+
+void *MarkerSink::receiveThread(void *pVoid)
+{
+    MarkerSink * const markers = (MarkerSink *) pVoid;
+
+    gStats.registerThread("markers");
+    markers->receive();
+
+    return 0;
+}
+
+void MarkerSink::receive()
+{
+#if !defined(WIN32)
+    char label[MARKER_LABEL_SIZE];
+
+    while (mRunning.load()) {
+        struct pollfd pfd;
+        pfd.fd = mSocket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        const int ready = poll(&pfd, 1, RECEIVE_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            logg.logMessage("Unable to wait for markers: %s", strerror(errno));
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        // Labels longer than the buffer are truncated by recv
+        const ssize_t length = recv(mSocket, label, sizeof(label) - 1, 0);
+        if (length < 0) {
+            continue;
+        }
+        const uint64_t arrival = getTime();
+        label[length] = '\0';
+        // Keep the label safe to write as an XML attribute
+        for (char *c = label; *c != '\0'; c++) {
+            if (*c < ' ' || *c == '<' || *c == '>' || *c == '&' || *c == '"' || *c == '\'') {
+                *c = '_';
+            }
+        }
+
+        const unsigned int head = mQueueHead.load(std::memory_order_relaxed);
+        if (head - mQueueTail.load(std::memory_order_acquire) >= MARKER_QUEUE_SIZE) {
+            Stats::add(mDropped, 1);
+            continue;
+        }
+        QueuedMarker * const queued = &mQueue[head % MARKER_QUEUE_SIZE];
+        queued->time = arrival;
+        memcpy(queued->label, label, length + 1);
+        mQueueHead.store(head + 1, std::memory_order_release);
+    }
+#endif
+}
+
+void MarkerSink::stamp(const char *label)
+{
+    const int numMarkers = mNumMarkers.load(std::memory_order_relaxed);
+    Stats::add(mReceived, 1);
+
+    if (numMarkers < MAX_MARKERS) {
+        Marker * const marker = &mMarkers[numMarkers];
+        marker->sample = mLocalSamples;
+        strcpy(marker->label, label);
+        memcpy(marker->powerSum, mLocalPowerSum, mNumPower * sizeof(*mLocalPowerSum));
+        mNumMarkers.store(numMarkers + 1, std::memory_order_release);
+    }
+    logg.logMessage("Marker '%s' at sample %llu", label, (unsigned long long) mLocalSamples);
+
+    // Start the next region
+    for (int i = 0; i < mNumPower; i++) {
+        mLocalPowerSum[i] = 0;
+    }
+    mRegionStart.store(mLocalSamples, std::memory_order_relaxed);
+}
+
+void MarkerSink::addSample(const char *sample)
+{
+    // Values are little endian, as are all supported hosts
+    for (int i = 0; i < mNumPower; i++) {
+        int32_t value;
+        memcpy(&value, sample + mPowerSources[i] * sizeof(value), sizeof(value));
+        mLocalPowerSum[i] += value;
+    }
+    mLocalSamples++;
+}
+
+void MarkerSink::write(const char *buf, size_t size)
+{
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+
+    if (sampleSize == 0) {
+        return;
+    }
+
+    // Markers start at the first sample read after they arrived. Samples can be written well after they are read, as
+    // with --staged, so markers wait for samples read later than them rather than taking the next samples written.
+    const uint64_t readTime = gLatency.getReadTime();
+    const unsigned int head = mQueueHead.load(std::memory_order_acquire);
+    unsigned int tail = mQueueTail.load(std::memory_order_relaxed);
+    while (tail != head && mQueue[tail % MARKER_QUEUE_SIZE].time <= readTime) {
+        stamp(mQueue[tail % MARKER_QUEUE_SIZE].label);
+        tail++;
+        mQueueTail.store(tail, std::memory_order_release);
+    }
+
+    // Finish a sample split by the last write
+    if (mPartialLength > 0) {
+        size_t length = sampleSize - mPartialLength;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(&mPartial[mPartialLength], buf, length);
+        mPartialLength += length;
+        buf += length;
+        size -= length;
+        if (mPartialLength == sampleSize) {
+            addSample(mPartial);
+            mPartialLength = 0;
+        }
+    }
+
+    for (; size >= sampleSize; size -= sampleSize) {
+        addSample(buf);
+        buf += sampleSize;
+    }
+
+    if (size > 0) {
+        memcpy(mPartial, buf, size);
+        mPartialLength = size;
+    }
+
+    for (int i = 0; i < mNumPower; i++) {
+        mPowerSum[i].store(mLocalPowerSum[i], std::memory_order_relaxed);
+    }
+    mSamples.store(mLocalSamples, std::memory_order_relaxed);
+}
+
+void MarkerSink::reset()
+{
+    // Markers sent between captures belong to none of them
+    mQueueTail.store(mQueueHead.load(std::memory_order_acquire), std::memory_order_release);
+
+    mLocalSamples = 0;
+    mPartialLength = 0;
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        mLocalPowerSum[i] = 0;
+        mPowerSum[i].store(0, std::memory_order_relaxed);
+    }
+    mNumMarkers.store(0, std::memory_order_release);
+    mReceived.store(0, std::memory_order_relaxed);
+    mDropped.store(0, std::memory_order_relaxed);
+    mSamples.store(0, std::memory_order_relaxed);
+    mRegionStart.store(0, std::memory_order_relaxed);
+}
+
+int MarkerSink::appendMarker(char *xml, int pos, int size, const char *indent, const Marker &marker, uint64_t regionStart) const
+{
+    // Power is in milliwatts, so the sum over samples divided by the sample rate is in millijoules
+    pos = appendFormat(xml, pos, size, "%s<marker sample=\"%llu\" time_s=\"%.6f\" label=\"%s\" region_start=\"%llu\">\n", indent,
+                       (unsigned long long) marker.sample, (double) marker.sample / mSampleRate, marker.label,
+                       (unsigned long long) regionStart);
+    for (int i = 0; i < mNumPower; i++) {
+        pos = appendFormat(xml, pos, size, "%s  <energy channel=\"%d\" mj=\"%.3f\"/>\n", indent, mPowerChannels[i],
+                           (double) marker.powerSum[i] / mSampleRate);
+    }
+    pos = appendFormat(xml, pos, size, "%s</marker>\n", indent);
+
+    return pos;
+}
+
+int MarkerSink::appendXML(char *xml, int pos, int size) const
+{
+    const int numMarkers = mNumMarkers.load(std::memory_order_acquire);
+    const uint64_t samples = mSamples.load(std::memory_order_relaxed);
+    const uint64_t regionStart = mRegionStart.load(std::memory_order_relaxed);
+
+    pos = appendFormat(xml, pos, size, "  <markers received=\"%llu\" dropped=\"%llu\" kept=\"%d\">\n",
+                       (unsigned long long) mReceived.load(), (unsigned long long) mDropped.load(), numMarkers);
+    // The stats are sent often, so only the latest markers are included; markers.xml has them all
+    const int first = numMarkers > MARKER_STATS_COUNT ? numMarkers - MARKER_STATS_COUNT : 0;
+    for (int i = first; i < numMarkers && size - pos > 2 * MARKER_XML_MAX; i++) {
+        pos = appendMarker(xml, pos, size, "    ", mMarkers[i], i > 0 ? mMarkers[i - 1].sample : 0);
+    }
+    // The region since the last marker is still open
+    pos = appendFormat(xml, pos, size, "    <open region_start=\"%llu\" samples=\"%llu\">\n", (unsigned long long) regionStart,
+                       (unsigned long long) samples);
+    for (int i = 0; i < mNumPower; i++) {
+        pos = appendFormat(xml, pos, size, "      <energy channel=\"%d\" mj=\"%.3f\"/>\n", mPowerChannels[i],
+                           (double) mPowerSum[i].load(std::memory_order_relaxed) / mSampleRate);
+    }
+    pos = appendFormat(xml, pos, size, "    </open>\n");
+    pos = appendFormat(xml, pos, size, "  </markers>\n");
+
+    return pos;
+}
+
+void MarkerSink::writeXML(const char *outputPath) const
+{
+    char filename[CAIMAN_PATH_MAX + 1];
+    snprintf(filename, CAIMAN_PATH_MAX, "%smarkers.xml", outputPath);
+    FILE * const xmlout = fopen(filename, "wt");
+    if (xmlout == NULL) {
+        logg.logError("Unable to create %s", filename);
+        handleException();
+    }
+
+    const int numMarkers = mNumMarkers.load(std::memory_order_acquire);
+    char xml[MARKER_XML_MAX];
+
+    fprintf(xmlout, "<?xml version=\"1.0\" encoding='UTF-8'?>\n");
+    fprintf(xmlout, "<markers version=\"1\" sample_rate=\"%u\" received=\"%llu\" dropped=\"%llu\">\n", mSampleRate,
+            (unsigned long long) mReceived.load(), (unsigned long long) mDropped.load());
+    for (int i = 0; i < numMarkers; i++) {
+        appendMarker(xml, 0, MARKER_XML_MAX, "  ", mMarkers[i], i > 0 ? mMarkers[i - 1].sample : 0);
+        fputs(xml, xmlout);
+    }
+    fprintf(xmlout, "</markers>\n");
+    fclose(xmlout);
+}
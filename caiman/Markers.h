@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MARKERS_H
+#define MARKERS_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#if !defined(WIN32)
+#include <pthread.h>
+#endif
+
+#include "OlyUtility.h"
+#include "SessionData.h"
+#include "Sinks.h"
+
+// Longest label kept, including the terminator; longer labels are truncated
+#define MARKER_LABEL_SIZE   64
+// Markers received but not yet stamped by the thread writing samples
+#define MARKER_QUEUE_SIZE   64
+// Markers kept for markers.xml; later markers are still reported but not kept
+#define MAX_MARKERS         1024
+// Most recent markers included in the stats
+#define MARKER_STATS_COUNT  16
+
+// Receives labelled markers from other local processes as datagrams on a Unix socket, and stamps each with the index of
+// the first sample read after it arrived. Each marker ends the region started by the one before it, or by the start
+// of the capture, and records the energy used on each channel over that region.
+class MarkerSink : public Sink
+{
+public:
+    // socketPath is bound to a new Unix datagram socket, replacing any existing socket there
+    MarkerSink(const char *socketPath, unsigned int sampleRate, int numFields);
+    virtual ~MarkerSink();
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // Appends a <markers> element with the most recent markers and the open region to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+    // Writes every kept marker to markers.xml in outputPath
+    void writeXML(const char *outputPath) const;
+
+    // Markers stamped so far in this capture
+    uint64_t getReceived() const
+    {
+        return mReceived.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Marker
+    {
+        uint64_t sample;
+        char label[MARKER_LABEL_SIZE];
+        // Sum of each channel's power field over the region ending at this marker
+        int64_t powerSum[MAX_CHANNELS];
+    };
+
+    static void *receiveThread(void *pVoid);
+    void receive();
+    void stamp(const char *label);
+    void addSample(const char *sample);
+    int appendMarker(char *xml, int pos, int size, const char *indent, const Marker &marker, uint64_t regionStart) const;
+
+    const unsigned int mSampleRate;
+    const int mNumFields;
+    // Sample field and channel of each power field
+    int mPowerSources[MAX_CHANNELS];
+    int mPowerChannels[MAX_CHANNELS];
+    int mNumPower;
+
+    char mSocketPath[CAIMAN_PATH_MAX];
+    int mSocket;
+    std::atomic<bool> mRunning;
+#if !defined(WIN32)
+    pthread_t mReceiveThread;
+#endif
+
+    struct QueuedMarker
+    {
+        // When the marker arrived, to compare with when samples were read
+        uint64_t time;
+        char label[MARKER_LABEL_SIZE];
+    };
+
+    // Single producer, single consumer queue from the receive thread to the thread writing samples
+    QueuedMarker mQueue[MARKER_QUEUE_SIZE];
+    std::atomic<unsigned int> mQueueHead;
+    std::atomic<unsigned int> mQueueTail;
+    std::atomic<uint64_t> mDropped;
+
+    // Only used by the thread writing samples
+    uint64_t mLocalSamples;
+    // A sample split between writes
+    char mPartial[MAX_FIELDS * sizeof(int32_t)];
+    size_t mPartialLength;
+    int64_t mLocalPowerSum[MAX_CHANNELS];
+
+    // Entries below mNumMarkers are complete and never change again
+    Marker *mMarkers;
+    std::atomic<int> mNumMarkers;
+    std::atomic<uint64_t> mReceived;
+    std::atomic<uint64_t> mSamples;
+    std::atomic<uint64_t> mRegionStart;
+    std::atomic<int64_t> mPowerSum[MAX_CHANNELS];
+
+    // Intentionally unimplemented
+    MarkerSink(const MarkerSink &);
+    MarkerSink &operator=(const MarkerSink &);
+};
+
+#endif // MARKERS_H
@@ -0,0 +1,449 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "MergeDevice.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define SLEEP_US(US) Sleep(((US) + 999) / 1000)
+#else
+#include <unistd.h>
+#define SLEEP_US(US) usleep(US)
+#endif
+
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+#include "Thread.h"
+
+// Time the merge sleeps when no output sample is ready
+#define MERGE_POLL_US 1000
+// Samples each ring holds beyond the latency, for inputs that write in bursts
+#define MERGE_SLACK_MS 1000
+#define MERGE_MIN_CAPACITY 1024
+// How far an input's clock may run slower than its nominal rate and still be followed, in parts per million
+#define MERGE_MAX_DRIFT_PPM 1000
+
+// Nanoseconds from the first sample to sample at rate, without overflowing on long captures
+static uint64_t samplesToNs(uint64_t sample, unsigned int rate)
+{
+    return sample / rate * 1000000000 + sample % rate * 1000000000 / rate;
+}
+
+// Samples at rate in ns nanoseconds from the first, rounded down
+static uint64_t nsToSamples(uint64_t ns, unsigned int rate)
+{
+    return ns / 1000000000 * rate + ns % 1000000000 * rate / 1000000000;
+}
+
+MergeDevice::Input::Input(Device *device, const char *name, int numSources, int firstChannel)
+        : mDevice(device),
+          mName(name),
+          mNumSources(numSources),
+          mFirstChannel(firstChannel),
+          mNumFields(0),
+          mSampleSize(0),
+          mRunning(false),
+          mSamples(0),
+          mDropped(0),
+          mLate(0),
+          mRate(0),
+          mRing(NULL),
+          mCapacity(0),
+          mHead(0),
+          mTail(0),
+          mOrigin(0),
+          mAnchored(false),
+          mLastWrite(0)
+{
+    memset(mLast, 0, sizeof(mLast));
+}
+
+MergeDevice::Input::~Input()
+{
+    delete mDevice;
+    free(mRing);
+}
+
+void MergeDevice::Input::allocate(unsigned int ms)
+{
+    mNumFields = mDevice->getNumFields();
+    mSampleSize = mNumFields * mDevice->getDataSize();
+    mRate = mDevice->getSampleRate();
+
+    const uint64_t samples = (uint64_t) ms * mRate / 1000;
+    mCapacity = MERGE_MIN_CAPACITY;
+    while (mCapacity < samples) {
+        mCapacity *= 2;
+    }
+    mRing = (char *) malloc(mCapacity * mSampleSize);
+    if (mRing == NULL) {
+        logg.logError("Unable to allocate %llu samples to merge %s", (unsigned long long) mCapacity, mName);
+        handleException();
+    }
+}
+
+void MergeDevice::Input::reset()
+{
+    mHead.store(0, std::memory_order_relaxed);
+    mTail.store(0, std::memory_order_relaxed);
+    mAnchored = false;
+    memset(mLast, 0, sizeof(mLast));
+}
+
+int64_t MergeDevice::Input::sampleTime(uint64_t sample) const
+{
+    return mOrigin.load(std::memory_order_relaxed) + (int64_t) samplesToNs(sample, mRate);
+}
+
+void MergeDevice::Input::write(const char *buf, size_t size)
+{
+    const uint64_t now = getTime();
+    uint64_t count = size / mSampleSize;
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    const uint64_t space = mCapacity - (head - mTail.load(std::memory_order_acquire));
+    uint64_t dropped = 0;
+    if (count > space) {
+        // The merge is further behind than the ring holds, so keep what fits and take the time afresh afterwards
+        dropped = count - space;
+        count = space;
+        Stats::add(mDropped, dropped);
+        if (count == 0) {
+            mAnchored = false;
+            return;
+        }
+    }
+
+    const uint64_t slot = head & (mCapacity - 1);
+    const uint64_t first = count < mCapacity - slot ? count : mCapacity - slot;
+    memcpy(&mRing[slot * mSampleSize], buf, first * mSampleSize);
+    memcpy(mRing, &buf[first * mSampleSize], (count - first) * mSampleSize);
+    head += count;
+
+    // The latest sample was taken no later than now. Samples arrive late by a varying amount, so the earliest time seen
+    // is kept, only allowed to drift later to follow an input whose clock is slower than its nominal rate.
+    const int64_t observed = (int64_t) now - (int64_t) samplesToNs(head - 1, mRate);
+    int64_t origin = observed;
+    if (mAnchored) {
+        origin = mOrigin.load(std::memory_order_relaxed) + (int64_t) ((now - mLastWrite) * MERGE_MAX_DRIFT_PPM / 1000000);
+        if (observed < origin) {
+            origin = observed;
+        }
+    }
+    mOrigin.store(origin, std::memory_order_relaxed);
+    mHead.store(head, std::memory_order_release);
+    mAnchored = dropped == 0;
+    mLastWrite = now;
+    Stats::add(mSamples, count);
+}
+
+bool MergeDevice::Input::getFirstTime(int64_t *time) const
+{
+    if (mHead.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    *time = sampleTime(0);
+    return true;
+}
+
+bool MergeDevice::Input::isPast(int64_t time) const
+{
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    return head > 0 && sampleTime(head) > time;
+}
+
+void MergeDevice::Input::take(int64_t time, bool late, char *out)
+{
+    const uint64_t head = mHead.load(std::memory_order_acquire);
+    const uint64_t tail = mTail.load(std::memory_order_relaxed);
+    if (head > tail) {
+        // Samples are evenly spaced from the origin, so those at or before time are counted rather than searched for
+        const int64_t origin = mOrigin.load(std::memory_order_relaxed);
+        uint64_t taken = time < origin ? 0 : nsToSamples(time - origin, mRate) + 1;
+        if (taken > head) {
+            taken = head;
+        }
+        if (taken > tail) {
+            memcpy(mLast, &mRing[((taken - 1) & (mCapacity - 1)) * mSampleSize], mSampleSize);
+            mTail.store(taken, std::memory_order_release);
+        }
+    }
+    if (late && !isPast(time)) {
+        Stats::add(mLate, 1);
+    }
+    memcpy(out, mLast, mSampleSize);
+}
+
+MergeDevice::MergeDevice(const char *outputPath, unsigned int rate, unsigned int latencyMs)
+        : Device(outputPath),
+          mRate(rate),
+          mLatencyMs(latencyMs),
+          mNumInputs(0),
+          mNumAdded(0),
+          mNumChannels(0),
+          mSampleSize(0),
+          mStartTime(0),
+          mStarted(false),
+          mOrigin(0),
+          mTicks(0),
+          mReady(0),
+          mTimedOut(0)
+{
+}
+
+MergeDevice::~MergeDevice()
+{
+    for (int i = 0; i < mNumAdded; i++) {
+        delete mInputs[i];
+    }
+}
+
+void MergeDevice::addInput(Device *device, const char *name, int numSources)
+{
+    if (mNumAdded >= MERGE_MAX_INPUTS) {
+        logg.logError("Too many devices to merge, at most %d are supported", MERGE_MAX_INPUTS);
+        handleException();
+    }
+    if (mNumChannels + numSources > MAX_CHANNELS) {
+        logg.logError("The merged devices have more than %d sources", MAX_CHANNELS);
+        handleException();
+    }
+
+    Input * const input = new Input(device, name, numSources, mNumChannels);
+    device->setInput();
+    device->addSink(input);
+    mInputs[mNumAdded++] = input;
+    mNumInputs = mNumAdded;
+    mNumChannels += numSources;
+}
+
+void MergeDevice::prepareChannels()
+{
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (gSessionData.mCounterEnabled[index] && gSessionData.mCounterChannel[index] >= mNumChannels) {
+            logg.logError("Channel %d was enabled but the merged devices only have %d sources", gSessionData.mCounterChannel[index],
+                          mNumChannels);
+            handleException();
+        }
+    }
+
+    // Each input is prepared as though its channels were the only ones, then the configuration is put back
+    SessionData * const all = new SessionData(gSessionData);
+    Input *unused[MERGE_MAX_INPUTS];
+    int numUnused = 0;
+    int numInputs = 0;
+    unsigned int fastest = 0;
+    mNumFields = 0;
+    for (int i = 0; i < mNumInputs; i++) {
+        Input * const input = mInputs[i];
+        gSessionData.selectChannels(input->mFirstChannel, input->mNumSources);
+        if (gSessionData.mMaxEnabledChannel < 0) {
+            logg.logMessage("None of the channels of %s are enabled, so it is not merged", input->mName);
+            unused[numUnused++] = input;
+        }
+        else {
+            input->mDevice->prepareChannels();
+            input->allocate(mLatencyMs + MERGE_SLACK_MS);
+            mNumFields += input->mNumFields;
+            if (input->mDevice->getSampleRate() > fastest) {
+                fastest = input->mDevice->getSampleRate();
+            }
+            mInputs[numInputs++] = input;
+        }
+        gSessionData = *all;
+    }
+    delete all;
+
+    // Inputs that are not merged are kept after the others, only to be deleted with this object
+    memcpy(&mInputs[numInputs], unused, numUnused * sizeof(unused[0]));
+    mNumInputs = numInputs;
+
+    mSampleRate = mRate != 0 ? mRate : fastest;
+    mVendor = "caiman merged devices";
+    mDatasize = EMETER_DATA_SIZE;
+    mSampleSize = mNumFields * mDatasize;
+}
+
+void MergeDevice::init(const char *devicename)
+{
+    for (int i = 0; i < mNumInputs; i++) {
+        mInputs[i]->mDevice->init(devicename);
+    }
+    logg.logMessage("Merging %d devices into %d fields at %u samples per second, waiting up to %u ms for each", mNumInputs,
+                    mNumFields, mSampleRate, mLatencyMs);
+}
+
+void MergeDevice::start()
+{
+    for (int i = 0; i < mNumInputs; i++) {
+        mInputs[i]->reset();
+        mInputs[i]->mDevice->start();
+    }
+    mStarted = false;
+    mStartTime = getTime();
+
+    for (int i = 0; i < mNumInputs; i++) {
+        Input * const input = mInputs[i];
+        input->mRunning.store(true, std::memory_order_release);
+        if (!THREAD_CREATE(input->mThread, inputThread, input)) {
+            input->mRunning.store(false, std::memory_order_release);
+            logg.logError("Failed to create the thread reading %s", input->mName);
+            handleException();
+        }
+    }
+}
+
+void MergeDevice::stopInputs()
+{
+    for (int i = 0; i < mNumInputs; i++) {
+        Input * const input = mInputs[i];
+        if (input->mRunning.exchange(false)) {
+            THREAD_JOIN(input->mThread);
+        }
+    }
+}
+
+void MergeDevice::stop()
+{
+    stopInputs();
+    for (int i = 0; i < mNumInputs; i++) {
+        mInputs[i]->mDevice->stop();
+    }
+    logg.logMessage("Merged %llu samples, %llu of them once the latency elapsed", (unsigned long long) (mReady.load() + mTimedOut.load()),
+                    (unsigned long long) mTimedOut.load());
+}
+
+void MergeDevice::pause()
+{
+    stopInputs();
+    for (int i = 0; i < mNumInputs; i++) {
+        mInputs[i]->mDevice->pause();
+    }
+}
+
+void *MergeDevice::inputThread(void *pVoid)
+{
+    Input * const input = (Input *) pVoid;
+
+    gStats.registerThread(input->mName);
+    while (input->mRunning.load(std::memory_order_acquire)) {
+        input->mDevice->processBuffer();
+    }
+
+    return 0;
+}
+
+size_t MergeDevice::merge(char *out, size_t size)
+{
+    const int64_t now = (int64_t) getTime();
+    const int64_t latencyNs = (int64_t) mLatencyMs * 1000000;
+
+    if (!mStarted) {
+        // The timeline starts once every input has a sample for it, or once the latency has elapsed without one
+        int64_t origin = 0;
+        bool any = false;
+        bool all = true;
+        for (int i = 0; i < mNumInputs; i++) {
+            int64_t first;
+            if (!mInputs[i]->getFirstTime(&first)) {
+                all = false;
+            }
+            else if (!any || first > origin) {
+                origin = first;
+                any = true;
+            }
+        }
+        if (!all && now < (int64_t) mStartTime + latencyNs) {
+            return 0;
+        }
+        mOrigin = any ? origin : now - latencyNs;
+        mTicks = 0;
+        mStarted = true;
+    }
+
+    size_t length = 0;
+    while (length + mSampleSize <= size) {
+        const int64_t time = mOrigin + (int64_t) samplesToNs(mTicks, mSampleRate);
+        bool ready = true;
+        for (int i = 0; i < mNumInputs && ready; i++) {
+            ready = mInputs[i]->isPast(time);
+        }
+        if (!ready && now < time + latencyNs) {
+            break;
+        }
+
+        char *sample = &out[length];
+        for (int i = 0; i < mNumInputs; i++) {
+            mInputs[i]->take(time, !ready, sample);
+            sample += mInputs[i]->mSampleSize;
+        }
+        Stats::add(ready ? mReady : mTimedOut, 1);
+        length += mSampleSize;
+        mTicks++;
+    }
+
+    return length;
+}
+
+void MergeDevice::processBuffer()
+{
+    const size_t length = merge(mOutBuffer, sizeof(mOutBuffer));
+    if (length == 0) {
+        SLEEP_US(MERGE_POLL_US);
+        return;
+    }
+    markRead(getTime());
+    writeData(mOutBuffer, length);
+}
+
+void MergeDevice::readRaw(RawBlock *block)
+{
+    // The merged samples are already in their final form, so there is nothing left to decode
+    block->length = (int) merge(block->data, sizeof(block->data));
+    block->readTime = getTime();
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+    if (block->length == 0) {
+        SLEEP_US(MERGE_POLL_US);
+    }
+}
+
+void MergeDevice::decodeRaw(const RawBlock *block)
+{
+    writeData((void *) block->data, block->length);
+}
+
+int MergeDevice::appendXML(char *xml, int pos, int size) const
+{
+    pos = appendFormat(xml, pos, size, "  <merge rate=\"%u\" latency_ms=\"%u\" ready=\"%llu\" timed_out=\"%llu\">\n", mSampleRate,
+                       mLatencyMs, (unsigned long long) mReady.load(), (unsigned long long) mTimedOut.load());
+    for (int i = 0; i < mNumInputs; i++) {
+        const Input * const input = mInputs[i];
+        pos = appendFormat(xml, pos, size,
+                           "    <input name=\"%s\" first_channel=\"%d\" fields=\"%d\" rate=\"%u\" samples=\"%llu\" dropped=\"%llu\" late=\"%llu\"/>\n",
+                           input->mName, input->mFirstChannel, input->mNumFields, input->mDevice->getSampleRate(),
+                           (unsigned long long) input->mSamples.load(), (unsigned long long) input->mDropped.load(),
+                           (unsigned long long) input->mLate.load());
+    }
+    pos = appendFormat(xml, pos, size, "  </merge>\n");
+
+    return pos;
+}
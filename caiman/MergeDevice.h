@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MERGE_DEVICE_H
+#define MERGE_DEVICE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "Devices.h"
+#include "Sinks.h"
+
+// Most devices that can be merged
+#define MERGE_MAX_INPUTS    8
+// Bytes of samples written at once, must not exceed the fifo's single buffer size
+#define MERGE_BUFFER_SIZE   (1 << 14)
+
+// Merges the samples of several source devices, each with its own clock and rate, into one stream at a single rate.
+// Each input runs on a thread of its own and passes its samples to a bounded ring, where they are timestamped from
+// their index and the input's rate, anchored to the earliest host time any of them arrived. Every output sample has a
+// time on a common timeline, and takes from each input the latest sample at or before that time. An output sample
+// is written once every input has passed its time, or once the latency has elapsed, in which case inputs that have
+// not caught up repeat their previous sample. Time and memory are linear in the number of inputs.
+class MergeDevice : public Device
+{
+public:
+    // A rate of 0 uses the fastest input's rate. Inputs are waited for up to latencyMs.
+    MergeDevice(const char *outputPath, unsigned int rate, unsigned int latencyMs);
+    virtual ~MergeDevice();
+
+    // Adds an input, which this object then owns, with the given number of sources. Its sources become the channels
+    // after those of the inputs added before it. name must stay allocated for the life of this object.
+    void addInput(Device *device, const char *name, int numSources);
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+    // Appends a <merge> element with the counters of each input to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    // Receives the samples of one input on its thread, for the thread merging them
+    class Input : public Sink
+    {
+    public:
+        Input(Device *device, const char *name, int numSources, int firstChannel);
+        virtual ~Input();
+
+        // Allocates the ring to hold ms milliseconds of samples, once the input's channels are prepared
+        void allocate(unsigned int ms);
+        void reset();
+
+        virtual void write(const char *buf, size_t size);
+
+        // Whether the input has written a sample, and if so when its first sample was taken
+        bool getFirstTime(int64_t *time) const;
+        // Whether every sample the input writes from now on is after time
+        bool isPast(int64_t time) const;
+        // Consumes the samples up to time, copying the latest of them to out, or the previous sample if there are none
+        void take(int64_t time, bool late, char *out);
+
+        Device * const mDevice;
+        const char * const mName;
+        const int mNumSources;
+        const int mFirstChannel;
+        int mNumFields;
+        size_t mSampleSize;
+        // Set while the input's thread should keep reading it
+        std::atomic<bool> mRunning;
+#if defined(WIN32)
+        HANDLE mThread;
+#else
+        pthread_t mThread;
+#endif
+
+        std::atomic<uint64_t> mSamples;
+        std::atomic<uint64_t> mDropped;
+        std::atomic<uint64_t> mLate;
+
+    private:
+        // Host time of sample, from the origin and rate
+        int64_t sampleTime(uint64_t sample) const;
+
+        unsigned int mRate;
+        char *mRing;
+        // A power of two, in samples
+        uint64_t mCapacity;
+        // Samples written by the input, and taken by the merge
+        std::atomic<uint64_t> mHead;
+        std::atomic<uint64_t> mTail;
+        // Host time of sample 0, from which the others are spaced by the rate
+        std::atomic<int64_t> mOrigin;
+
+        // Input thread only
+        bool mAnchored;
+        uint64_t mLastWrite;
+
+        // Merge thread only
+        char mLast[MAX_FIELDS * EMETER_DATA_SIZE];
+
+        // Intentionally unimplemented
+        Input(const Input &);
+        Input &operator=(const Input &);
+    };
+
+    static void *inputThread(void *pVoid);
+    void stopInputs();
+    // Writes the samples that are ready to out, returning how many bytes were written
+    size_t merge(char *out, size_t size);
+
+    const unsigned int mRate;
+    const unsigned int mLatencyMs;
+    // Those merged, then any with no channels enabled
+    Input *mInputs[MERGE_MAX_INPUTS];
+    int mNumInputs;
+    int mNumAdded;
+    int mNumChannels;
+    size_t mSampleSize;
+
+    // Merge thread only
+    uint64_t mStartTime;
+    bool mStarted;
+    int64_t mOrigin;
+    uint64_t mTicks;
+    char mOutBuffer[MERGE_BUFFER_SIZE];
+
+    // Output samples written as soon as every input had passed them, and those written once the latency elapsed
+    std::atomic<uint64_t> mReady;
+    std::atomic<uint64_t> mTimedOut;
+
+    // Intentionally unimplemented
+    MergeDevice(const MergeDevice &);
+    MergeDevice &operator=(const MergeDevice &);
+};
+
+#endif // MERGE_DEVICE_H
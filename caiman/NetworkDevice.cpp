@@ -0,0 +1,691 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NetworkDevice.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Logging.h"
+#include "OlySocket.h"
+#include "Stats.h"
+
+// Longest time a read waits for data, so gQuit is noticed promptly
+#define MAX_POLL_MS 10
+// Requested socket receive buffer, to ride out a busy acquisition thread
+#define NET_RCVBUF_SIZE (4 << 20)
+// Samples the jitter buffer holds beyond the jitter window, for packets that arrive early
+#define NET_MIN_AHEAD 4096
+// A sender that jumps this many seconds ahead, or back past the jitter buffer, is taken to have restarted
+#define NET_MAX_GAP_S 10
+
+extern volatile bool gQuit;
+
+NetworkDevice::NetworkDevice(const char *outputPath, bool tcp, int port, unsigned int jitterMs)
+        : Device(outputPath),
+          mTcp(tcp),
+          mPort(port),
+          mJitterMs(jitterMs),
+          mFd(-1),
+          mServer(NULL),
+          mClient(-1),
+          mNumSources(0),
+          mFieldsSize(0),
+          mPendingFirst(0),
+          mPendingCount(0),
+          mLastReceived(0),
+          mStreamLength(0),
+          mRing(NULL),
+          mPresent(NULL),
+          mArrival(NULL),
+          mCapacity(0),
+          mReceiveTime(0),
+          mSynced(false),
+          mNext(0),
+          mEnd(0),
+          mOutLength(0),
+          mPackets(0),
+          mInvalid(0),
+          mReordered(0),
+          mLate(0),
+          mDuplicates(0),
+          mResyncs(0),
+          mConnections(0)
+{
+#if defined(WIN32)
+    logg.logError("Network sources are not supported on Windows");
+    handleException();
+#else
+    if (mTcp) {
+        mServer = new OlyServerSocket(mPort);
+    }
+    else {
+        // Listen on both IPv4 and IPv6, as OlyServerSocket does
+        int family = AF_INET6;
+        mFd = socket_cloexec(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+        if (mFd < 0) {
+            family = AF_INET;
+            mFd = socket_cloexec(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (mFd < 0) {
+                logg.logError("Error creating UDP socket");
+                handleException();
+            }
+        }
+        int on = 0;
+        if (setsockopt(mFd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *) &on, sizeof(on)) != 0) {
+            logg.logMessage("setsockopt IPV6_V6ONLY failed");
+        }
+        const int rcvbuf = NET_RCVBUF_SIZE;
+        if (setsockopt(mFd, SOL_SOCKET, SO_RCVBUF, (const char *) &rcvbuf, sizeof(rcvbuf)) != 0) {
+            logg.logMessage("Unable to set the UDP receive buffer to %d bytes", rcvbuf);
+        }
+
+        struct sockaddr_in6 sockaddr;
+        memset((void *) &sockaddr, 0, sizeof(sockaddr));
+        sockaddr.sin6_family = family;
+        sockaddr.sin6_port = htons(mPort);
+        sockaddr.sin6_addr = in6addr_any;
+        if (bind(mFd, (const struct sockaddr *) &sockaddr, sizeof(sockaddr)) < 0) {
+            logg.logError("Binding of UDP socket on port %d failed.\nIs another application using that port?", mPort);
+            handleException();
+        }
+    }
+#endif
+}
+
+NetworkDevice::~NetworkDevice()
+{
+#if !defined(WIN32)
+    if (mClient >= 0) {
+        close(mClient);
+    }
+    if (mFd >= 0) {
+        close(mFd);
+    }
+#endif
+    delete mServer;
+    free(mRing);
+    free(mPresent);
+    free(mArrival);
+}
+
+int NetworkDevice::packetSize(const unsigned char *data, int length)
+{
+    struct caiman_net_header header;
+    if (length < (int) sizeof(header)) {
+        return 0;
+    }
+    // Values are little endian, as are all supported hosts
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != CAIMAN_NET_MAGIC || header.version != CAIMAN_NET_VERSION || header.num_sources == 0) {
+        return -1;
+    }
+
+    const int size = sizeof(header) + ((header.num_sources + 3) & ~3) + header.num_samples * header.num_sources * (int) sizeof(int32_t);
+    return size <= CAIMAN_NET_MAX_PACKET ? size : -1;
+}
+
+void NetworkDevice::waitForFirstPacket(unsigned int timeoutS)
+{
+    // The sources and rate are only known once the sender is heard from
+    logg.logMessage("Waiting for the first packet on %s port %d", mTcp ? "TCP" : "UDP", mPort);
+    const uint64_t deadline = timeoutS > 0 ? getTime() + (uint64_t) timeoutS * 1000000000 : UINT64_MAX;
+    const unsigned char *packet = NULL;
+    int size = 0;
+    while (packet == NULL && !gQuit && getTime() < deadline) {
+        if (mTcp) {
+            const int length = receiveStream((char *) &mStream[mStreamLength], sizeof(mStream) - mStreamLength);
+            mStreamLength = length < 0 ? 0 : mStreamLength + length;
+            size = packetSize(mStream, mStreamLength);
+            if (size > 0 && size <= mStreamLength) {
+                packet = mStream;
+            }
+        }
+        else if (receiveDatagrams() > 0) {
+            size = packetSize(mDatagrams[0], mDatagramLengths[0]);
+            if (size > 0 && size == mDatagramLengths[0]) {
+                packet = mDatagrams[0];
+            }
+        }
+        if (size < 0) {
+            logg.logError("The first packet received on %s port %d is not in the caiman network format", mTcp ? "TCP" : "UDP", mPort);
+            handleException();
+        }
+    }
+    if (packet == NULL) {
+        logg.logError("No packets were received on %s port %d", mTcp ? "TCP" : "UDP", mPort);
+        handleException();
+    }
+
+    struct caiman_net_header header;
+    memcpy(&header, packet, sizeof(header));
+    if (header.num_sources > MAX_CHANNELS || header.rate == 0) {
+        logg.logError("The sender has %d sources at %u samples per second, at most %d sources are supported", header.num_sources,
+                      header.rate, MAX_CHANNELS);
+        handleException();
+    }
+    mNumSources = header.num_sources;
+    mFieldsSize = (mNumSources + 3) & ~3;
+    memcpy(mFieldBytes, packet + sizeof(header), mNumSources);
+    for (int source = 0; source < mNumSources; source++) {
+        mSourceFields[source] = mFieldBytes[source];
+        if (mSourceFields[source] != CAIMAN_NET_POWER && mSourceFields[source] != CAIMAN_NET_VOLTAGE &&
+            mSourceFields[source] != CAIMAN_NET_CURRENT) {
+            logg.logError("The sender gave source %d the unknown field %d", source, mSourceFields[source]);
+            handleException();
+        }
+    }
+    mSampleRate = header.rate;
+
+    // The rest is read again once the capture starts
+    mStreamLength = 0;
+    mPendingCount = 0;
+    logg.logMessage("The sender has %d sources at %u samples per second", mNumSources, mSampleRate);
+}
+
+void NetworkDevice::prepareChannels()
+{
+    mNumFields = 0;
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (!gSessionData.mCounterEnabled[index]) {
+            continue;
+        }
+        const int channel = gSessionData.mCounterChannel[index];
+        if (channel >= mNumSources) {
+            logg.logError("Channel %d was enabled but the sender only has %d sources", channel, mNumSources);
+            handleException();
+        }
+        mFieldSources[gSessionData.mCounterSource[index]] = channel;
+        mNumFields++;
+    }
+
+    // The samples in the jitter window, plus room for packets that arrive early, rounded up to a power of 2
+    const uint64_t window = (uint64_t) mJitterMs * mSampleRate / 1000;
+    mCapacity = 1;
+    while (mCapacity < window + NET_MIN_AHEAD) {
+        mCapacity *= 2;
+    }
+    mRing = (int32_t *) malloc(mCapacity * mNumFields * sizeof(int32_t));
+    mPresent = (bool *) malloc(mCapacity * sizeof(bool));
+    mArrival = (uint64_t *) malloc(mCapacity * sizeof(uint64_t));
+    if (mRing == NULL || mPresent == NULL || mArrival == NULL) {
+        logg.logError("Unable to allocate the jitter buffer of %llu samples", (unsigned long long) mCapacity);
+        handleException();
+    }
+
+    mVendor = "caiman network source";
+    mDatasize = EMETER_DATA_SIZE;
+}
+
+void NetworkDevice::init(const char *devicename)
+{
+    (void) devicename;
+    logg.logMessage("Network source on %s port %d with %d fields at %u samples per second, holding up to %llu samples for %u ms",
+                    mTcp ? "TCP" : "UDP", mPort, mNumFields, mSampleRate, (unsigned long long) mCapacity, mJitterMs);
+}
+
+void NetworkDevice::start()
+{
+#if !defined(WIN32)
+    // Discard whatever arrived between captures
+    const int fd = mTcp ? mClient : mFd;
+    char discard[CAIMAN_NET_MAX_PACKET];
+    while (fd >= 0 && recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+#endif
+    mPendingCount = 0;
+    resetDecoder();
+}
+
+void NetworkDevice::stop()
+{
+    // Nothing more will arrive, so write out everything held
+    release(mEnd);
+    flush();
+    logg.logMessage("Network source received %llu packets, %llu invalid", (unsigned long long) mPackets.load(),
+                    (unsigned long long) mInvalid.load());
+}
+
+void NetworkDevice::pause()
+{
+    stop();
+}
+
+int NetworkDevice::receiveDatagrams()
+{
+#if defined(WIN32)
+    return 0;
+#else
+    struct pollfd pollFd;
+    pollFd.fd = mFd;
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+    const int ready = poll(&pollFd, 1, MAX_POLL_MS);
+    if (ready < 0 && errno != EINTR) {
+        logg.logError("Unable to poll the UDP socket: %s", strerror(errno));
+        handleException();
+    }
+    if (ready <= 0) {
+        return 0;
+    }
+
+    int count = 0;
+    uint64_t bytes = 0;
+#if defined(__linux__)
+    // Everything queued, up to a batch, in one system call
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iovs[NET_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < NET_BATCH; i++) {
+        iovs[i].iov_base = mDatagrams[i];
+        iovs[i].iov_len = sizeof(mDatagrams[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    count = recvmmsg(mFd, msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        logg.logError("Unable to receive from the UDP socket: %s", strerror(errno));
+        handleException();
+    }
+    for (int i = 0; i < count; i++) {
+        // A truncated datagram is longer than any valid packet
+        mDatagramLengths[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0 ? -1 : (int) msgs[i].msg_len;
+        bytes += msgs[i].msg_len;
+    }
+#else
+    for (; count < NET_BATCH; count++) {
+        const ssize_t length = recv(mFd, mDatagrams[count], sizeof(mDatagrams[count]), MSG_DONTWAIT | MSG_TRUNC);
+        if (length < 0) {
+            break;
+        }
+        mDatagramLengths[count] = length > (ssize_t) sizeof(mDatagrams[count]) ? -1 : (int) length;
+        bytes += length;
+    }
+#endif
+
+    Stats::add(gStats.mBytesRead, bytes);
+    return count;
+#endif
+}
+
+int NetworkDevice::receiveStream(char *buf, int size)
+{
+#if defined(WIN32)
+    (void) buf;
+    (void) size;
+    return 0;
+#else
+    struct pollfd pollFd;
+    pollFd.fd = mClient >= 0 ? mClient : mServer->getFd();
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+    const int ready = poll(&pollFd, 1, MAX_POLL_MS);
+    if (ready < 0 && errno != EINTR) {
+        logg.logError("Unable to poll the TCP socket: %s", strerror(errno));
+        handleException();
+    }
+    if (ready <= 0) {
+        return 0;
+    }
+
+    // One sender at a time; a new connection starts a new stream
+    if (mClient < 0) {
+        mClient = mServer->acceptConnection();
+        Stats::add(mConnections, 1);
+        logg.logMessage("Network source connected");
+        return -1;
+    }
+
+    const ssize_t length = recv(mClient, buf, size, MSG_DONTWAIT);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    if (length <= 0) {
+        logg.logMessage("Network source disconnected");
+        close(mClient);
+        mClient = -1;
+        return -1;
+    }
+
+    Stats::add(gStats.mBytesRead, length);
+    return (int) length;
+#endif
+}
+
+void NetworkDevice::processBuffer()
+{
+    if (mTcp) {
+        readRaw(&mBlock);
+        if (mBlock.length == 0 && !mBlock.restarted && !mBlock.idle) {
+            return;
+        }
+        markRead(mBlock.readTime);
+        decodeRaw(&mBlock);
+        return;
+    }
+
+    // Datagrams are decoded where they were received, without packing them into a block
+    const int count = receiveDatagrams();
+    if (count > 0) {
+        mReceiveTime = getTime();
+        markRead(mReceiveTime);
+        for (int i = 0; i < count; i++) {
+            decodePacket(mDatagrams[i], mDatagramLengths[i]);
+        }
+    }
+    releaseDue();
+    flush();
+}
+
+void NetworkDevice::readRaw(RawBlock *block)
+{
+    block->length = 0;
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+
+    if (mTcp) {
+        const int length = receiveStream(block->data, sizeof(block->data));
+        block->restarted = length < 0;
+        block->length = length > 0 ? length : 0;
+        block->readTime = getTime();
+        if (block->length > 0) {
+            mLastReceived = block->readTime;
+        }
+        else {
+            setIdle(block);
+        }
+        return;
+    }
+
+    if (mPendingCount == 0) {
+        mPendingFirst = 0;
+        mPendingCount = receiveDatagrams();
+        if (mPendingCount == 0) {
+            block->readTime = getTime();
+            setIdle(block);
+            return;
+        }
+    }
+
+    // As many of the datagrams received as fit, each after its length; the rest wait for the next block
+    int pos = 0;
+    while (mPendingCount > 0) {
+        const int length = mDatagramLengths[mPendingFirst];
+        const int stored = length > 0 ? (length + 3) & ~3 : 0;
+        if (pos + (int) sizeof(int32_t) + stored > (int) sizeof(block->data)) {
+            break;
+        }
+        memcpy(&block->data[pos], &length, sizeof(length));
+        if (length > 0) {
+            memcpy(&block->data[pos + sizeof(int32_t)], mDatagrams[mPendingFirst], length);
+        }
+        pos += sizeof(int32_t) + stored;
+        mPendingFirst++;
+        mPendingCount--;
+    }
+    block->length = pos;
+    block->readTime = getTime();
+    mLastReceived = block->readTime;
+}
+
+void NetworkDevice::setIdle(RawBlock *block) const
+{
+    // Until the last data received is due, with a poll to spare as each read may wait that long
+    block->idle = block->readTime <= mLastReceived + ((uint64_t) mJitterMs + 2 * MAX_POLL_MS) * 1000000;
+}
+
+void NetworkDevice::decodeRaw(const RawBlock *block)
+{
+    const unsigned char * const data = (const unsigned char *) block->data;
+    mReceiveTime = block->readTime;
+    if (mTcp) {
+        decodeStream(data, block->length);
+        if (block->restarted) {
+            // A new sender, or the same one again, starts its own sequence
+            release(mEnd);
+            mSynced = false;
+            mStreamLength = 0;
+        }
+    }
+    else {
+        for (int pos = 0; pos < block->length;) {
+            int length;
+            memcpy(&length, &data[pos], sizeof(length));
+            pos += sizeof(int32_t);
+            decodePacket(&data[pos], length);
+            pos += length > 0 ? (length + 3) & ~3 : 0;
+        }
+    }
+    releaseDue();
+    flush();
+}
+
+void NetworkDevice::resetDecoder()
+{
+    mStreamLength = 0;
+    mSynced = false;
+    mNext = 0;
+    mEnd = 0;
+    memset(mPresent, 0, mCapacity * sizeof(bool));
+    memset(mLast, 0, sizeof(mLast));
+    mOutLength = 0;
+}
+
+void NetworkDevice::decodeStream(const unsigned char *data, int length)
+{
+    while (length > 0) {
+        int copied = (int) sizeof(mStream) - mStreamLength;
+        if (copied > length) {
+            copied = length;
+        }
+        memcpy(&mStream[mStreamLength], data, copied);
+        mStreamLength += copied;
+        data += copied;
+        length -= copied;
+
+        int pos = 0;
+        for (;;) {
+            const int size = packetSize(&mStream[pos], mStreamLength - pos);
+            if (size < 0) {
+                // The packet boundaries were lost, so skip to the next header
+                Stats::add(mInvalid, 1);
+                const uint32_t magic = CAIMAN_NET_MAGIC;
+                for (pos++; pos + (int) sizeof(magic) <= mStreamLength && memcmp(&mStream[pos], &magic, sizeof(magic)) != 0; pos++) {
+                }
+                continue;
+            }
+            if (size == 0 || size > mStreamLength - pos) {
+                break;
+            }
+            decodePacket(&mStream[pos], size);
+            pos += size;
+        }
+        memmove(mStream, &mStream[pos], mStreamLength - pos);
+        mStreamLength -= pos;
+    }
+}
+
+void NetworkDevice::decodePacket(const unsigned char *data, int length)
+{
+    struct caiman_net_header header;
+    if (length <= 0 || packetSize(data, length) != length) {
+        Stats::add(mInvalid, 1);
+        return;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.num_sources != mNumSources || header.rate != mSampleRate || memcmp(data + sizeof(header), mFieldBytes, mNumSources) != 0) {
+        Stats::add(mInvalid, 1);
+        return;
+    }
+
+    Stats::add(mPackets, 1);
+    Stats::add(gStats.mFramesRead, header.num_samples);
+    store(header.sequence, header.num_samples, data + sizeof(header) + mFieldsSize);
+}
+
+void NetworkDevice::store(uint64_t sequence, int count, const unsigned char *values)
+{
+    if (count == 0) {
+        return;
+    }
+
+    const uint64_t maxGap = (uint64_t) NET_MAX_GAP_S * mSampleRate;
+    if (mSynced && (sequence + count + mCapacity <= mNext || sequence > mEnd + maxGap)) {
+        // The sender restarted, so write out what is held and follow its new sequence
+        release(mEnd);
+        mSynced = false;
+        Stats::add(mResyncs, 1);
+    }
+    if (!mSynced) {
+        mNext = sequence;
+        mEnd = sequence;
+        mSynced = true;
+    }
+
+    // Samples already written out are too late to use
+    if (sequence < mNext) {
+        Stats::add(mLate, 1);
+        const uint64_t skip = mNext - sequence;
+        if (skip >= (uint64_t) count) {
+            return;
+        }
+        values += skip * mNumSources * sizeof(int32_t);
+        count -= (int) skip;
+        sequence = mNext;
+    }
+    // Make room for samples beyond the jitter buffer by writing out the oldest, gaps and all
+    if (sequence + count > mNext + mCapacity) {
+        release(sequence + count - mCapacity);
+    }
+    if (sequence < mEnd) {
+        Stats::add(mReordered, 1);
+    }
+
+    const size_t rowSize = mNumSources * sizeof(int32_t);
+    bool duplicate = false;
+    for (int i = 0; i < count; i++) {
+        const uint64_t slot = (sequence + i) & (mCapacity - 1);
+        if (mPresent[slot]) {
+            duplicate = true;
+            continue;
+        }
+        int32_t * const sample = &mRing[slot * mNumFields];
+        const unsigned char * const row = values + i * rowSize;
+        for (int field = 0; field < mNumFields; field++) {
+            memcpy(&sample[field], row + mFieldSources[field] * sizeof(int32_t), sizeof(int32_t));
+        }
+        mPresent[slot] = true;
+        mArrival[slot] = mReceiveTime;
+    }
+    if (duplicate) {
+        Stats::add(mDuplicates, 1);
+    }
+    if (sequence + count > mEnd) {
+        mEnd = sequence + count;
+    }
+}
+
+void NetworkDevice::release(uint64_t limit)
+{
+    const uint64_t end = limit > mEnd ? limit : mEnd;
+    uint64_t missing = 0;
+    for (; mNext < end; mNext++) {
+        const uint64_t slot = mNext & (mCapacity - 1);
+        if (mPresent[slot]) {
+            mPresent[slot] = false;
+            memcpy(mLast, &mRing[slot * mNumFields], mNumFields * sizeof(int32_t));
+        }
+        else if (mNext < limit) {
+            // Waited long enough, so repeat the previous sample in its place
+            missing++;
+        }
+        else {
+            break;
+        }
+        emit(mLast);
+    }
+    if (mEnd < mNext) {
+        mEnd = mNext;
+    }
+    if (missing > 0) {
+        Stats::add(gStats.mMissingFrames, missing);
+    }
+}
+
+void NetworkDevice::releaseDue()
+{
+    const uint64_t now = getTime();
+    const uint64_t jitterNs = (uint64_t) mJitterMs * 1000000;
+    const uint64_t deadline = now > jitterNs ? now - jitterNs : 0;
+    for (;;) {
+        // Everything before the first missing sample
+        release(mNext);
+        if (mNext >= mEnd) {
+            return;
+        }
+        // The sample before mEnd is always held, so there is one after the gap
+        uint64_t after = mNext + 1;
+        while (after < mEnd && !mPresent[after & (mCapacity - 1)]) {
+            after++;
+        }
+        if (mArrival[after & (mCapacity - 1)] > deadline) {
+            return;
+        }
+        release(after);
+    }
+}
+
+void NetworkDevice::emit(const int32_t *sample)
+{
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+    if (mOutLength + sampleSize > sizeof(mOutBuffer)) {
+        flush();
+    }
+    memcpy((char *) mOutBuffer + mOutLength, sample, sampleSize);
+    mOutLength += sampleSize;
+}
+
+void NetworkDevice::flush()
+{
+    if (mOutLength > 0) {
+        writeData(mOutBuffer, mOutLength);
+        mOutLength = 0;
+    }
+}
+
+int NetworkDevice::appendXML(char *xml, int pos, int size) const
+{
+    pos = appendFormat(xml, pos, size,
+                       "  <network protocol=\"%s\" port=\"%d\" jitter_ms=\"%u\" packets=\"%llu\" invalid=\"%llu\" reordered=\"%llu\" late=\"%llu\" duplicates=\"%llu\" resyncs=\"%llu\" connections=\"%llu\"/>\n",
+                       mTcp ? "tcp" : "udp", mPort, mJitterMs, (unsigned long long) mPackets.load(), (unsigned long long) mInvalid.load(),
+                       (unsigned long long) mReordered.load(), (unsigned long long) mLate.load(), (unsigned long long) mDuplicates.load(),
+                       (unsigned long long) mResyncs.load(), (unsigned long long) mConnections.load());
+
+    return pos;
+}
@@ -0,0 +1,154 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETWORK_DEVICE_H
+#define NETWORK_DEVICE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "CaimanNet.h"
+#include "Devices.h"
+
+class OlyServerSocket;
+
+// Datagrams received with one call
+#define NET_BATCH           32
+// Bytes of samples written at once, must not exceed the fifo's single buffer size
+#define NET_BUFFER_SIZE     (1 << 14)
+
+// Receives samples pushed by a network source in the format of CaimanNet.h, over UDP or TCP. Each of the sender's
+// sources is one channel with a single field; they are learned from the first packet, which waitForFirstPacket waits
+// for. UDP datagrams are received in batches. Packets are put back in order by sequence in a jitter buffer, which holds
+// samples for up to jitterMs after they arrive waiting for any missing before them. A gap still open after that is
+// filled by repeating the previous sample, and counted as missing frames.
+class NetworkDevice : public Device
+{
+public:
+    // Listens on port, for TCP connections if tcp or UDP datagrams otherwise
+    NetworkDevice(const char *outputPath, bool tcp, int port, unsigned int jitterMs);
+    virtual ~NetworkDevice();
+
+    // Learns the sender's sources and rate from its first packet, waiting up to timeoutS seconds for it, or until
+    // interrupted if 0. Must be called before anything else.
+    void waitForFirstPacket(unsigned int timeoutS);
+
+    int getNumSources() const
+    {
+        return mNumSources;
+    }
+    // Returns the field of source, one of POWER, VOLTAGE or CURRENT
+    int getSourceField(int source) const
+    {
+        return mSourceFields[source];
+    }
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+    // Appends a <network> element with the packet counters to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    // Returns the size of the packet starting at data, 0 if more than length bytes are needed to tell, or -1 if it is
+    // not a valid packet
+    static int packetSize(const unsigned char *data, int length);
+
+    // Read stage
+    // Waits briefly for datagrams, returning how many were received into mDatagrams
+    int receiveDatagrams();
+    // Waits briefly for a connection or bytes on it, returning the bytes received into buf, 0 if none, or -1 if the
+    // connection ended
+    int receiveStream(char *buf, int size);
+    // Marks a block with nothing read as idle while the decode stage may still hold samples that are not yet due
+    void setIdle(RawBlock *block) const;
+
+    // Decode stage
+    void resetDecoder();
+    void decodeStream(const unsigned char *data, int length);
+    void decodePacket(const unsigned char *data, int length);
+    void store(uint64_t sequence, int count, const unsigned char *values);
+    // Writes out samples in order up to the first missing one after limit, filling earlier gaps
+    void release(uint64_t limit);
+    // Writes out samples in order, filling each gap once the sample after it has been held for the jitter window
+    void releaseDue();
+    void emit(const int32_t *sample);
+    void flush();
+
+    const bool mTcp;
+    const int mPort;
+    const unsigned int mJitterMs;
+    int mFd;
+    OlyServerSocket *mServer;
+    int mClient;
+
+    // From the first packet
+    int mNumSources;
+    int mSourceFields[MAX_CHANNELS];
+    unsigned char mFieldBytes[MAX_CHANNELS];
+    int mFieldsSize;
+    // Source of each field of a sample
+    int mFieldSources[MAX_FIELDS];
+
+    // Read stage, with datagrams not yet passed on by readRaw
+    unsigned char mDatagrams[NET_BATCH][CAIMAN_NET_MAX_PACKET];
+    int mDatagramLengths[NET_BATCH];
+    int mPendingFirst;
+    int mPendingCount;
+    // When data was last passed on, so the decode stage is prompted until everything it holds is due
+    uint64_t mLastReceived;
+
+    // Decode stage: a packet split between TCP reads, and the jitter buffer of samples in caiman's format
+    unsigned char mStream[CAIMAN_NET_MAX_PACKET];
+    int mStreamLength;
+    int32_t *mRing;
+    bool *mPresent;
+    // When each sample held was received
+    uint64_t *mArrival;
+    uint64_t mCapacity;
+    // When the data being decoded was received
+    uint64_t mReceiveTime;
+    bool mSynced;
+    // Next sample to write out, and the sample after the latest received
+    uint64_t mNext;
+    uint64_t mEnd;
+    int32_t mLast[MAX_FIELDS];
+    int32_t mOutBuffer[NET_BUFFER_SIZE / sizeof(int32_t)];
+    size_t mOutLength;
+
+    std::atomic<uint64_t> mPackets;
+    std::atomic<uint64_t> mInvalid;
+    std::atomic<uint64_t> mReordered;
+    std::atomic<uint64_t> mLate;
+    std::atomic<uint64_t> mDuplicates;
+    std::atomic<uint64_t> mResyncs;
+    std::atomic<uint64_t> mConnections;
+
+    RawBlock mBlock;
+
+    // Intentionally unimplemented
+    NetworkDevice(const NetworkDevice &);
+    NetworkDevice &operator=(const NetworkDevice &);
+};
+
+#endif // NETWORK_DEVICE_H
@@ -14,17 +14,64 @@
  * limitations under the License.
  */
 
-#if defined(SUPPORT_DAQ)
-
 #include "NiDaq.h"
 
+unsigned int NiDaq::convertRow(const double *row, const char *fields, const int *resistors, unsigned char *outbuf)
+{
+    int value;
+    unsigned int col = 0, outidx = 0;
+
+    for (int chan = 0; chan < MAX_CHANNELS; chan++) {
+        double v, i;
+        if (!fields[chan]) {
+            continue;
+        }
+
+        v = row[(col*2) + 0];
+        i = row[(col*2) + 1];
+        i = (i * 1000.0) / ((double)resistors[chan]); // i=v/r (and scale mOhms -> Ohms)
+        col++;
+
+        // Emeter always outputs enabled fields in the order POWER, VOLTAGE, CURRENT
+        if (fields[chan] & POWER) {
+            value = (int)(v*i*1000.0); // mW
+            value = (value < 0)?0:value;
+            outbuf[outidx++] = value & 0xFF;
+            outbuf[outidx++] = (value >> 8) & 0xFF;
+            outbuf[outidx++] = (value >> 16) & 0xFF;
+            outbuf[outidx++] = (value >> 24) & 0xFF;
+        }
+        if (fields[chan] & VOLTAGE) {
+            value = (int)(v*1000.0); // mV
+            value = (value < 0)?0:value;
+            outbuf[outidx++] = value & 0xFF;
+            outbuf[outidx++] = (value >> 8) & 0xFF;
+            outbuf[outidx++] = (value >> 16) & 0xFF;
+            outbuf[outidx++] = (value >> 24) & 0xFF;
+        }
+        if (fields[chan] & CURRENT) {
+            value = (int)(i*1000.0); // mA
+            value = (value < 0)?0:value;
+            outbuf[outidx++] = value & 0xFF;
+            outbuf[outidx++] = (value >> 8) & 0xFF;
+            outbuf[outidx++] = (value >> 16) & 0xFF;
+            outbuf[outidx++] = (value >> 24) & 0xFF;
+        }
+    } // for each channel
+
+    return outidx;
+}
+
+#if defined(SUPPORT_DAQ)
+
 #include "Logging.h"
+#include "Stats.h"
 
 // Support can be compiled out - in this case there is no
-// source dependency on the NI DAQmx Base header, and this
-// class doesn't exist at all.
+// source dependency on the NI DAQmx Base header, and the
+// rest of this class doesn't exist at all.
 
-NiDaq::NiDaq(const char *outputPath, FILE *binfile, Fifo *fifo) : Device(outputPath, binfile, fifo) {
+NiDaq::NiDaq(const char *outputPath) : Device(outputPath) {
     mIsRunning = false;
     mDllsLoaded = false;
     mDaqMx = DAQmxFuncs::getInstance();
@@ -96,6 +143,16 @@ void NiDaq::stop() {
     }
 }
 
+void NiDaq::pause() {
+    // The task keeps its configuration and can be started again
+    if (mIsRunning) {
+        mIsRunning = false;
+        if (!mDaqMx->stopTask()) {
+            mDaqMx->handleError("StopTask");
+        }
+    }
+}
+
 void NiDaq::processBuffer() {
     static const int BUF_SIZE = mWindow * MAX_CHANNELS;
     double data[BUF_SIZE];
@@ -106,52 +163,45 @@ void NiDaq::processBuffer() {
     if (!mDaqMx->readAnalogF64(mWindow, 1.0, data, BUF_SIZE, &read, NULL)) {
         mDaqMx->handleError("ReadAnalogF64");
     }
+    markRead(getTime());
+    Stats::add(gStats.mBytesRead, read * mDaqChannels * sizeof(double));
+    Stats::add(gStats.mFramesRead, read);
 
     // Parse it, write it.
     for (int row=0; row < read; row++) {
-        int value;
-        unsigned int col = 0, outidx = 0;
         unsigned char outbuf[MAX_CHANNELS * EMETER_DATA_SIZE * MAX_FIELDS];
+        const unsigned int outidx = convertRow(&data[row*mDaqChannels], mFields, mResistors, outbuf);
+        writeData(outbuf, outidx);
+    } // for each row
+}
 
-        for (int chan = 0; chan < MAX_CHANNELS; chan++) {
-            double v, i;
-            if (!mFields[chan]) {
-                continue;
-            }
+void NiDaq::readRaw(RawBlock *block) {
+    // Read fewer rows than processBuffer so they fit in a block
+    double * const data = (double *) block->data;
+    const int rows = RAW_BLOCK_SIZE / (mDaqChannels * sizeof(double));
+    int32_t read = 0;
 
-            v = data[(row*mDaqChannels) + (col*2) + 0];
-            i = data[(row*mDaqChannels) + (col*2) + 1];
-            i = (i * 1000.0) / ((double)gSessionData.mResistors[chan]); // i=v/r (and scale mOhms -> Ohms)
-            col++;
-
-            // Emeter always outputs enabled fields in the order POWER, VOLTAGE, CURRENT
-            if (mFields[chan] & POWER) {
-                value = (int)(v*i*1000.0); // mW
-                value = (value < 0)?0:value;
-                outbuf[outidx++] = value & 0xFF;
-                outbuf[outidx++] = (value >> 8) & 0xFF;
-                outbuf[outidx++] = (value >> 16) & 0xFF;
-                outbuf[outidx++] = (value >> 24) & 0xFF;
-            }
-            if (mFields[chan] & VOLTAGE) {
-                value = (int)(v*1000.0); // mV
-                value = (value < 0)?0:value;
-                outbuf[outidx++] = value & 0xFF;
-                outbuf[outidx++] = (value >> 8) & 0xFF;
-                outbuf[outidx++] = (value >> 16) & 0xFF;
-                outbuf[outidx++] = (value >> 24) & 0xFF;
-            }
-            if (mFields[chan] & CURRENT) {
-                value = (int)(i*1000.0); // mA
-                value = (value < 0)?0:value;
-                outbuf[outidx++] = value & 0xFF;
-                outbuf[outidx++] = (value >> 8) & 0xFF;
-                outbuf[outidx++] = (value >> 16) & 0xFF;
-                outbuf[outidx++] = (value >> 24) & 0xFF;
-            }
-        } // for each channel
+    if (!mDaqMx->readAnalogF64(rows < mWindow ? rows : mWindow, 1.0, data, RAW_BLOCK_SIZE / sizeof(double), &read, NULL)) {
+        mDaqMx->handleError("ReadAnalogF64");
+    }
+    block->readTime = getTime();
+    block->length = read * mDaqChannels * sizeof(double);
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+    Stats::add(gStats.mBytesRead, block->length);
+}
+
+void NiDaq::decodeRaw(const RawBlock *block) {
+    const double * const data = (const double *) block->data;
+    const int read = block->length / (mDaqChannels * sizeof(double));
+
+    Stats::add(gStats.mFramesRead, read);
+    for (int row=0; row < read; row++) {
+        unsigned char outbuf[MAX_CHANNELS * EMETER_DATA_SIZE * MAX_FIELDS];
+        const unsigned int outidx = convertRow(&data[row*mDaqChannels], mFields, mResistors, outbuf);
         writeData(outbuf, outidx);
-    } // for each row
+    }
 }
 
 void NiDaq::lookup_daq() {
@@ -173,6 +223,9 @@ void NiDaq::prepareChannels() {
 
     for (index = 0; index < MAX_CHANNELS; index ++) {
         mFields[index] = 0;
+        mResistors[index] = gSessionData.mResistors[index];
+        mDaqCh[index][mVoltageField][0] = '\0';
+        mDaqCh[index][mCurrentField][0] = '\0';
     }
 
     // Similar to the EnergyMeter:
@@ -189,6 +242,13 @@ void NiDaq::prepareChannels() {
         }
         // bitwise OR all types on a per channel basis
         mFields[gSessionData.mCounterChannel[index]] |= gSessionData.mCounterField[index];
+
+        // DAQ channel not supported for POWER fields
+        const int field = gSessionData.mCounterField[index];
+        if (field & (VOLTAGE | CURRENT)) {
+            snprintf(mDaqCh[gSessionData.mCounterChannel[index]][(field & VOLTAGE) ? mVoltageField : mCurrentField],
+                     MAX_STRING_LEN, "%s", gSessionData.mCounterDaqCh[index]);
+        }
     }
 
     // Write captured.xml before initializing the device for live as initializing
@@ -203,26 +263,15 @@ void NiDaq::enableChannels() {
     // Work out if we've been told which DAQ channel to use
     char *daq_channel[MAX_CHANNELS][MAX_FIELDS_PER_CHANNEL];
     memset(&daq_channel, 0, sizeof(daq_channel));
-    for (index = 0; index < MAX_COUNTERS; index++) {
-        if (!gSessionData.mCounterEnabled[index]) {
-            continue;
-        }
-
-        int chan = gSessionData.mCounterChannel[index];
-        int field = gSessionData.mCounterField[index];
-
-        if (field & VOLTAGE) {
-            field = mVoltageField;
-        }
-        else if (field & CURRENT) {
-            field = mCurrentField;
+    for (index = 0; index < MAX_CHANNELS; index++) {
+        // DAQ channel not supported for POWER fields
+        if (mFields[index] & VOLTAGE) {
+            daq_channel[index][mVoltageField] = get_channel_info(mDaqCh[index][mVoltageField], mVoltageField, index);
         }
-        else {
-            continue; // DAQ channel not supported for POWER fields
+        if (mFields[index] & CURRENT) {
+            daq_channel[index][mCurrentField] = get_channel_info(mDaqCh[index][mCurrentField], mCurrentField, index);
         }
-
-        daq_channel[chan][field] = get_channel_info(gSessionData.mCounterDaqCh[index], field, chan);
-    } // for index over MAX_COUNTERS
+    } // for index over MAX_CHANNELS
 
       // The next part is different for the DAQ. For every channel where ANY field is on,
       // collect BOTH V & I. (No 'power' channel for DAQ.)
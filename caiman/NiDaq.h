@@ -24,21 +24,29 @@
 class NiDaq : public Device
 {
 public:
-    NiDaq(const char *outputPath, FILE *binfile, Fifo *fifo);
+    NiDaq(const char *outputPath);
     virtual ~NiDaq();
 
     virtual void prepareChannels();
     virtual void init(const char *device);
     virtual void start();
     virtual void stop();
+    virtual void pause();
     virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+    // Converts one row of interleaved voltage and current readings for the channels enabled in fields, with shunt
+    // resistors in milliohms, into the Energy Probe output format; returns the number of bytes written to outbuf.
+    // Available even when DAQ support is compiled out so it can be benchmarked.
+    static unsigned int convertRow(const double *row, const char *fields, const int *resistors, unsigned char *outbuf);
 
 private:
     void enableChannels();
     void lookup_daq();
     char *get_channel_info(char *config_chan, int field, int chan);
 
-    static const int mWindow = mSampleRate / 10;
+    static const int mWindow = mDefaultSampleRate / 10;
 
     static const int mVoltageField = 0; // Used to determine DAQ channel numbering.
     static const int mCurrentField = 1; // (Default is Voltage channel first.)
@@ -53,7 +61,11 @@ private:
     char mDev[MAX_DEVICE_LEN];
     int mDaqChannels;
 
+    // Initialized on prepareChannels, as gSessionData describes every merged device once they are all prepared
     char mFields[MAX_CHANNELS];
+    int mResistors[MAX_CHANNELS];
+    // DAQ channel of the voltage and current of each channel, empty for the default
+    char mDaqCh[MAX_CHANNELS][2][MAX_STRING_LEN];
 
     // Intentionally unimplemented
     NiDaq(const NiDaq &);
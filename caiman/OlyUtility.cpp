@@ -18,6 +18,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,8 +26,10 @@
 #if defined(WIN32)
 #include <windows.h>
 #elif defined(__linux__)
+#include <time.h>
 #include <unistd.h>
 #elif defined(DARWIN)
+#include <time.h>
 #include <mach-o/dyld.h>
 #endif
 
@@ -282,3 +285,39 @@ char* getPathPart(char* path)
 
     return (path);
 }
+
+uint64_t getTime()
+{
+#if defined(WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&count);
+    return (uint64_t) ((double) count.QuadPart * 1000000000.0 / (double) frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int appendFormat(char *buf, int pos, int size, const char *format, ...)
+{
+    if (pos >= size - 1) {
+        return size - 1;
+    }
+
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(&buf[pos], size - pos, format, args);
+    va_end(args);
+
+    // Older C runtimes return -1 and leave the output unterminated when it is truncated
+    if (n < 0 || n >= size - pos) {
+        buf[size - 1] = '\0';
+        return size - 1;
+    }
+    return pos + n;
+}
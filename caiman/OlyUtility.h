@@ -18,6 +18,7 @@
 #define OLY_UTILITY_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef WIN32
 #include <stdio.h>
@@ -44,5 +45,14 @@ int appendToDisk(const char* path, const char* file);
 int copyFile(const char* srcFile, const char* dstFile);
 const char* getFilePart(const char* path);
 char* getPathPart(char* path);
+// Monotonic time in nanoseconds
+uint64_t getTime();
+// Formats at pos in buf of size bytes, returning the new position. Output that does not fit is truncated and the
+// position stops at the terminating null, so it can be called repeatedly without checking for overflow.
+int appendFormat(char *buf, int pos, int size, const char *format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 4, 5)))
+#endif
+    ;
 
 #endif // OLY_UTILITY_H
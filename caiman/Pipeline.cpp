@@ -0,0 +1,167 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+#include "Thread.h"
+
+// Main.cpp defines Quit
+extern volatile bool gQuit;
+
+Pipeline::Pipeline(Device *device, int numBlocks)
+        : mDevice(device),
+          mNumBlocks(numBlocks),
+          mBlocks(NULL),
+          mHead(0),
+          mTail(0),
+          mBlocksRead(0),
+          mBytesRead(0),
+          mReadStallNs(0),
+          mHighWater(0),
+          mBlocksDecoded(0),
+          mBlocksDropped(0),
+          mDecodeNs(0),
+          mQueueLatency()
+{
+    mBlocks = (RawBlock *) malloc(mNumBlocks * sizeof(RawBlock));
+    if (mBlocks == NULL) {
+        logg.logError("Failed to allocate %d bytes for the pipeline", (int) (mNumBlocks * sizeof(RawBlock)));
+        handleException();
+    }
+
+    if (sem_init(&mFreeSem, 0, mNumBlocks) || sem_init(&mFilledSem, 0, 0)) {
+        logg.logError("sem_init() failed");
+        handleException();
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    sem_destroy(&mFreeSem);
+    sem_destroy(&mFilledSem);
+    free(mBlocks);
+}
+
+void Pipeline::run()
+{
+    if (!THREAD_CREATE(mDecodeThread, decodeThread, this)) {
+        logg.logError("Failed to create decode thread");
+        handleException();
+    }
+
+    RawBlock *block = NULL;
+    for (;;) {
+        if (block == NULL) {
+            const uint64_t waitStart = getTime();
+            sem_wait(&mFreeSem);
+            Stats::add(mReadStallNs, getTime() - waitStart);
+            block = &mBlocks[mHead];
+        }
+
+        if (gQuit) {
+            // Tell the decode stage there is nothing more to come
+            block->length = -1;
+        }
+        else {
+            mDevice->readRaw(block);
+            if (block->length == 0 && !block->restarted && !block->idle) {
+                // Nothing read, so keep the block for the next attempt
+                continue;
+            }
+            Stats::add(mBlocksRead, 1);
+            Stats::add(mBytesRead, block->length);
+        }
+
+        mHead = (mHead + 1) % mNumBlocks;
+        sem_post(&mFilledSem);
+
+        // Only the read stage raises the high water mark, so this cannot race with another update
+        const int occupancy = (int) (mBlocksRead.load(std::memory_order_relaxed) - mBlocksDecoded.load(std::memory_order_relaxed));
+        if (occupancy > mHighWater.load(std::memory_order_relaxed)) {
+            mHighWater.store(occupancy, std::memory_order_relaxed);
+        }
+
+        if (block->length < 0) {
+            break;
+        }
+        block = NULL;
+    }
+
+    THREAD_JOIN(mDecodeThread);
+}
+
+void *Pipeline::decodeThread(void *pVoid)
+{
+    Pipeline * const pipeline = (Pipeline *) pVoid;
+
+    gStats.registerThread("decode");
+    pipeline->decode();
+
+    return 0;
+}
+
+void Pipeline::decode()
+{
+    for (;;) {
+        sem_wait(&mFilledSem);
+        const RawBlock * const block = &mBlocks[mTail];
+        mTail = (mTail + 1) % mNumBlocks;
+
+        if (block->length < 0) {
+            sem_post(&mFreeSem);
+            break;
+        }
+
+        if (gQuit) {
+            // The sender stops at gQuit, so writing more to the fifo could block forever
+            Stats::add(mBlocksDropped, 1);
+        }
+        else {
+            const uint64_t decodeStart = getTime();
+            mQueueLatency.record(decodeStart - block->readTime);
+            gLatency.markRead(block->readTime);
+            mDevice->decodeRaw(block);
+            Stats::add(mDecodeNs, getTime() - decodeStart);
+        }
+
+        Stats::add(mBlocksDecoded, 1);
+        sem_post(&mFreeSem);
+    }
+}
+
+int Pipeline::appendXML(char *xml, int pos, int size) const
+{
+    const uint64_t blocksRead = mBlocksRead.load();
+    const uint64_t blocksDecoded = mBlocksDecoded.load();
+
+    pos = appendFormat(xml, pos, size, "  <pipeline blocks=\"%d\" block_size=\"%d\" occupancy=\"%d\" high_water=\"%d\">\n",
+                       mNumBlocks, RAW_BLOCK_SIZE, (int) (blocksRead - blocksDecoded), mHighWater.load());
+    pos = appendFormat(xml, pos, size, "    <read blocks=\"%llu\" bytes=\"%llu\" stall_ns=\"%llu\"/>\n",
+                       (unsigned long long) blocksRead, (unsigned long long) mBytesRead.load(), (unsigned long long) mReadStallNs.load());
+    pos = appendFormat(xml, pos, size, "    <decode blocks=\"%llu\" dropped=\"%llu\" busy_ns=\"%llu\" queue_p50_ns=\"%llu\" queue_p99_ns=\"%llu\" queue_max_ns=\"%llu\"/>\n",
+                       (unsigned long long) blocksDecoded, (unsigned long long) mBlocksDropped.load(), (unsigned long long) mDecodeNs.load(),
+                       (unsigned long long) mQueueLatency.getPercentile(50.0), (unsigned long long) mQueueLatency.getPercentile(99.0),
+                       (unsigned long long) mQueueLatency.getMax());
+    pos = appendFormat(xml, pos, size, "  </pipeline>\n");
+
+    return pos;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "Devices.h"
+#include "Fifo.h"
+#include "Latency.h"
+
+// Default number of blocks between the read and decode stages
+#define PIPELINE_BLOCKS 256
+
+// Splits acquisition into a read stage, which only drains the device, and a decode stage on its own thread, connected
+// by a single producer, single consumer ring of raw blocks. The decode stage writes to the fifo as processBuffer would,
+// so a burst of decoding, logging or a full fifo delays the device reads only once the ring has filled.
+class Pipeline
+{
+public:
+    Pipeline(Device *device, int numBlocks);
+    ~Pipeline();
+
+    // Runs the read stage on the calling thread until gQuit is set, then waits for the decode stage to finish
+    void run();
+
+    // Appends a <pipeline> element to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    static void *decodeThread(void *pVoid);
+    void decode();
+
+    Device * const mDevice;
+    const int mNumBlocks;
+    RawBlock *mBlocks;
+    // Count the free and filled blocks, which also orders the accesses to them
+    sem_t mFreeSem;
+    sem_t mFilledSem;
+    // Read stage only
+    int mHead;
+    // Decode stage only
+    int mTail;
+#if defined(WIN32)
+    HANDLE mDecodeThread;
+#else
+    pthread_t mDecodeThread;
+#endif
+
+    // Read stage
+    std::atomic<uint64_t> mBlocksRead;
+    std::atomic<uint64_t> mBytesRead;
+    // Time spent waiting for the decode stage to free a block
+    std::atomic<uint64_t> mReadStallNs;
+    std::atomic<int> mHighWater;
+
+    // Decode stage
+    std::atomic<uint64_t> mBlocksDecoded;
+    std::atomic<uint64_t> mBlocksDropped;
+    std::atomic<uint64_t> mDecodeNs;
+    // From the end of a read to the start of its decoding
+    LatencyHistogram mQueueLatency;
+
+    // Intentionally unimplemented
+    Pipeline(const Pipeline &);
+    Pipeline &operator=(const Pipeline &);
+};
+
+#endif // PIPELINE_H
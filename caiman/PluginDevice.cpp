@@ -0,0 +1,205 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PluginDevice.h"
+
+#include <string.h>
+
+#include "Logging.h"
+#include "Stats.h"
+
+// Longest time a read waits for samples, so gQuit is noticed promptly
+#define READ_TIMEOUT_MS 10
+
+PluginDevice::PluginDevice(const char *outputPath, const char *path, const char *args)
+        : Device(outputPath),
+          mHandle(NULL),
+          mPlugin(NULL),
+          mInstance(NULL),
+          mNumSources(0),
+          mStarted(false)
+{
+    mHandle = load_dll(path);
+    if (mHandle == NULL) {
+        logg.logError("Unable to load the plugin %s", path);
+        handleException();
+    }
+    const caiman_plugin_entry_func entry = (caiman_plugin_entry_func) load_symbol(mHandle, CAIMAN_PLUGIN_ENTRY);
+    if (entry == NULL) {
+        logg.logError("%s is not a caiman plugin, as it has no %s", path, CAIMAN_PLUGIN_ENTRY);
+        handleException();
+    }
+
+    // Every member of version 1 is required; later versions only add to the end
+    mPlugin = entry(CAIMAN_PLUGIN_ABI_VERSION);
+    if (mPlugin == NULL || mPlugin->abi_version < 1 || mPlugin->abi_version > CAIMAN_PLUGIN_ABI_VERSION ||
+        mPlugin->size < sizeof(struct caiman_plugin)) {
+        logg.logError("The plugin %s does not support version %d of the plugin interface", path, CAIMAN_PLUGIN_ABI_VERSION);
+        handleException();
+    }
+    if (mPlugin->name == NULL || mPlugin->create == NULL || mPlugin->destroy == NULL || mPlugin->get_error == NULL ||
+        mPlugin->describe == NULL || mPlugin->prepare == NULL || mPlugin->init == NULL || mPlugin->start == NULL ||
+        mPlugin->stop == NULL || mPlugin->read == NULL) {
+        logg.logError("The plugin %s is missing required functions", path);
+        handleException();
+    }
+
+    mInstance = mPlugin->create(args != NULL ? args : "");
+    if (mInstance == NULL) {
+        fail("create an instance");
+    }
+
+    uint32_t rate = 0;
+    mNumSources = mPlugin->describe(mInstance, mSourceFields, MAX_CHANNELS, &rate);
+    if (mNumSources < 0) {
+        fail("describe its sources");
+    }
+    if (mNumSources == 0 || mNumSources > MAX_CHANNELS || rate == 0) {
+        logg.logError("The plugin %s described %d sources at %u samples per second", mPlugin->name, mNumSources, rate);
+        handleException();
+    }
+    for (int source = 0; source < mNumSources; source++) {
+        const int field = mSourceFields[source];
+        if (field != CAIMAN_PLUGIN_POWER && field != CAIMAN_PLUGIN_VOLTAGE && field != CAIMAN_PLUGIN_CURRENT) {
+            logg.logError("The plugin %s gave source %d the unknown field %d", mPlugin->name, source, field);
+            handleException();
+        }
+    }
+    mSampleRate = rate;
+
+    logg.logMessage("Loaded the plugin %s from %s, with %d sources at %u samples per second", mPlugin->name, path, mNumSources,
+                    mSampleRate);
+}
+
+PluginDevice::~PluginDevice()
+{
+    if (mInstance != NULL) {
+        if (mStarted) {
+            mPlugin->stop(mInstance);
+        }
+        mPlugin->destroy(mInstance);
+    }
+    if (mHandle != NULL) {
+        unload_dll(mHandle);
+    }
+}
+
+void PluginDevice::fail(const char *what) const
+{
+    const char * const error = mPlugin->get_error(mInstance);
+    logg.logError("The plugin %s failed to %s: %s", mPlugin->name, what, error != NULL ? error : "unknown error");
+    handleException();
+}
+
+void PluginDevice::prepareChannels()
+{
+    // The plugin gives each sample's fields in caiman's order, so they need no reordering
+    int sources[MAX_FIELDS];
+    mNumFields = 0;
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (!gSessionData.mCounterEnabled[index]) {
+            continue;
+        }
+        const int channel = gSessionData.mCounterChannel[index];
+        if (channel >= mNumSources) {
+            logg.logError("Channel %d was enabled but the plugin %s only has %d sources", channel, mPlugin->name, mNumSources);
+            handleException();
+        }
+        sources[gSessionData.mCounterSource[index]] = channel;
+        mNumFields++;
+    }
+    if (mPlugin->prepare(mInstance, sources, mNumFields) < 0) {
+        fail("prepare its sources");
+    }
+
+    mVendor = mPlugin->name;
+    mDatasize = EMETER_DATA_SIZE;
+}
+
+void PluginDevice::init(const char *devicename)
+{
+    (void) devicename;
+    if (mPlugin->init(mInstance) < 0) {
+        fail("initialize");
+    }
+}
+
+void PluginDevice::start()
+{
+    if (mPlugin->start(mInstance) < 0) {
+        fail("start");
+    }
+    mStarted = true;
+}
+
+void PluginDevice::stop()
+{
+    if (mStarted) {
+        mPlugin->stop(mInstance);
+        mStarted = false;
+    }
+}
+
+void PluginDevice::pause()
+{
+    stop();
+}
+
+int PluginDevice::readSamples(void *buf, size_t size)
+{
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+    const int max = (int) (size / sampleSize);
+    uint64_t lost = 0;
+    const int count = mPlugin->read(mInstance, (int32_t *) buf, max, READ_TIMEOUT_MS, &lost);
+    // More samples than there was room for means the plugin has already overrun buf
+    if (count < 0 || count > max) {
+        fail("read");
+    }
+
+    if (lost > 0) {
+        Stats::add(gStats.mMissingFrames, lost);
+    }
+    if (count > 0) {
+        Stats::add(gStats.mFramesRead, count);
+        Stats::add(gStats.mBytesRead, count * sampleSize);
+    }
+    return (int) (count * sampleSize);
+}
+
+void PluginDevice::processBuffer()
+{
+    // Samples need no decoding, so they are read straight into the buffer written out
+    const int length = readSamples(mOutBuffer, sizeof(mOutBuffer));
+    if (length == 0) {
+        return;
+    }
+    markRead(getTime());
+    writeData(mOutBuffer, length);
+}
+
+void PluginDevice::readRaw(RawBlock *block)
+{
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+    block->length = readSamples(block->data, sizeof(block->data));
+    block->readTime = getTime();
+}
+
+void PluginDevice::decodeRaw(const RawBlock *block)
+{
+    writeData((void *) block->data, block->length);
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PLUGIN_DEVICE_H
+#define PLUGIN_DEVICE_H
+
+#include <stdint.h>
+
+#include "CaimanPlugin.h"
+#include "Devices.h"
+#include "Dll.h"
+
+// Bytes of samples read at once, must not exceed the fifo's single buffer size
+#define PLUGIN_BUFFER_SIZE (1 << 14)
+
+// Reads samples from a source plugin loaded at runtime, as described in CaimanPlugin.h. Each of the plugin's sources is
+// one channel with a single field. The plugin writes samples in caiman's own format, so they are passed on unchanged.
+class PluginDevice : public Device
+{
+public:
+    // Loads the plugin at path and creates an instance configured by args
+    PluginDevice(const char *outputPath, const char *path, const char *args);
+    virtual ~PluginDevice();
+
+    int getNumSources() const
+    {
+        return mNumSources;
+    }
+    // Returns the field of source, one of POWER, VOLTAGE or CURRENT
+    int getSourceField(int source) const
+    {
+        return mSourceFields[source];
+    }
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+private:
+    // Reads as many whole samples as fit in size bytes, returning the number of bytes read
+    int readSamples(void *buf, size_t size);
+    // Reports that the plugin failed to do what, then exits
+    [[noreturn]] void fail(const char *what) const;
+
+    DLLHANDLE mHandle;
+    const struct caiman_plugin *mPlugin;
+    void *mInstance;
+    int mNumSources;
+    int mSourceFields[MAX_CHANNELS];
+    bool mStarted;
+
+    int32_t mOutBuffer[PLUGIN_BUFFER_SIZE / sizeof(int32_t)];
+
+    // Intentionally unimplemented
+    PluginDevice(const PluginDevice &);
+    PluginDevice &operator=(const PluginDevice &);
+};
+
+#endif // PLUGIN_DEVICE_H
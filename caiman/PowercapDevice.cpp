@@ -0,0 +1,394 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PowercapDevice.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Logging.h"
+#include "Stats.h"
+#include "Sysfs.h"
+
+// Longest time readRaw sleeps, so gQuit is noticed promptly
+#define MAX_SLEEP_US 10000
+// Longest value read from a sysfs attribute
+#define VALUE_SIZE 32
+
+PowercapDevice::PowercapDevice(const char *outputPath, const char *root, unsigned int rate)
+        : Device(outputPath),
+          mRoot(root),
+          mNumSources(0),
+          mStartTime(0),
+          mSamples(0),
+          mLastTime(0)
+{
+    mSampleRate = rate;
+
+#if defined(WIN32)
+    logg.logError("powercap and hwmon are not supported on Windows");
+    handleException();
+#else
+    findPowercap();
+    findHwmon();
+#endif
+    if (mNumSources == 0) {
+        logg.logError("No powercap zones or hwmon sensors found in %s/class", mRoot);
+        handleException();
+    }
+}
+
+PowercapDevice::~PowercapDevice()
+{
+#if !defined(WIN32)
+    for (int i = 0; i < mNumSources; i++) {
+        if (mSources[i].fd >= 0) {
+            close(mSources[i].fd);
+        }
+    }
+#endif
+}
+
+void PowercapDevice::addSource(const char *path, const char *name, int kind, uint64_t range)
+{
+    if (mNumSources >= MAX_CHANNELS) {
+        logg.logMessage("Ignoring %s, at most %d sources are supported", path, MAX_CHANNELS);
+        return;
+    }
+
+    Source * const source = &mSources[mNumSources++];
+    snprintf(source->path, sizeof(source->path), "%s", path);
+    snprintf(source->name, sizeof(source->name), "%s", name);
+    source->kind = kind;
+    source->fd = -1;
+    source->range = range;
+}
+
+void PowercapDevice::findPowercap()
+{
+#if !defined(WIN32)
+    char dirPath[CAIMAN_PATH_MAX];
+    char path[CAIMAN_PATH_MAX];
+    char line[POWERCAP_NAME_SIZE];
+    char name[POWERCAP_NAME_SIZE];
+    char *entries[SYSFS_MAX_ENTRIES];
+
+    const int count = formatPath(dirPath, "%s/class/powercap", mRoot) ? listDirectory(dirPath, entries) : 0;
+    for (int i = 0; i < count; i++) {
+        // Control types such as intel-rapl have no counter of their own, only their zones do
+        struct stat st;
+        if (formatPath(path, "%s/%s/energy_uj", dirPath, entries[i]) && stat(path, &st) == 0) {
+            snprintf(name, sizeof(name), "%.*s", POWERCAP_NAME_SIZE - 1, entries[i]);
+            if (formatPath(path, "%s/%s/name", dirPath, entries[i]) && readLine(path, line, sizeof(line))) {
+                snprintf(name, sizeof(name), "%.30s %.30s", entries[i], line);
+            }
+
+            uint64_t range = 0;
+            if (formatPath(path, "%s/%s/max_energy_range_uj", dirPath, entries[i]) && readLine(path, line, sizeof(line))) {
+                range = strtoull(line, NULL, 10);
+            }
+
+            formatPath(path, "%s/%s/energy_uj", dirPath, entries[i]);
+            addSource(path, name, SOURCE_ENERGY, range);
+        }
+        free(entries[i]);
+    }
+#endif
+}
+
+void PowercapDevice::findHwmon()
+{
+#if !defined(WIN32)
+    static const struct
+    {
+        const char *prefix;
+        int kind;
+    } sensors[] = {
+        { "energy", SOURCE_ENERGY },
+        { "power", SOURCE_POWER },
+        { "in", SOURCE_VOLTAGE },
+        { "curr", SOURCE_CURRENT },
+    };
+
+    char dirPath[CAIMAN_PATH_MAX];
+    char path[CAIMAN_PATH_MAX];
+    char chip[POWERCAP_NAME_SIZE];
+    char label[POWERCAP_NAME_SIZE];
+    char name[POWERCAP_NAME_SIZE];
+    char *devices[SYSFS_MAX_ENTRIES];
+    char *entries[SYSFS_MAX_ENTRIES];
+
+    const int numDevices = formatPath(dirPath, "%s/class/hwmon", mRoot) ? listDirectory(dirPath, devices) : 0;
+    for (int i = 0; i < numDevices; i++) {
+        if (!formatPath(path, "%s/%s/name", dirPath, devices[i]) || !readLine(path, chip, sizeof(chip))) {
+            snprintf(chip, sizeof(chip), "%.*s", POWERCAP_NAME_SIZE - 1, devices[i]);
+        }
+
+        const int numEntries = formatPath(path, "%s/%s", dirPath, devices[i]) ? listDirectory(path, entries) : 0;
+        for (int j = 0; j < numEntries; j++) {
+            // Sensors are <prefix><index>_input, e.g. power1_input, with an optional <prefix><index>_label
+            for (size_t k = 0; k < sizeof(sensors) / sizeof(sensors[0]); k++) {
+                const size_t prefixLength = strlen(sensors[k].prefix);
+                char *end;
+                if (strncmp(entries[j], sensors[k].prefix, prefixLength) != 0 || entries[j][prefixLength] < '0' ||
+                    entries[j][prefixLength] > '9') {
+                    continue;
+                }
+                strtoul(&entries[j][prefixLength], &end, 10);
+                if (strcmp(end, "_input") != 0) {
+                    continue;
+                }
+
+                const int sensorLength = (int) (end - entries[j]);
+                if (formatPath(path, "%s/%s/%.*s_label", dirPath, devices[i], sensorLength, entries[j]) &&
+                    readLine(path, label, sizeof(label))) {
+                    snprintf(name, sizeof(name), "%.30s %.30s", chip, label);
+                }
+                else {
+                    snprintf(name, sizeof(name), "%.30s %.*s", chip, sensorLength < 30 ? sensorLength : 30, entries[j]);
+                }
+                if (formatPath(path, "%s/%s/%s", dirPath, devices[i], entries[j])) {
+                    addSource(path, name, sensors[k].kind, 0);
+                }
+            }
+            free(entries[j]);
+        }
+        free(devices[i]);
+    }
+#endif
+}
+
+int PowercapDevice::getSourceField(int source) const
+{
+    switch (mSources[source].kind) {
+    case SOURCE_VOLTAGE:
+        return VOLTAGE;
+    case SOURCE_CURRENT:
+        return CURRENT;
+    default:
+        return POWER;
+    }
+}
+
+void PowercapDevice::prepareChannels()
+{
+    // Each channel has a single field, read from the source of the same number
+    mNumFields = 0;
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (!gSessionData.mCounterEnabled[index]) {
+            continue;
+        }
+        const int channel = gSessionData.mCounterChannel[index];
+        if (channel >= mNumSources) {
+            logg.logError("Channel %d was enabled but only %d powercap and hwmon sources were found", channel, mNumSources);
+            handleException();
+        }
+        mFieldSources[gSessionData.mCounterSource[index]] = channel;
+        mNumFields++;
+    }
+
+    mVendor = "Linux powercap and hwmon";
+    mDatasize = EMETER_DATA_SIZE;
+}
+
+void PowercapDevice::init(const char *devicename)
+{
+    (void) devicename;
+
+#if !defined(WIN32)
+    for (int i = 0; i < mNumSources; i++) {
+        Source * const source = &mSources[i];
+        if (source->fd >= 0) {
+            continue;
+        }
+        source->fd = open(source->path, O_RDONLY | O_CLOEXEC);
+        if (source->fd < 0) {
+            if (errno == EACCES) {
+                // Recent kernels restrict the RAPL counters to root, and caiman will not run as root
+                logg.logError("Permission denied reading %s. Recent kernels only let root read RAPL counters; make it readable by "
+                              "caiman's user, e.g. 'chmod a+r %s'.", source->path, source->path);
+            }
+            else {
+                logg.logError("Unable to open %s: %s", source->path, strerror(errno));
+            }
+            handleException();
+        }
+
+        int64_t value;
+        if (!readValue(*source, &value)) {
+            logg.logError("Unable to read %s: %s", source->path, strerror(errno));
+            handleException();
+        }
+        logg.logMessage("Channel %d is %s, read from %s", i, source->name, source->path);
+    }
+#endif
+
+    logg.logMessage("powercap and hwmon device with %d fields at %u samples per second", mNumFields, mSampleRate);
+}
+
+bool PowercapDevice::readValue(const Source &source, int64_t *value)
+{
+#if defined(WIN32)
+    (void) source;
+    (void) value;
+    return false;
+#else
+    // Reading from the start of a sysfs attribute produces a fresh value
+    char buf[VALUE_SIZE];
+    const ssize_t length = pread(source.fd, buf, sizeof(buf) - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    buf[length] = '\0';
+    *value = strtoll(buf, NULL, 10);
+    return true;
+#endif
+}
+
+void PowercapDevice::readAll(int64_t *values)
+{
+    for (int i = 0; i < mNumSources; i++) {
+        // A failed read, e.g. a sensor that is briefly busy, repeats the previous value
+        if (!readValue(mSources[i], &values[i])) {
+            Stats::add(gStats.mMissingFrames, 1);
+        }
+    }
+}
+
+void PowercapDevice::start()
+{
+    readAll(mReadValues);
+    memcpy(mLastValues, mReadValues, mNumSources * sizeof(int64_t));
+    mStartTime = getTime();
+    mLastTime = mStartTime;
+    mSamples = 0;
+}
+
+void PowercapDevice::stop()
+{
+    logg.logMessage("powercap and hwmon device took %llu samples", (unsigned long long) mSamples);
+}
+
+void PowercapDevice::pause()
+{
+    stop();
+}
+
+void PowercapDevice::processBuffer()
+{
+    readRaw(&mBlock);
+    if (mBlock.length == 0) {
+        return;
+    }
+    markRead(mBlock.readTime);
+    decodeRaw(&mBlock);
+}
+
+void PowercapDevice::readRaw(RawBlock *block)
+{
+    block->length = 0;
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+
+    const uint64_t now = getTime();
+    const uint64_t due = (now - mStartTime) / 1000 * mSampleRate / 1000000;
+    if (due <= mSamples) {
+        const uint64_t wake = mStartTime + (mSamples + 1) * 1000000 / mSampleRate * 1000;
+        const uint64_t sleepUs = wake > now ? (wake - now) / 1000 : 0;
+#if !defined(WIN32)
+        usleep(sleepUs < MAX_SLEEP_US ? sleepUs : MAX_SLEEP_US);
+#endif
+        return;
+    }
+
+    // The number of sample periods covered, then the value of every source, copied so the block needs no alignment
+    const int64_t periods = due - mSamples;
+    readAll(mReadValues);
+    memcpy(block->data, &periods, sizeof(int64_t));
+    memcpy(&block->data[sizeof(int64_t)], mReadValues, mNumSources * sizeof(int64_t));
+    block->readTime = getTime();
+    block->length = (1 + mNumSources) * sizeof(int64_t);
+    mSamples = due;
+
+    Stats::add(gStats.mBytesRead, block->length);
+}
+
+void PowercapDevice::decodeRaw(const RawBlock *block)
+{
+    int64_t periods;
+    int64_t values[MAX_CHANNELS];
+    memcpy(&periods, block->data, sizeof(int64_t));
+    memcpy(values, &block->data[sizeof(int64_t)], mNumSources * sizeof(int64_t));
+    const uint64_t elapsed = block->readTime - mLastTime;
+
+    int32_t sample[MAX_FIELDS];
+    for (int field = 0; field < mNumFields; field++) {
+        const int index = mFieldSources[field];
+        const Source &source = mSources[index];
+        int64_t value;
+        switch (source.kind) {
+        case SOURCE_ENERGY: {
+            int64_t energy = values[index] - mLastValues[index];
+            if (energy < 0) {
+                // The counter wrapped, or was reset if its range is not known
+                energy = source.range > 0 ? energy + (int64_t) source.range : 0;
+            }
+            // Microjoules per nanosecond are kilowatts
+            value = elapsed > 0 ? (int64_t) (energy * 1e6 / elapsed) : 0;
+            break;
+        }
+        case SOURCE_POWER:
+            value = values[index] / 1000;
+            break;
+        default:
+            value = values[index];
+            break;
+        }
+        if (value > INT32_MAX || value < INT32_MIN) {
+            Stats::add(gStats.mOverflowClamps, 1);
+            value = value > 0 ? INT32_MAX : INT32_MIN;
+        }
+        sample[field] = (int32_t) value;
+    }
+    memcpy(mLastValues, values, mNumSources * sizeof(int64_t));
+    mLastTime = block->readTime;
+    Stats::add(gStats.mFramesRead, 1);
+    if (periods > 1) {
+        // A late read covers several sample periods, each given the same values
+        Stats::add(gStats.mMissingFrames, periods - 1);
+    }
+
+    // Values are little endian, as are all supported hosts
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+    const int64_t perBuffer = POWERCAP_BUFFER_SIZE / sampleSize;
+    for (int64_t remaining = periods; remaining > 0;) {
+        const int64_t count = remaining < perBuffer ? remaining : perBuffer;
+        for (int64_t i = 0; i < count; i++) {
+            memcpy(&mOutBuffer[i * sampleSize], sample, sampleSize);
+        }
+        writeData(mOutBuffer, count * sampleSize);
+        remaining -= count;
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POWERCAP_DEVICE_H
+#define POWERCAP_DEVICE_H
+
+#include <stdint.h>
+
+#include "Devices.h"
+#include "OlyUtility.h"
+
+// Longest name kept for a source, including the terminator
+#define POWERCAP_NAME_SIZE      64
+// Bytes of samples written at once, must not exceed the fifo's single buffer size
+#define POWERCAP_BUFFER_SIZE    (1 << 14)
+
+// Samples the energy counters of Linux powercap zones, such as Intel RAPL packages and DRAM, and the energy, power,
+// voltage and current sensors of hwmon devices, at a fixed rate. Each counter or sensor found is one channel, in the
+// order they are found: powercap zones first, then each hwmon device's sensors. Cumulative energy is converted into
+// power over each sample period. Every attribute is kept open and re-read with pread, so each sample costs one system
+// call per channel.
+class PowercapDevice : public Device
+{
+public:
+    // Finds the sources under root, normally /sys, which must stay allocated for the life of this object; rate is in
+    // samples per second
+    PowercapDevice(const char *outputPath, const char *root, unsigned int rate);
+    virtual ~PowercapDevice();
+
+    int getNumSources() const
+    {
+        return mNumSources;
+    }
+    // Returns the field of source, one of POWER, VOLTAGE or CURRENT
+    int getSourceField(int source) const;
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+private:
+    enum
+    {
+        // Cumulative microjoules
+        SOURCE_ENERGY,
+        // Microwatts
+        SOURCE_POWER,
+        // Millivolts
+        SOURCE_VOLTAGE,
+        // Milliamps
+        SOURCE_CURRENT
+    };
+
+    struct Source
+    {
+        char path[CAIMAN_PATH_MAX];
+        char name[POWERCAP_NAME_SIZE];
+        int kind;
+        int fd;
+        // The value at which an energy counter wraps to zero, or 0 if it is not known to wrap
+        uint64_t range;
+    };
+
+    void findPowercap();
+    void findHwmon();
+    void addSource(const char *path, const char *name, int kind, uint64_t range);
+    bool readValue(const Source &source, int64_t *value);
+    void readAll(int64_t *values);
+
+    const char * const mRoot;
+
+    Source mSources[MAX_CHANNELS];
+    int mNumSources;
+    // Source of each field of a sample
+    int mFieldSources[MAX_FIELDS];
+
+    // Initialized on start(); the read stage paces itself from these
+    uint64_t mStartTime;
+    uint64_t mSamples;
+    // The previous value of every source, repeated by a failed read
+    int64_t mReadValues[MAX_CHANNELS];
+
+    // Used by the decode stage to turn energy into power
+    int64_t mLastValues[MAX_CHANNELS];
+    uint64_t mLastTime;
+
+    RawBlock mBlock;
+    char mOutBuffer[POWERCAP_BUFFER_SIZE];
+
+    // Intentionally unimplemented
+    PowercapDevice(const PowercapDevice &);
+    PowercapDevice &operator=(const PowercapDevice &);
+};
+
+#endif // POWERCAP_DEVICE_H
@@ -0,0 +1,220 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__)
+// For sched_setaffinity and the CPU_* macros
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include "Realtime.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include "Logging.h"
+
+// Bytes of stack touched by prefaultStack, enough for the deepest acquisition call chain
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+// Set by lockMemory
+static bool memoryLocked = false;
+
+// Marks each CPU named in cpus in selected, returning false if cpus is malformed
+static bool parseCpuList(const char *cpus, bool *selected)
+{
+    const char *pos = cpus;
+
+    memset(selected, 0, MAX_CPUS * sizeof(*selected));
+    do {
+        char *end;
+        const long first = strtol(pos, &end, 10);
+        if (end == pos || first < 0 || first >= MAX_CPUS) {
+            return false;
+        }
+        long last = first;
+        pos = end;
+        if (*pos == '-') {
+            last = strtol(pos + 1, &end, 10);
+            if (end == pos + 1 || last < first || last >= MAX_CPUS) {
+                return false;
+            }
+            pos = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            selected[cpu] = true;
+        }
+    } while (*pos++ == ',');
+
+    return pos[-1] == '\0';
+}
+
+bool isValidCpuList(const char *cpus)
+{
+    bool selected[MAX_CPUS];
+    return parseCpuList(cpus, selected);
+}
+
+static void setScheduling(const char *name, const ThreadPolicy &policy)
+{
+#if defined(WIN32)
+    // Windows has no priority levels to choose between, so use the highest
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        logg.logError("Unable to use a real-time priority for the %s thread (error %lu)", name, (unsigned long) GetLastError());
+        handleException();
+    }
+#else
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = policy.priority;
+    const char * const policyName = policy.roundRobin ? "SCHED_RR" : "SCHED_FIFO";
+
+    const int result = pthread_setschedparam(pthread_self(), policy.roundRobin ? SCHED_RR : SCHED_FIFO, &param);
+    if (result == EPERM) {
+#if defined(__linux__)
+        struct rlimit limit;
+        unsigned long long rtprio = 0;
+        if (getrlimit(RLIMIT_RTPRIO, &limit) == 0) {
+            rtprio = limit.rlim_cur;
+        }
+        logg.logError("Not permitted to run the %s thread under %s at priority %d. Give caiman the CAP_SYS_NICE capability, "
+                      "e.g. 'setcap cap_sys_nice+ep caiman', or raise the real-time priority limit, which is %llu ('ulimit -r').",
+                      name, policyName, policy.priority, rtprio);
+#else
+        logg.logError("Not permitted to run the %s thread under %s at priority %d", name, policyName, policy.priority);
+#endif
+        handleException();
+    }
+    else if (result != 0) {
+        logg.logError("Unable to run the %s thread under %s at priority %d: %s", name, policyName, policy.priority, strerror(result));
+        handleException();
+    }
+#endif
+    logg.logMessage("Running the %s thread at real-time priority %d", name, policy.priority);
+}
+
+static void setAffinity(const char *name, const char *cpus)
+{
+    bool selected[MAX_CPUS];
+    if (!parseCpuList(cpus, selected)) {
+        logg.logError("Invalid CPU list '%s' for the %s thread", cpus, name);
+        handleException();
+    }
+
+#if defined(WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (selected[cpu]) {
+            if (cpu >= (int) (8 * sizeof(mask))) {
+                logg.logError("CPU %d for the %s thread is beyond the CPUs supported on Windows", cpu, name);
+                handleException();
+            }
+            mask |= (DWORD_PTR) 1 << cpu;
+        }
+    }
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        logg.logError("Unable to run the %s thread on CPUs %s (error %lu)", name, cpus, (unsigned long) GetLastError());
+        handleException();
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (selected[cpu]) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    const int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result == EINVAL) {
+        // None of the CPUs are online, or they are excluded by the cpuset caiman runs in
+        logg.logError("None of CPUs %s are available to run the %s thread; check 'taskset -p' and the cgroup cpuset", cpus, name);
+        handleException();
+    }
+    else if (result != 0) {
+        logg.logError("Unable to run the %s thread on CPUs %s: %s", name, cpus, strerror(result));
+        handleException();
+    }
+#else
+    logg.logError("Choosing the CPUs for the %s thread is not supported on this platform", name);
+    handleException();
+#endif
+    logg.logMessage("Running the %s thread on CPUs %s", name, cpus);
+}
+
+void applyThreadPolicy(const char *name, const ThreadPolicy &policy)
+{
+    // Move first, so the thread never runs at real-time priority on a CPU it should not use
+    if (policy.cpus != NULL) {
+        setAffinity(name, policy.cpus);
+    }
+    if (policy.priority > 0) {
+        setScheduling(name, policy);
+    }
+}
+
+void lockMemory()
+{
+#if defined(WIN32)
+    logg.logError("Locking memory is not supported on Windows");
+    handleException();
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        const int error = errno;
+        struct rlimit limit;
+        unsigned long long memlockKiB = 0;
+        if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0) {
+            memlockKiB = limit.rlim_cur == RLIM_INFINITY ? ~0ULL : limit.rlim_cur / 1024;
+        }
+        if (error == EPERM || error == ENOMEM) {
+            logg.logError("Not permitted to lock caiman's memory into RAM (%s). Give caiman the CAP_IPC_LOCK capability, "
+                          "e.g. 'setcap cap_ipc_lock+ep caiman', or raise the locked memory limit, which is %llu KiB ('ulimit -l').",
+                          strerror(error), memlockKiB);
+        }
+        else {
+            logg.logError("Unable to lock caiman's memory into RAM: %s", strerror(error));
+        }
+        handleException();
+    }
+
+    memoryLocked = true;
+    logg.logMessage("Locked memory into RAM");
+#endif
+}
+
+void prefaultStack()
+{
+    if (!memoryLocked) {
+        return;
+    }
+
+    // Existing allocations such as the fifo are resident once locked; a stack only grows into locked pages as it is used
+    volatile char stack[PREFAULT_STACK_SIZE];
+    for (int i = 0; i < PREFAULT_STACK_SIZE; i += 4096) {
+        stack[i] = 0;
+    }
+    (void) stack;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+// Highest CPU number that may be named in a CPU list
+#define MAX_CPUS 1024
+
+// Scheduling and placement requested for one of caiman's threads
+struct ThreadPolicy
+{
+    // Real-time priority from 1 to 99, or 0 to keep the default scheduling
+    int priority;
+    // Use SCHED_RR rather than SCHED_FIFO for a real-time priority
+    bool roundRobin;
+    // CPUs to run on, such as "2" or "0,2-3", or NULL to run on any CPU
+    const char *cpus;
+};
+
+// Returns false if cpus is not a list of CPU numbers and ranges
+bool isValidCpuList(const char *cpus);
+
+// Applies policy to the calling thread, which is called name in messages. Failures are fatal.
+void applyThreadPolicy(const char *name, const ThreadPolicy &policy);
+
+// Locks all current and future memory into RAM so page faults cannot stall acquisition. Failures are fatal.
+void lockMemory();
+// Touches the stack of the calling thread so it is resident before it is needed, if lockMemory was called
+void prefaultStack();
+
+#endif // REALTIME_H
@@ -99,3 +99,72 @@ void SessionData::compileData()
 
     compiled = true;
 }
+
+void SessionData::restrictFields(int fieldMask)
+{
+    int channelFieldMasks[MAX_CHANNELS];
+    for (int channel = 0; channel < MAX_CHANNELS; ++channel) {
+        channelFieldMasks[channel] = fieldMask;
+    }
+    restrictFields(channelFieldMasks);
+}
+
+void SessionData::restrictFields(const int *channelFieldMasks)
+{
+    // Sources of the remaining fields stay in energy meter order: ch0 pwr, ch0 volt, ch0 curr, ch1 pwr, etc.
+    static const int field_order[] = { POWER, VOLTAGE, CURRENT };
+    int source = 0;
+
+    for (int channel = 0; channel <= mMaxEnabledChannel; ++channel) {
+        for (int field = 0; field < 3; ++field) {
+            for (int index = 0; index < MAX_COUNTERS; ++index) {
+                if (!mCounterEnabled[index] || mCounterChannel[index] != channel || mCounterField[index] != field_order[field]) {
+                    continue;
+                }
+                if (channelFieldMasks[channel] & field_order[field]) {
+                    mCounterSource[index] = source++;
+                }
+                else {
+                    mCounterEnabled[index] = false;
+                }
+            }
+        }
+    }
+}
+
+void SessionData::selectChannels(int first, int count)
+{
+    // Sources follow channel order, so those of the kept channels come after one source per counter before them
+    int firstSource = 0;
+    for (int index = 0; index < MAX_COUNTERS; ++index) {
+        if (mCounterEnabled[index] && mCounterChannel[index] < first) {
+            ++firstSource;
+        }
+    }
+
+    for (int channel = 0; channel < MAX_CHANNELS; ++channel) {
+        const bool kept = channel < count && first + channel < MAX_CHANNELS;
+        mChannelEnabled[channel] = kept && mChannelEnabled[first + channel];
+        mResistors[channel] = kept ? mResistors[first + channel] : 0;
+    }
+    for (int source = 0; source + firstSource < MAX_FIELDS; ++source) {
+        mSourceScaleFactor[source] = mSourceScaleFactor[source + firstSource];
+    }
+
+    mMaxEnabledChannel = -1;
+    for (int index = 0; index < MAX_COUNTERS; ++index) {
+        if (!mCounterEnabled[index]) {
+            continue;
+        }
+        const int channel = mCounterChannel[index];
+        if (channel < first || channel >= first + count) {
+            mCounterEnabled[index] = false;
+            continue;
+        }
+        mCounterChannel[index] = channel - first;
+        mCounterSource[index] -= firstSource;
+        if (mCounterChannel[index] > mMaxEnabledChannel) {
+            mMaxEnabledChannel = mCounterChannel[index];
+        }
+    }
+}
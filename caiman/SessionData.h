@@ -46,6 +46,13 @@ public:
     ~SessionData();
     void initialize();
     void compileData();
+    // Disables the counters for fields not in fieldMask and renumbers the remaining sources
+    void restrictFields(int fieldMask);
+    // As above, with the fields kept given separately for each channel
+    void restrictFields(const int *channelFieldMasks);
+    // Keeps only the counters of channels first to first + count - 1, renumbering their channels and sources from 0 as
+    // though they were the only channels configured
+    void selectChannels(int first, int count);
 
     // Counters
     // one of power, voltage, or current
@@ -0,0 +1,514 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Sinks.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#if !defined(WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "Fifo.h"
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+
+// Largest single write to the fifo, which must not exceed its single buffer size
+#define FIFO_SINK_MAX_WRITE (1 << 14)
+// Touching one byte in each block of this size faults in every page of an arena
+#define ARENA_PAGE_SIZE     4096
+
+extern volatile bool gQuit;
+
+FifoSink::FifoSink(Fifo *fifo)
+        : mFifo(fifo),
+          mBuffer(fifo->start())
+{
+}
+
+void FifoSink::write(const char *buf, size_t size)
+{
+    while (size > 0) {
+        const size_t length = size < FIFO_SINK_MAX_WRITE ? size : FIFO_SINK_MAX_WRITE;
+        memcpy(mBuffer, buf, length);
+        mBuffer = mFifo->write(length);
+        buf += length;
+        size -= length;
+    }
+}
+
+void FifoSink::reset()
+{
+    mBuffer = mFifo->start();
+}
+
+FileSink::FileSink(FILE *file)
+        : mFile(file)
+{
+}
+
+void FileSink::write(const char *buf, size_t size)
+{
+    if (fwrite(buf, 1, size, mFile) != size) {
+        logg.logError("Error writing .apc energy data");
+        handleException();
+    }
+}
+
+ArenaSink::ArenaSink(size_t capacity)
+        : mArena(NULL),
+          mCapacity(capacity),
+          mUsed(0),
+          mDropped(0)
+{
+    mArena = (char *) malloc(mCapacity);
+    if (mArena == NULL) {
+        logg.logError("Unable to allocate %llu bytes to capture to RAM", (unsigned long long) mCapacity);
+        handleException();
+    }
+
+    // Fault in every page now rather than on its first write during the capture
+    const uint64_t start = getTime();
+    for (size_t pos = 0; pos < mCapacity; pos += ARENA_PAGE_SIZE) {
+        ((volatile char *) mArena)[pos] = 0;
+    }
+    logg.logMessage("Prefaulted %llu bytes to capture to RAM in %llu ns", (unsigned long long) mCapacity,
+                    (unsigned long long) (getTime() - start));
+}
+
+ArenaSink::~ArenaSink()
+{
+    free(mArena);
+}
+
+void ArenaSink::write(const char *buf, size_t size)
+{
+    const size_t used = mUsed.load(std::memory_order_relaxed);
+    if (used + size > mCapacity) {
+        if (used < mCapacity) {
+            logg.logMessage("The RAM capture is full, ending the capture");
+        }
+        Stats::add(mDropped, used + size - mCapacity);
+        size = mCapacity - used;
+        gQuit = true;
+    }
+
+    memcpy(&mArena[used], buf, size);
+    mUsed.store(used + size, std::memory_order_release);
+}
+
+void ArenaSink::reset()
+{
+    mUsed.store(0, std::memory_order_relaxed);
+    mDropped.store(0, std::memory_order_relaxed);
+}
+
+int ArenaSink::appendXML(char *xml, int pos, int size) const
+{
+    pos = appendFormat(xml, pos, size, "  <arena capacity=\"%llu\" used=\"%llu\" dropped=\"%llu\"/>\n", (unsigned long long) mCapacity,
+                       (unsigned long long) getUsed(), (unsigned long long) mDropped.load());
+
+    return pos;
+}
+
+StatsSink::StatsSink(int numFields)
+        : mNumFields(numFields),
+          mField(0),
+          mPartialLength(0),
+          mLocalSamples(0),
+          mSamples(0)
+{
+    reset();
+}
+
+void StatsSink::reset()
+{
+    mField = 0;
+    mPartialLength = 0;
+    mLocalSamples = 0;
+    for (int i = 0; i < MAX_FIELDS; i++) {
+        mLocalMin[i] = INT32_MAX;
+        mLocalMax[i] = INT32_MIN;
+        mLocalSum[i] = 0;
+    }
+    publish();
+}
+
+void StatsSink::add(int32_t value)
+{
+    if (value < mLocalMin[mField]) {
+        mLocalMin[mField] = value;
+    }
+    if (value > mLocalMax[mField]) {
+        mLocalMax[mField] = value;
+    }
+    mLocalSum[mField] += value;
+
+    if (++mField == mNumFields) {
+        mField = 0;
+        mLocalSamples++;
+    }
+}
+
+// The fields of a snapshot may be from different writes, which is close enough for the stats
+void StatsSink::publish()
+{
+    for (int i = 0; i < mNumFields; i++) {
+        mMin[i].store(mLocalMin[i], std::memory_order_relaxed);
+        mMax[i].store(mLocalMax[i], std::memory_order_relaxed);
+        mSum[i].store(mLocalSum[i], std::memory_order_relaxed);
+    }
+    mSamples.store(mLocalSamples, std::memory_order_relaxed);
+}
+
+void StatsSink::write(const char *buf, size_t size)
+{
+    int32_t value;
+
+    if (mNumFields <= 0) {
+        return;
+    }
+
+    // Finish a value split by the last write
+    while (mPartialLength > 0 && size > 0) {
+        mPartial[mPartialLength++] = *buf++;
+        size--;
+        if (mPartialLength == sizeof(value)) {
+            memcpy(&value, mPartial, sizeof(value));
+            add(value);
+            mPartialLength = 0;
+        }
+    }
+
+    // Values are little endian, as are all supported hosts. Whole samples, the common case, avoid tracking the field.
+    const size_t sampleSize = mNumFields * sizeof(value);
+    if (mField == 0) {
+        uint64_t samples = 0;
+        for (; size >= sampleSize; size -= sampleSize) {
+            for (int i = 0; i < mNumFields; i++) {
+                memcpy(&value, buf, sizeof(value));
+                buf += sizeof(value);
+                mLocalMin[i] = value < mLocalMin[i] ? value : mLocalMin[i];
+                mLocalMax[i] = value > mLocalMax[i] ? value : mLocalMax[i];
+                mLocalSum[i] += value;
+            }
+            samples++;
+        }
+        mLocalSamples += samples;
+    }
+
+    while (size >= sizeof(value)) {
+        memcpy(&value, buf, sizeof(value));
+        add(value);
+        buf += sizeof(value);
+        size -= sizeof(value);
+    }
+
+    memcpy(mPartial, buf, size);
+    mPartialLength = size;
+
+    publish();
+}
+
+int StatsSink::appendXML(char *xml, int pos, int size) const
+{
+    const uint64_t samples = mSamples.load(std::memory_order_relaxed);
+
+    pos = appendFormat(xml, pos, size, "  <samples count=\"%llu\">\n", (unsigned long long) samples);
+    for (int i = 0; i < mNumFields && samples > 0; i++) {
+        pos = appendFormat(xml, pos, size, "    <field index=\"%d\" min=\"%d\" max=\"%d\" mean=\"%lld\"/>\n", i,
+                           mMin[i].load(std::memory_order_relaxed), mMax[i].load(std::memory_order_relaxed),
+                           (long long) (mSum[i].load(std::memory_order_relaxed) / (int64_t) samples));
+    }
+    pos = appendFormat(xml, pos, size, "  </samples>\n");
+
+    return pos;
+}
+
+LatestSink::LatestSink(unsigned int sampleRate, int numFields, LatestValues *values)
+        : mNumFields(numFields),
+          mAlpha(1.0 - exp(-1000.0 / ((double) LATEST_AVERAGE_MS * sampleRate))),
+          mValues(values),
+          mOwnsValues(values == NULL),
+          mPartialLength(0),
+          mSamples(0)
+{
+    if (mOwnsValues) {
+        mValues = new LatestValues;
+    }
+    mValues->numFields = numFields;
+    mValues->sequence.store(0, std::memory_order_relaxed);
+    reset();
+}
+
+LatestSink::~LatestSink()
+{
+    if (mOwnsValues) {
+        delete mValues;
+    }
+}
+
+void LatestSink::addSample(const char *sample)
+{
+    int32_t value;
+
+    // Values are little endian, as are all supported hosts
+    for (int i = 0; i < mNumFields; i++) {
+        memcpy(&value, &sample[i * sizeof(value)], sizeof(value));
+        mLatest[i] = value;
+        // Start the average at the first value rather than converging on it from zero
+        mAverage[i] = mSamples == 0 ? value : mAverage[i] + mAlpha * (value - mAverage[i]);
+    }
+    mSamples++;
+}
+
+void LatestSink::write(const char *buf, size_t size)
+{
+    const size_t sampleSize = mNumFields * sizeof(int32_t);
+
+    if (sampleSize == 0) {
+        return;
+    }
+
+    // Finish a sample split by the last write
+    if (mPartialLength > 0) {
+        size_t length = sampleSize - mPartialLength;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(&mPartial[mPartialLength], buf, length);
+        mPartialLength += length;
+        buf += length;
+        size -= length;
+        if (mPartialLength < sampleSize) {
+            return;
+        }
+        addSample(mPartial);
+        mPartialLength = 0;
+    }
+
+    if (mSamples == 0 && size >= sampleSize) {
+        addSample(buf);
+        buf += sampleSize;
+        size -= sampleSize;
+    }
+
+    // Whole samples, the common case, averaged in locals the compiler can keep in registers
+    if (size >= sampleSize) {
+        double average[MAX_FIELDS];
+        memcpy(average, mAverage, mNumFields * sizeof(*average));
+        const double alpha = mAlpha;
+        const size_t count = size / sampleSize;
+        for (size_t sample = 0; sample < count; sample++) {
+            for (int i = 0; i < mNumFields; i++) {
+                int32_t value;
+                // Values are little endian, as are all supported hosts
+                memcpy(&value, buf, sizeof(value));
+                buf += sizeof(value);
+                average[i] += alpha * (value - average[i]);
+            }
+        }
+        memcpy(mAverage, average, mNumFields * sizeof(*average));
+        // Only the last sample's values are kept
+        memcpy(mLatest, buf - sampleSize, sampleSize);
+        mSamples += count;
+        size -= count * sampleSize;
+    }
+
+    memcpy(mPartial, buf, size);
+    mPartialLength = size;
+
+    publish();
+}
+
+void LatestSink::reset()
+{
+    mPartialLength = 0;
+    mSamples = 0;
+    for (int i = 0; i < MAX_FIELDS; i++) {
+        mLatest[i] = 0;
+        mAverage[i] = 0;
+    }
+    publish();
+}
+
+// The values are atomics only so that readers racing with an update are well defined; the sequence tells them to retry
+void LatestSink::publish()
+{
+    const uint32_t sequence = mValues->sequence.load(std::memory_order_relaxed);
+    mValues->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    mValues->samples.store(mSamples, std::memory_order_relaxed);
+    for (int i = 0; i < mNumFields; i++) {
+        mValues->latest[i].store(mLatest[i], std::memory_order_relaxed);
+        mValues->average[i].store((int32_t) lround(mAverage[i]), std::memory_order_relaxed);
+    }
+
+    mValues->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int LatestSink::appendXML(char *xml, int pos, int size) const
+{
+    int32_t latest[MAX_FIELDS];
+    int32_t average[MAX_FIELDS];
+    uint64_t samples;
+    uint32_t before, after;
+
+    do {
+        before = mValues->sequence.load(std::memory_order_acquire);
+        samples = mValues->samples.load(std::memory_order_relaxed);
+        for (int i = 0; i < mNumFields; i++) {
+            latest[i] = mValues->latest[i].load(std::memory_order_relaxed);
+            average[i] = mValues->average[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = mValues->sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    pos = appendFormat(xml, pos, size, "  <latest samples=\"%llu\" average_ms=\"%d\">\n", (unsigned long long) samples,
+                       LATEST_AVERAGE_MS);
+    for (int i = 0; i < mNumFields; i++) {
+        pos = appendFormat(xml, pos, size, "    <field index=\"%d\" value=\"%d\" average=\"%d\"/>\n", i, latest[i], average[i]);
+    }
+    pos = appendFormat(xml, pos, size, "  </latest>\n");
+
+    return pos;
+}
+
+#if defined(WIN32)
+
+ShmSink::ShmSink(const char *name, unsigned int sampleRate, int numFields, int fieldSize, unsigned int seconds)
+        : mName(name),
+          mMapSize(0),
+          mHeader(NULL),
+          mLatest(NULL),
+          mRing(NULL),
+          mWritten(0)
+{
+    (void) sampleRate;
+    (void) numFields;
+    (void) fieldSize;
+    (void) seconds;
+    logg.logError("Shared memory output is not supported on Windows");
+    handleException();
+}
+
+ShmSink::~ShmSink()
+{
+}
+
+#else
+
+ShmSink::ShmSink(const char *name, unsigned int sampleRate, int numFields, int fieldSize, unsigned int seconds)
+        : mName(name),
+          mMapSize(0),
+          mHeader(NULL),
+          mLatest(NULL),
+          mRing(NULL),
+          mWritten(0)
+{
+    static_assert(sizeof(ShmSinkHeader) <= SHM_SINK_LATEST, "ShmSinkHeader overlaps LatestValues");
+    static_assert(SHM_SINK_LATEST + sizeof(LatestValues) <= 4096, "LatestValues overlaps the ring");
+
+    // Keep the ring page aligned
+    const size_t headerSize = 4096;
+    const uint64_t capacity = (uint64_t) seconds * sampleRate * numFields * fieldSize;
+    mMapSize = headerSize + capacity;
+
+    const int fd = shm_open(mName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logg.logError("Unable to create shared memory %s: %s", mName, strerror(errno));
+        handleException();
+    }
+    if (ftruncate(fd, mMapSize) != 0) {
+        logg.logError("Unable to size shared memory %s to %llu bytes: %s", mName, (unsigned long long) mMapSize, strerror(errno));
+        handleException();
+    }
+    void * const map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        logg.logError("Unable to map shared memory %s: %s", mName, strerror(errno));
+        handleException();
+    }
+
+    mHeader = new (map) ShmSinkHeader;
+    mLatest = new ((char *) map + SHM_SINK_LATEST) LatestValues;
+    mRing = (char *) map + headerSize;
+    memcpy(mHeader->magic, SHM_SINK_MAGIC, sizeof(mHeader->magic));
+    mHeader->version = SHM_SINK_VERSION;
+    mHeader->headerSize = headerSize;
+    mHeader->sampleRate = sampleRate;
+    mHeader->numFields = numFields;
+    mHeader->fieldSize = fieldSize;
+    mHeader->latestOffset = SHM_SINK_LATEST;
+    mHeader->capacity = capacity;
+    mHeader->written.store(0, std::memory_order_release);
+    mHeader->writing.store(0, std::memory_order_release);
+    logg.logMessage("Publishing %u seconds of samples in shared memory %s", seconds, mName);
+}
+
+ShmSink::~ShmSink()
+{
+    munmap(mHeader, mMapSize);
+    // Readers that still have it mapped keep the data
+    shm_unlink(mName);
+}
+
+#endif
+
+void ShmSink::write(const char *buf, size_t size)
+{
+    const uint64_t capacity = mHeader->capacity;
+
+    // Only the most recent capacity bytes can be kept
+    if (size > capacity) {
+        mWritten += size - capacity;
+        buf += size - capacity;
+        size = capacity;
+    }
+
+    // Warn readers before overwriting anything they may be copying
+    mHeader->writing.store(mWritten + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    while (size > 0) {
+        const size_t pos = mWritten % capacity;
+        const size_t length = size < capacity - pos ? size : capacity - pos;
+        memcpy(&mRing[pos], buf, length);
+        buf += length;
+        size -= length;
+        mWritten += length;
+    }
+
+    // Publish the data only once it is complete
+    mHeader->written.store(mWritten, std::memory_order_release);
+}
+
+void ShmSink::reset()
+{
+    mWritten = 0;
+    mHeader->written.store(0, std::memory_order_release);
+    mHeader->writing.store(0, std::memory_order_release);
+}
@@ -0,0 +1,272 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SINKS_H
+#define SINKS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+#include "SessionData.h"
+
+class Fifo;
+
+// Receives every sample a device writes. A device passes each block of samples to all of its sinks in turn, on the thread
+// writing the samples, without copying it first; the block is only valid for the duration of the call.
+class Sink
+{
+public:
+    virtual ~Sink()
+    {
+    }
+
+    virtual void write(const char *buf, size_t size) = 0;
+    // Called between captures in daemon mode, while no samples are being written
+    virtual void reset()
+    {
+    }
+    // Returns true if the samples are queued for the sender thread
+    virtual bool isQueued() const
+    {
+        return false;
+    }
+};
+
+// Queues samples in the fifo for the sender thread to stream to Streamline
+class FifoSink : public Sink
+{
+public:
+    FifoSink(Fifo *fifo);
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+    virtual bool isQueued() const
+    {
+        return true;
+    }
+
+private:
+    Fifo * const mFifo;
+    char *mBuffer;
+
+    // Intentionally unimplemented
+    FifoSink(const FifoSink &);
+    FifoSink &operator=(const FifoSink &);
+};
+
+// Writes samples to a file, such as the 0000000000 file of a local capture
+class FileSink : public Sink
+{
+public:
+    FileSink(FILE *file);
+
+    virtual void write(const char *buf, size_t size);
+
+private:
+    FILE * const mFile;
+
+    // Intentionally unimplemented
+    FileSink(const FileSink &);
+    FileSink &operator=(const FileSink &);
+};
+
+// Keeps a whole capture in one arena, allocated and touched up front so that writing a sample never waits for memory,
+// the disk or the network. Once the arena is full the capture ends, as though stopped.
+class ArenaSink : public Sink
+{
+public:
+    // capacity should be a whole number of samples
+    ArenaSink(size_t capacity);
+    virtual ~ArenaSink();
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // The samples written so far, for writing out once the capture has stopped
+    const char *getData() const
+    {
+        return mArena;
+    }
+    size_t getUsed() const
+    {
+        return mUsed.load(std::memory_order_acquire);
+    }
+
+    // Appends an <arena> element to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    char *mArena;
+    const size_t mCapacity;
+    std::atomic<size_t> mUsed;
+    std::atomic<uint64_t> mDropped;
+
+    // Intentionally unimplemented
+    ArenaSink(const ArenaSink &);
+    ArenaSink &operator=(const ArenaSink &);
+};
+
+// Keeps the count, minimum, maximum and sum of each field for the stats XML
+class StatsSink : public Sink
+{
+public:
+    StatsSink(int numFields);
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // Appends a <samples> element to xml, returning the new position
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    void add(int32_t value);
+    void publish();
+
+    const int mNumFields;
+    int mField;
+    // A value split between writes
+    unsigned char mPartial[sizeof(int32_t)];
+    unsigned int mPartialLength;
+
+    // Updated for every value by the thread writing samples, then published once per write
+    uint64_t mLocalSamples;
+    int32_t mLocalMin[MAX_FIELDS];
+    int32_t mLocalMax[MAX_FIELDS];
+    int64_t mLocalSum[MAX_FIELDS];
+
+    std::atomic<uint64_t> mSamples;
+    std::atomic<int32_t> mMin[MAX_FIELDS];
+    std::atomic<int32_t> mMax[MAX_FIELDS];
+    std::atomic<int64_t> mSum[MAX_FIELDS];
+
+    // Intentionally unimplemented
+    StatsSink(const StatsSink &);
+    StatsSink &operator=(const StatsSink &);
+};
+
+// Time constant of the moving average kept by LatestSink
+#define LATEST_AVERAGE_MS   100
+
+// The most recent value and a moving average of each field, published with a sequence lock so readers never delay the
+// thread writing samples. To read, load sequence, copy the values, then load sequence again; retry if it was odd or
+// changed. Values are in host byte order.
+struct LatestValues
+{
+    // Odd while the values are being updated
+    std::atomic<uint32_t> sequence;
+    uint32_t numFields;
+    // Samples written when the values were published
+    std::atomic<uint64_t> samples;
+    std::atomic<int32_t> latest[MAX_FIELDS];
+    std::atomic<int32_t> average[MAX_FIELDS];
+};
+
+// Keeps LatestValues up to date, either in its own memory or in memory provided by the caller such as a ShmSink
+class LatestSink : public Sink
+{
+public:
+    LatestSink(unsigned int sampleRate, int numFields, LatestValues *values);
+    virtual ~LatestSink();
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // Appends a <latest> element to xml, returning the new position. May be called from any thread.
+    int appendXML(char *xml, int pos, int size) const;
+
+private:
+    void addSample(const char *sample);
+    void publish();
+
+    const int mNumFields;
+    // Weight of each new sample in the moving average
+    const double mAlpha;
+    LatestValues *mValues;
+    bool mOwnsValues;
+
+    // Only used by the thread writing samples
+    char mPartial[MAX_FIELDS * sizeof(int32_t)];
+    size_t mPartialLength;
+    uint64_t mSamples;
+    int32_t mLatest[MAX_FIELDS];
+    double mAverage[MAX_FIELDS];
+
+    // Intentionally unimplemented
+    LatestSink(const LatestSink &);
+    LatestSink &operator=(const LatestSink &);
+};
+
+#define SHM_SINK_MAGIC      "CAIMSHM"
+#define SHM_SINK_VERSION    2
+// Offset of the LatestValues in the shared memory
+#define SHM_SINK_LATEST     1024
+
+// Start of the shared memory written by ShmSink, followed by the data ring. Values are in host byte order.
+struct ShmSinkHeader
+{
+    char magic[8];
+    uint32_t version;
+    // Offset of the data ring from the start of the shared memory
+    uint32_t headerSize;
+    uint32_t sampleRate;
+    uint32_t numFields;
+    // Bytes per field, each a signed little endian integer
+    uint32_t fieldSize;
+    // Offset of the LatestValues from the start of the shared memory
+    uint32_t latestOffset;
+    // Bytes in the data ring, a whole number of samples
+    uint64_t capacity;
+    // Bytes written since the capture started; byte n of the stream is at n % capacity in the ring
+    std::atomic<uint64_t> written;
+    // Raised before the ring is overwritten, to as far as written will be once the write completes. Readers copy data
+    // below written, then check writing is no more than capacity past the start of the data they copied.
+    std::atomic<uint64_t> writing;
+};
+
+// Publishes the most recent samples in a POSIX shared memory ring that any number of local processes may read without
+// ever delaying acquisition
+class ShmSink : public Sink
+{
+public:
+    // name is as for shm_open, e.g. /caiman
+    ShmSink(const char *name, unsigned int sampleRate, int numFields, int fieldSize, unsigned int seconds);
+    virtual ~ShmSink();
+
+    virtual void write(const char *buf, size_t size);
+    virtual void reset();
+
+    // For a LatestSink to publish alongside the samples
+    LatestValues *getLatestValues() const
+    {
+        return mLatest;
+    }
+
+private:
+    const char * const mName;
+    size_t mMapSize;
+    ShmSinkHeader *mHeader;
+    LatestValues *mLatest;
+    char *mRing;
+    uint64_t mWritten;
+
+    // Intentionally unimplemented
+    ShmSink(const ShmSink &);
+    ShmSink &operator=(const ShmSink &);
+};
+
+#endif // SINKS_H
@@ -0,0 +1,267 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#define SLEEP_MS(MS)    Sleep(MS)
+#else
+#include <unistd.h>
+#define SLEEP_MS(MS)    usleep((MS) * 1000)
+#endif
+
+#include "Fifo.h"
+#include "FlightRecorder.h"
+#include "Gate.h"
+#include "Latency.h"
+#include "Logging.h"
+#include "Markers.h"
+#include "MergeDevice.h"
+#include "NetworkDevice.h"
+#include "Pipeline.h"
+#include "Sinks.h"
+#include "Thread.h"
+
+// Global pipeline counters
+Stats gStats;
+
+Stats::Stats()
+        : mBytesRead(0),
+          mFramesRead(0),
+          mMissingFrames(0),
+          mOverflowClamps(0),
+          mStalls(0),
+          mRecoveries(0),
+          mGapFrames(0),
+          mBytesCommitted(0),
+          mBytesSent(0),
+          mSendStallNs(0),
+          mStartTime(getTime()),
+          mFifo(NULL),
+          mPipeline(NULL),
+          mSampleStats(NULL),
+          mMarkers(NULL),
+          mFlightRecorder(NULL),
+          mGate(NULL),
+          mArena(NULL),
+          mNetwork(NULL),
+          mMerge(NULL),
+          mNumThreads(0),
+          mFileIntervalMs(0),
+          mFileWriterRunning(false)
+{
+    mFilePath[0] = '\0';
+    for (int i = 0; i < MAX_STATS_THREADS; i++) {
+        mThreads[i].name.store(NULL);
+    }
+}
+
+Stats::~Stats()
+{
+    stopFileWriter();
+}
+
+void Stats::registerThread(const char *name)
+{
+    // A thread started again under the same name, e.g. for each capture, replaces the old entry
+    const int numThreads = mNumThreads.load() < MAX_STATS_THREADS ? mNumThreads.load() : MAX_STATS_THREADS;
+    for (int i = 0; i < numThreads; i++) {
+        const char * const existing = mThreads[i].name.load();
+        if (existing != NULL && strcmp(existing, name) == 0) {
+            mThreads[i].name.store(NULL);
+#if defined(WIN32)
+            CloseHandle(mThreads[i].handle);
+#endif
+            setThread(&mThreads[i], name);
+            return;
+        }
+    }
+
+    const int index = mNumThreads.fetch_add(1);
+    if (index >= MAX_STATS_THREADS) {
+        logg.logMessage("Too many threads to record CPU time for %s", name);
+        return;
+    }
+
+    setThread(&mThreads[index], name);
+}
+
+void Stats::setThread(ThreadInfo * const thread, const char *name)
+{
+#if defined(WIN32)
+    // GetCurrentThread returns a pseudo handle that is only meaningful to the calling thread
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &thread->handle, THREAD_QUERY_INFORMATION, FALSE, 0)) {
+        logg.logMessage("Unable to record CPU time for %s", name);
+        return;
+    }
+#elif defined(__linux__)
+    if (pthread_getcpuclockid(pthread_self(), &thread->clock) != 0) {
+        logg.logMessage("Unable to record CPU time for %s", name);
+        return;
+    }
+#endif
+    thread->name.store(name);
+}
+
+char *Stats::getXML(int * const length) const
+{
+    const int BUF_SIZE = 1 << 16;
+    char * const xml = (char *) malloc(BUF_SIZE);
+    int pos = 0;
+
+    const int fifoSize = mFifo != NULL ? mFifo->getSize() : 0;
+    const int fifoFilled = mFifo != NULL ? mFifo->getOccupancy() : 0;
+    const int fifoHighWater = mFifo != NULL ? mFifo->getHighWater() : 0;
+
+    pos = appendFormat(xml, pos, BUF_SIZE, "<?xml version=\"1.0\" encoding='UTF-8'?>\n");
+    pos = appendFormat(xml, pos, BUF_SIZE, "<stats version=\"1\" uptime_ns=\"%llu\">\n", (unsigned long long) (getTime() - mStartTime));
+    pos = appendFormat(xml, pos, BUF_SIZE, "  <device bytes_read=\"%llu\" frames_read=\"%llu\" missing_frames=\"%llu\" overflow_clamps=\"%llu\" stalls=\"%llu\" recoveries=\"%llu\" gap_frames=\"%llu\" bytes_committed=\"%llu\"/>\n",
+                       (unsigned long long) mBytesRead.load(), (unsigned long long) mFramesRead.load(), (unsigned long long) mMissingFrames.load(),
+                       (unsigned long long) mOverflowClamps.load(), (unsigned long long) mStalls.load(), (unsigned long long) mRecoveries.load(),
+                       (unsigned long long) mGapFrames.load(), (unsigned long long) mBytesCommitted.load());
+    if (mPipeline != NULL) {
+        pos = mPipeline->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mSampleStats != NULL) {
+        pos = mSampleStats->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mMarkers != NULL) {
+        pos = mMarkers->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mFlightRecorder != NULL) {
+        pos = mFlightRecorder->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mGate != NULL) {
+        pos = mGate->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mArena != NULL) {
+        pos = mArena->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mNetwork != NULL) {
+        pos = mNetwork->appendXML(xml, pos, BUF_SIZE);
+    }
+    if (mMerge != NULL) {
+        pos = mMerge->appendXML(xml, pos, BUF_SIZE);
+    }
+    pos = appendFormat(xml, pos, BUF_SIZE, "  <fifo size=\"%d\" occupancy=\"%d\" high_water=\"%d\"/>\n", fifoSize, fifoFilled, fifoHighWater);
+    pos = appendFormat(xml, pos, BUF_SIZE, "  <sender bytes_sent=\"%llu\" send_stall_ns=\"%llu\"/>\n",
+                       (unsigned long long) mBytesSent.load(), (unsigned long long) mSendStallNs.load());
+    pos = appendFormat(xml, pos, BUF_SIZE, "  <threads>\n");
+    const int numThreads = mNumThreads.load() < MAX_STATS_THREADS ? mNumThreads.load() : MAX_STATS_THREADS;
+    for (int i = 0; i < numThreads; i++) {
+        const char * const name = mThreads[i].name.load();
+        if (name == NULL) {
+            continue;
+        }
+
+        unsigned long long cpuNs = 0;
+#if defined(WIN32)
+        FILETIME creation, exit, kernel, user;
+        if (GetThreadTimes(mThreads[i].handle, &creation, &exit, &kernel, &user)) {
+            // FILETIMEs are in 100ns units
+            cpuNs = ((((unsigned long long) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+                     (((unsigned long long) user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+        }
+#elif defined(__linux__)
+        // Fails once the thread has exited
+        struct timespec ts;
+        if (clock_gettime(mThreads[i].clock, &ts) == 0) {
+            cpuNs = (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+#endif
+        pos = appendFormat(xml, pos, BUF_SIZE, "    <thread name=\"%s\" cpu_ns=\"%llu\"/>\n", name, cpuNs);
+    }
+    pos = appendFormat(xml, pos, BUF_SIZE, "  </threads>\n");
+    pos = gLatency.appendXML(xml, pos, BUF_SIZE);
+    pos = appendFormat(xml, pos, BUF_SIZE, "</stats>\n");
+    xml[pos] = '\0';
+
+    *length = pos;
+    return xml;
+}
+
+void Stats::writeFile(const char *path) const
+{
+    char tmpPath[CAIMAN_PATH_MAX + 8];
+    int length;
+    char * const xml = getXML(&length);
+
+    // Write to a temporary file first so readers never see a partial snapshot
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    if (writeToDisk(tmpPath, xml) < 0) {
+        logg.logMessage("Unable to write stats to %s", tmpPath);
+    }
+    else {
+#if defined(WIN32)
+        remove(path);
+#endif
+        if (rename(tmpPath, path) != 0) {
+            logg.logMessage("Unable to rename %s to %s", tmpPath, path);
+        }
+    }
+
+    free(xml);
+}
+
+void *Stats::fileWriterThread(void *pVoid)
+{
+    Stats * const stats = (Stats *) pVoid;
+
+    stats->registerThread("stats");
+    while (stats->mFileWriterRunning.load()) {
+        stats->writeFile(stats->mFilePath);
+        // Sleep in short steps so stopping is prompt
+        for (int slept = 0; slept < stats->mFileIntervalMs && stats->mFileWriterRunning.load(); slept += 100) {
+            const int remain = stats->mFileIntervalMs - slept;
+            SLEEP_MS(remain < 100 ? remain : 100);
+        }
+    }
+
+    return 0;
+}
+
+void Stats::startFileWriter(const char *path, int intervalMs)
+{
+    if (mFileWriterRunning.exchange(true)) {
+        return;
+    }
+
+    strncpy(mFilePath, path, CAIMAN_PATH_MAX);
+    mFilePath[CAIMAN_PATH_MAX - 1] = '\0';
+    mFileIntervalMs = intervalMs;
+
+    if (!THREAD_CREATE(mFileWriterThread, fileWriterThread, this)) {
+        mFileWriterRunning.store(false);
+        logg.logError("Failed to create stats thread");
+        handleException();
+    }
+}
+
+void Stats::stopFileWriter()
+{
+    if (!mFileWriterRunning.exchange(false)) {
+        return;
+    }
+
+    THREAD_JOIN(mFileWriterThread);
+
+    // Leave the final counters behind
+    writeFile(mFilePath);
+}
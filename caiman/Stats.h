@@ -0,0 +1,169 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <atomic>
+
+#include "OlyUtility.h"
+
+class ArenaSink;
+class Fifo;
+class Pipeline;
+class FlightRecorderSink;
+class GateSink;
+class MarkerSink;
+class MergeDevice;
+class NetworkDevice;
+class StatsSink;
+
+#define MAX_STATS_THREADS 16
+
+// Live counters for each stage of the pipeline. Counters are updated with relaxed atomics
+// by the thread owning the stage and may be read at any time from any thread.
+class Stats
+{
+public:
+    Stats();
+    ~Stats();
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Records the CPU time used by the calling thread under name, which must be a string literal
+    void registerThread(const char *name);
+    void setFifo(const Fifo *fifo)
+    {
+        mFifo = fifo;
+    }
+    void setPipeline(const Pipeline *pipeline)
+    {
+        mPipeline = pipeline;
+    }
+    void setSampleStats(const StatsSink *sampleStats)
+    {
+        mSampleStats = sampleStats;
+    }
+    void setMarkers(const MarkerSink *markers)
+    {
+        mMarkers = markers;
+    }
+    void setFlightRecorder(const FlightRecorderSink *flightRecorder)
+    {
+        mFlightRecorder = flightRecorder;
+    }
+    void setGate(const GateSink *gate)
+    {
+        mGate = gate;
+    }
+    void setArena(const ArenaSink *arena)
+    {
+        mArena = arena;
+    }
+    void setNetwork(const NetworkDevice *network)
+    {
+        mNetwork = network;
+    }
+    void setMerge(const MergeDevice *merge)
+    {
+        mMerge = merge;
+    }
+
+    // Returns a snapshot of all counters as XML, which must be freed by the caller
+    char *getXML(int * const length) const;
+    // Writes a snapshot to path, replacing any previous snapshot atomically
+    void writeFile(const char *path) const;
+
+    // Writes a snapshot to path every intervalMs milliseconds until stopped
+    void startFileWriter(const char *path, int intervalMs);
+    void stopFileWriter();
+
+    // Device
+    std::atomic<uint64_t> mBytesRead;
+    std::atomic<uint64_t> mFramesRead;
+    std::atomic<uint64_t> mMissingFrames;
+    std::atomic<uint64_t> mOverflowClamps;
+    // Device streams that stopped, how many were restarted and the samples lost meanwhile
+    std::atomic<uint64_t> mStalls;
+    std::atomic<uint64_t> mRecoveries;
+    std::atomic<uint64_t> mGapFrames;
+
+    // Output of the device, to the fifo or a local file
+    std::atomic<uint64_t> mBytesCommitted;
+
+    // Sender
+    std::atomic<uint64_t> mBytesSent;
+    std::atomic<uint64_t> mSendStallNs;
+
+private:
+    struct ThreadInfo;
+
+    static void *fileWriterThread(void *pVoid);
+    // Records the calling thread in thread
+    static void setThread(ThreadInfo * const thread, const char *name);
+
+    const uint64_t mStartTime;
+    const Fifo *mFifo;
+    const Pipeline *mPipeline;
+    const StatsSink *mSampleStats;
+    const MarkerSink *mMarkers;
+    const FlightRecorderSink *mFlightRecorder;
+    const GateSink *mGate;
+    const ArenaSink *mArena;
+    const NetworkDevice *mNetwork;
+    const MergeDevice *mMerge;
+
+    struct ThreadInfo
+    {
+        // Set last, once the entry is complete
+        std::atomic<const char *> name;
+#ifdef WIN32
+        HANDLE handle;
+#else
+        clockid_t clock;
+#endif
+    };
+    ThreadInfo mThreads[MAX_STATS_THREADS];
+    std::atomic<int> mNumThreads;
+
+    char mFilePath[CAIMAN_PATH_MAX];
+    int mFileIntervalMs;
+    std::atomic<bool> mFileWriterRunning;
+#ifdef WIN32
+    HANDLE mFileWriterThread;
+#else
+    pthread_t mFileWriterThread;
+#endif
+
+    // Intentionally unimplemented
+    Stats(const Stats &);
+    Stats &operator=(const Stats &);
+};
+
+extern Stats gStats;
+
+#endif // STATS_H
@@ -0,0 +1,175 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SyntheticDevice.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#define SLEEP_US(US)    Sleep((US) / 1000)
+#else
+#include <unistd.h>
+#define SLEEP_US(US)    usleep(US)
+#endif
+
+#include "Latency.h"
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "Stats.h"
+
+// Longest time processBuffer sleeps, so gQuit is noticed promptly
+#define MAX_SLEEP_US 10000
+// Most buffers generated by one processBuffer call when catching up
+#define MAX_CATCHUP_BUFFERS 16
+
+SyntheticDevice::SyntheticDevice(const char *outputPath, unsigned int rate)
+        : Device(outputPath),
+          mRate(rate),
+          mStartTime(0),
+          mSamples(0),
+          mValue(0)
+{
+    if (mRate > 0) {
+        mSampleRate = mRate;
+    }
+}
+
+SyntheticDevice::~SyntheticDevice()
+{
+}
+
+void SyntheticDevice::prepareChannels()
+{
+    mNumFields = 0;
+    for (int index = 0; index < MAX_COUNTERS; index++) {
+        if (gSessionData.mCounterEnabled[index]) {
+            mNumFields++;
+        }
+    }
+
+    mVendor = "caiman synthetic device";
+    mDatasize = EMETER_DATA_SIZE;
+}
+
+void SyntheticDevice::init(const char *devicename)
+{
+    (void) devicename;
+    logg.logMessage("Synthetic device with %d fields at %u samples per second", mNumFields, mRate);
+}
+
+void SyntheticDevice::start()
+{
+    mSamples = 0;
+    mValue = 0;
+    mStartTime = getTime();
+}
+
+void SyntheticDevice::stop()
+{
+    logg.logMessage("Synthetic device generated %llu samples", (unsigned long long) mSamples);
+}
+
+void SyntheticDevice::pause()
+{
+    stop();
+}
+
+unsigned int SyntheticDevice::fill(char *out, unsigned int samples)
+{
+    unsigned int outLength = 0;
+
+    for (unsigned int sample = 0; sample < samples; sample++) {
+        for (int field = 0; field < mNumFields; field++) {
+            out[outLength++] = mValue & 0xFF;
+            out[outLength++] = (mValue >> 8) & 0xFF;
+            out[outLength++] = (mValue >> 16) & 0xFF;
+            out[outLength++] = (mValue >> 24) & 0xFF;
+            mValue = (mValue + 1) & 0x7FFFFFFF;
+        }
+    }
+
+    mSamples += samples;
+    return outLength;
+}
+
+void SyntheticDevice::generate(unsigned int samples)
+{
+    const unsigned int outLength = fill(mOutBuffer, samples);
+    Stats::add(gStats.mFramesRead, samples);
+    writeData(mOutBuffer, outLength);
+}
+
+unsigned int SyntheticDevice::pace(unsigned int limit)
+{
+    if (mRate == 0) {
+        // Unpaced; the fifo blocks once the sender falls behind
+        return limit;
+    }
+
+    // Generate about a millisecond of samples at a time rather than waking for every sample
+    unsigned int batch = mRate / 1000;
+    if (batch < 1) {
+        batch = 1;
+    }
+    else if (batch > limit) {
+        batch = limit;
+    }
+
+    const uint64_t now = getTime();
+    const uint64_t due = (now - mStartTime) / 1000 * mRate / 1000000;
+    if (due < mSamples + batch) {
+        const uint64_t wake = mStartTime + (mSamples + batch) * 1000000 / mRate * 1000;
+        const uint64_t sleepUs = wake > now ? (wake - now) / 1000 : 0;
+        SLEEP_US(sleepUs < MAX_SLEEP_US ? sleepUs : MAX_SLEEP_US);
+        return 0;
+    }
+
+    return due - mSamples < limit ? (unsigned int) (due - mSamples) : limit;
+}
+
+void SyntheticDevice::processBuffer()
+{
+    const unsigned int perBuffer = SYNTHETIC_BUFFER_SIZE / (mNumFields * mDatasize);
+
+    // After a stall catch up over several calls so gQuit is still noticed
+    unsigned int pending = pace(mRate == 0 ? perBuffer : perBuffer * MAX_CATCHUP_BUFFERS);
+    if (pending == 0) {
+        return;
+    }
+
+    gLatency.markRead();
+    while (pending > 0) {
+        const unsigned int samples = pending < perBuffer ? pending : perBuffer;
+        generate(samples);
+        pending -= samples;
+    }
+}
+
+void SyntheticDevice::readRaw(RawBlock *block)
+{
+    // The generated values are already in their final form, so there is nothing left to decode
+    block->length = fill(block->data, pace(RAW_BLOCK_SIZE / (mNumFields * mDatasize)));
+    block->readTime = getTime();
+    block->restarted = false;
+    block->idle = false;
+    block->gapFrames = 0;
+    Stats::add(gStats.mBytesRead, block->length);
+}
+
+void SyntheticDevice::decodeRaw(const RawBlock *block)
+{
+    Stats::add(gStats.mFramesRead, block->length / (mNumFields * mDatasize));
+    writeData((void *) block->data, block->length);
+}
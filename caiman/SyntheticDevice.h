@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYNTHETIC_DEVICE_H
+#define SYNTHETIC_DEVICE_H
+
+#include <stdint.h>
+
+#include "Devices.h"
+
+// Bytes generated per write to the fifo, must not exceed the fifo's single buffer size
+#define SYNTHETIC_BUFFER_SIZE (1 << 14)
+
+// Generates a deterministic sample stream without any hardware, for testing and measuring the pipeline.
+// Every value in the stream is one more than the previous value, modulo 2^31, so a reader can detect lost data.
+class SyntheticDevice : public Device
+{
+public:
+    // rate is in samples per second; 0 generates samples as fast as they can be consumed
+    SyntheticDevice(const char *outputPath, unsigned int rate);
+    virtual ~SyntheticDevice();
+
+    virtual void prepareChannels();
+    virtual void init(const char *devicename);
+    virtual void start();
+    virtual void stop();
+    virtual void pause();
+    virtual void processBuffer();
+    virtual void readRaw(RawBlock *block);
+    virtual void decodeRaw(const RawBlock *block);
+
+private:
+    // Writes the next samples to out, returning the number of bytes written
+    unsigned int fill(char *out, unsigned int samples);
+    void generate(unsigned int samples);
+    // Returns the number of samples due, at most limit, or sleeps briefly and returns 0 if none are
+    unsigned int pace(unsigned int limit);
+
+    // Initialized on construction
+    const unsigned int mRate;
+
+    // Initialized on start()
+    uint64_t mStartTime;
+    uint64_t mSamples;
+    uint32_t mValue;
+
+    char mOutBuffer[SYNTHETIC_BUFFER_SIZE];
+
+    // Intentionally unimplemented
+    SyntheticDevice(const SyntheticDevice &);
+    SyntheticDevice &operator=(const SyntheticDevice &);
+};
+
+#endif // SYNTHETIC_DEVICE_H
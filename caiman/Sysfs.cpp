@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Sysfs.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <dirent.h>
+#endif
+
+#include "OlyUtility.h"
+
+bool formatPath(char *path, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(path, CAIMAN_PATH_MAX, format, args);
+    va_end(args);
+    return length >= 0 && length < CAIMAN_PATH_MAX;
+}
+
+#if !defined(WIN32)
+
+static int compareNames(const void *a, const void *b)
+{
+    const char *x = *(const char * const *) a;
+    const char *y = *(const char * const *) b;
+
+    while (*x != '\0' && *y != '\0') {
+        if (*x >= '0' && *x <= '9' && *y >= '0' && *y <= '9') {
+            char *xEnd, *yEnd;
+            const unsigned long long xValue = strtoull(x, &xEnd, 10);
+            const unsigned long long yValue = strtoull(y, &yEnd, 10);
+            if (xValue != yValue) {
+                return xValue < yValue ? -1 : 1;
+            }
+            x = xEnd;
+            y = yEnd;
+        }
+        else if (*x != *y) {
+            return (unsigned char) *x - (unsigned char) *y;
+        }
+        else {
+            x++;
+            y++;
+        }
+    }
+    return (unsigned char) *x - (unsigned char) *y;
+}
+
+#endif
+
+int listDirectory(const char *path, char **names)
+{
+#if defined(WIN32)
+    (void) path;
+    (void) names;
+    return 0;
+#else
+    DIR * const dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    int count = 0;
+    struct dirent *entry;
+    while (count < SYSFS_MAX_ENTRIES && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            names[count++] = strdup(entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    qsort(names, count, sizeof(*names), compareNames);
+    return count;
+#endif
+}
+
+bool readLine(const char *path, char *line, int size)
+{
+    FILE * const file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    const bool result = fgets(line, size, file) != NULL;
+    fclose(file);
+    if (result) {
+        line[strcspn(line, "\n")] = '\0';
+    }
+    return result;
+}
+
+bool writeLine(const char *path, const char *line)
+{
+    FILE * const file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    // sysfs reports a rejected value when the write is flushed
+    bool result = fputs(line, file) >= 0;
+    const int error = errno;
+    if (fclose(file) != 0) {
+        result = false;
+    }
+    else if (!result) {
+        errno = error;
+    }
+    return result;
+}
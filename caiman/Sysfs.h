@@ -0,0 +1,35 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSFS_H
+#define SYSFS_H
+
+// Most entries listDirectory returns
+#define SYSFS_MAX_ENTRIES 256
+
+// Helpers for the devices that are found and configured through sysfs
+
+// Formats a path into a buffer of CAIMAN_PATH_MAX bytes, returning false if it is too long
+bool formatPath(char *path, const char *format, ...);
+// Lists the entries of path other than . and .., with runs of digits ordered by value so hwmon2 comes before hwmon10.
+// names must have room for SYSFS_MAX_ENTRIES; returns how many there are, and the caller must free each.
+int listDirectory(const char *path, char **names);
+// Reads the first line of a small file such as a sysfs attribute, without the newline, returning false if it cannot
+bool readLine(const char *path, char *line, int size);
+// Replaces the contents of a sysfs attribute, returning false with errno set if it cannot
+bool writeLine(const char *path, const char *line);
+
+#endif // SYSFS_H
@@ -0,0 +1,35 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+// THREAD_CREATE evaluates to true if the thread was started, THREAD_ID is only valid in that case
+#ifdef WIN32
+#include <windows.h>
+
+#define tHANDLE    HANDLE
+#define THREAD_CREATE(THREAD_ID, THREAD_FUNC, ARG) ((THREAD_ID = CreateThread(NULL, 0, (unsigned long (__stdcall *)(void *))THREAD_FUNC, ARG, 0, NULL)) != NULL)
+#define THREAD_JOIN(THREAD_ID) WaitForSingleObject(THREAD_ID, INFINITE)
+#else
+#include <pthread.h>
+
+#define tHANDLE    pthread_t
+#define THREAD_CREATE(THREAD_ID, THREAD_FUNC, ARG) (pthread_create(&THREAD_ID, NULL, THREAD_FUNC, ARG) == 0)
+#define THREAD_JOIN(THREAD_ID) pthread_join(THREAD_ID, NULL)
+#endif
+
+#endif // THREAD_H
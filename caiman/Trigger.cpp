@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Trigger.h"
+
+#include <stdlib.h>
+
+#include "SessionData.h"
+
+TriggerCondition::TriggerCondition()
+        : mSpec(NULL),
+          mField(0),
+          mChannel(0),
+          mLevel(0),
+          mRising(true),
+          mSource(-1),
+          mState(-1)
+{
+}
+
+bool TriggerCondition::parse(const char *spec)
+{
+    mSpec = spec;
+    switch (spec[0]) {
+    case 'p':
+        mField = POWER;
+        break;
+    case 'v':
+        mField = VOLTAGE;
+        break;
+    case 'i':
+        mField = CURRENT;
+        break;
+    default:
+        return false;
+    }
+
+    char *end;
+    const long channel = strtol(spec + 1, &end, 10);
+    if (end == spec + 1 || channel < 0 || channel >= MAX_CHANNELS) {
+        return false;
+    }
+    mChannel = (int) channel;
+
+    if (*end != '>' && *end != '<') {
+        return false;
+    }
+    mRising = *end == '>';
+
+    const char * const levelStart = end + 1;
+    const long level = strtol(levelStart, &end, 10);
+    if (end == levelStart || *end != '\0' || level < INT32_MIN || level > INT32_MAX) {
+        return false;
+    }
+    mLevel = (int32_t) level;
+
+    return true;
+}
+
+bool TriggerCondition::resolve(int numFields)
+{
+    for (int i = 0; i < MAX_COUNTERS; i++) {
+        if (gSessionData.mCounterEnabled[i] && gSessionData.mCounterChannel[i] == mChannel && gSessionData.mCounterField[i] == mField &&
+            gSessionData.mCounterSource[i] < numFields) {
+            mSource = gSessionData.mCounterSource[i];
+            return true;
+        }
+    }
+    return false;
+}
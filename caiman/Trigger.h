@@ -0,0 +1,75 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+
+// A level crossing on one field of the decoded samples, written as <field><channel><edge><level>, e.g. p0>1500 for
+// channel 0's power rising above 1500 or v1<4900 for channel 1's voltage falling below 4900. The field is p, v or i for
+// power, voltage or current and the level is in the units of the capture data.
+class TriggerCondition
+{
+public:
+    TriggerCondition();
+
+    // Returns false if spec is malformed
+    bool parse(const char *spec);
+    // Finds the field in each sample once the channels are prepared, returning false if it is not captured
+    bool resolve(int numFields);
+
+    int getSource() const
+    {
+        return mSource;
+    }
+    const char *getSpec() const
+    {
+        return mSpec;
+    }
+
+    // Returns true if value has crossed the level in the direction of the condition since the last call. The first
+    // value only sets the starting state, so a value already past the level does not count as a crossing.
+    bool crossed(int32_t value)
+    {
+        const int state = mRising ? value > mLevel : value < mLevel;
+        const bool result = state > mState && mState >= 0;
+        mState = state;
+        return result;
+    }
+    // Returns true if the last value was past the level
+    bool isPast() const
+    {
+        return mState > 0;
+    }
+    // Forgets the last value, e.g. between captures
+    void reset()
+    {
+        mState = -1;
+    }
+
+private:
+    const char *mSpec;
+    int mField;
+    int mChannel;
+    int32_t mLevel;
+    bool mRising;
+    int mSource;
+    // -1 before the first value, otherwise whether the last value was past the level
+    int mState;
+};
+
+#endif // TRIGGER_H
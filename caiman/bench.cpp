@@ -0,0 +1,438 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// caiman_bench exercises the hot parts of caiman in isolation with synthetic input.
+// Each result is printed as one JSON object per line so runs can be compared across commits and hosts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
+
+#include "EnergyProbe.h"
+#include "Fifo.h"
+#include "Latency.h"
+#include "Logging.h"
+#include "NiDaq.h"
+#include "OlyUtility.h"
+#include "SessionData.h"
+#include "Sinks.h"
+#include "Thread.h"
+
+volatile bool gQuit = false;
+
+[[noreturn]] void handleException()
+{
+    fprintf(stderr, "%s", logg.getLastError());
+    exit(1);
+}
+
+static char host[256];
+// Scales the amount of work done by every benchmark
+static double scale = 1.0;
+static const char *filter = NULL;
+
+static bool selected(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char *name, const char *params, uint64_t ops, uint64_t bytes, uint64_t ns)
+{
+    const double seconds = ns / 1e9;
+    printf("{\"bench\":\"%s\",\"params\":\"%s\",\"host\":\"%s\",\"ops\":%llu,\"bytes\":%llu,\"ns\":%llu,\"ns_per_op\":%.3f,\"mb_per_s\":%.3f}\n",
+           name, params, host, (unsigned long long) ops, (unsigned long long) bytes, (unsigned long long) ns,
+           ops > 0 ? (double) ns / ops : 0.0, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    fflush(stdout);
+}
+
+static void reportLatency(const char *name, const char *params, const LatencyHistogram &histogram)
+{
+    printf("{\"bench\":\"%s\",\"params\":\"%s\",\"host\":\"%s\",\"ops\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+           name, params, host, (unsigned long long) histogram.getCount(), (unsigned long long) histogram.getPercentile(50.0),
+           (unsigned long long) histogram.getPercentile(99.0), (unsigned long long) histogram.getPercentile(99.9),
+           (unsigned long long) histogram.getMax());
+    fflush(stdout);
+}
+
+// Exposes the protected parts of Device
+class BenchDevice : public Device
+{
+public:
+    BenchDevice()
+            : Device("./")
+    {
+        mNumFields = 0;
+        mVendor = "caiman_bench";
+        mDatasize = EMETER_DATA_SIZE;
+    }
+
+    virtual void prepareChannels()
+    {
+    }
+    virtual void init(const char *)
+    {
+    }
+    virtual void start()
+    {
+    }
+    virtual void stop()
+    {
+    }
+    virtual void pause()
+    {
+    }
+    virtual void processBuffer()
+    {
+    }
+    virtual void readRaw(RawBlock *block)
+    {
+        block->length = 0;
+    }
+    virtual void decodeRaw(const RawBlock *)
+    {
+    }
+
+    void write(void *buf, size_t size)
+    {
+        writeData(buf, size);
+    }
+};
+
+// Fifo
+
+struct FifoBench
+{
+    Fifo *fifo;
+    sem_t readerSem;
+    sem_t ackSem;
+    int chunk;
+    uint64_t total;
+    std::atomic<uint64_t> writeTime;
+    LatencyHistogram *wakeups;
+};
+
+static void *fifoReader(void *pVoid)
+{
+    FifoBench * const bench = (FifoBench *) pVoid;
+    int length = 1;
+
+    while (length > 0) {
+        sem_wait(&bench->readerSem);
+        char * const data = bench->fifo->read(&length);
+        if (data == NULL) {
+            continue;
+        }
+        if (bench->wakeups != NULL && length > 0) {
+            bench->wakeups->record(getTime() - bench->writeTime.load());
+            sem_post(&bench->ackSem);
+        }
+        bench->fifo->release();
+    }
+
+    return 0;
+}
+
+static void benchFifoThroughput(int chunk)
+{
+    FifoBench bench;
+    tHANDLE reader;
+    char params[64];
+
+    sem_init(&bench.readerSem, 0, 0);
+    bench.fifo = new Fifo(1 << 15, 1 << 20, &bench.readerSem);
+    bench.chunk = chunk;
+    bench.total = (uint64_t) (scale * (1ULL << 30));
+    bench.wakeups = NULL;
+
+    const uint64_t start = getTime();
+    if (!THREAD_CREATE(reader, fifoReader, &bench)) {
+        logg.logError("Failed to create FIFO reader thread");
+        handleException();
+    }
+    char *buffer = bench.fifo->start();
+    uint64_t written = 0, ops = 0;
+    while (written < bench.total) {
+        memset(buffer, (int) ops, chunk);
+        buffer = bench.fifo->write(chunk);
+        written += chunk;
+        ops++;
+    }
+    bench.fifo->write(0);
+    THREAD_JOIN(reader);
+    const uint64_t elapsed = getTime() - start;
+
+    snprintf(params, sizeof(params), "chunk=%d", chunk);
+    report("fifo_throughput", params, ops, written, elapsed);
+
+    delete bench.fifo;
+    sem_destroy(&bench.readerSem);
+}
+
+static void benchFifoWakeup()
+{
+    FifoBench bench;
+    tHANDLE reader;
+    LatencyHistogram *histogram = new LatencyHistogram;
+
+    sem_init(&bench.readerSem, 0, 0);
+    sem_init(&bench.ackSem, 0, 0);
+    bench.fifo = new Fifo(1 << 15, 1 << 20, &bench.readerSem);
+    bench.chunk = EMETER_DATA_SIZE * 9;
+    bench.wakeups = histogram;
+
+    if (!THREAD_CREATE(reader, fifoReader, &bench)) {
+        logg.logError("Failed to create FIFO reader thread");
+        handleException();
+    }
+    char *buffer = bench.fifo->start();
+    const int iterations = (int) (scale * 20000);
+    for (int i = 0; i < iterations; i++) {
+        memset(buffer, i, bench.chunk);
+        bench.writeTime.store(getTime());
+        buffer = bench.fifo->write(bench.chunk);
+        sem_wait(&bench.ackSem);
+    }
+    bench.wakeups = NULL;
+    bench.fifo->write(0);
+    THREAD_JOIN(reader);
+
+    reportLatency("fifo_wakeup", "chunk=36", *histogram);
+
+    delete histogram;
+    delete bench.fifo;
+    sem_destroy(&bench.readerSem);
+    sem_destroy(&bench.ackSem);
+}
+
+// Energy Probe
+
+static void benchEnergyProbeDecode(int numChannels, int gapEvery)
+{
+    char params[64];
+
+    // Only enable counters on the requested number of channels
+    for (int i = 0; i < MAX_COUNTERS; i++) {
+        gSessionData.mCounterEnabled[i] = gSessionData.mCounterField[i] != 0 && gSessionData.mCounterChannel[i] < numChannels;
+    }
+    EnergyProbe energyProbe("./");
+    energyProbe.prepareChannels();
+    const int numFields = numChannels * MAX_FIELDS_PER_CHANNEL;
+
+    // One second of frames, skipping five frames every gapEvery frames
+    const int frames = 10000;
+    const int frameSize = (1 + numFields) * 2;
+    const int length = frames * frameSize - (frames * frameSize) % EMETER_BUFFER_SIZE;
+    unsigned char * const tap = (unsigned char *) malloc(frames * frameSize);
+    unsigned short frame = 0;
+    for (int i = 0; i < frames; i++) {
+        unsigned char * const out = tap + i * frameSize;
+        out[0] = frame & 0xff;
+        out[1] = frame >> 8;
+        for (int field = 0; field < numFields; field++) {
+            out[2 + field * 2] = (i + field) & 0xff;
+            out[3 + field * 2] = 0x10;
+        }
+        frame += (gapEvery > 0 && i % gapEvery == gapEvery - 1) ? 6 : 1;
+    }
+
+    const int iterations = (int) (scale * 200);
+    const uint64_t start = getTime();
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        energyProbe.resetDecoder();
+        for (int pos = 0; pos < length; pos += EMETER_BUFFER_SIZE) {
+            energyProbe.decodeBuffer((const char *) tap + pos, EMETER_BUFFER_SIZE);
+        }
+    }
+    const uint64_t elapsed = getTime() - start;
+
+    snprintf(params, sizeof(params), "fields=%d,gap_every=%d", numFields, gapEvery);
+    report("eprobe_decode", params, (uint64_t) iterations * (length / EMETER_BUFFER_SIZE), (uint64_t) iterations * length, elapsed);
+
+    free(tap);
+    for (int i = 0; i < MAX_COUNTERS; i++) {
+        gSessionData.mCounterEnabled[i] = gSessionData.mCounterField[i] != 0;
+    }
+}
+
+// NI DAQ
+
+static void benchNiDaqConvert(int numChannels)
+{
+    char fields[MAX_CHANNELS];
+    char params[64];
+    const int rows = 1000;
+    double * const data = (double *) malloc(rows * numChannels * 2 * sizeof(double));
+    unsigned char outbuf[MAX_CHANNELS * EMETER_DATA_SIZE * MAX_FIELDS];
+
+    for (int chan = 0; chan < MAX_CHANNELS; chan++) {
+        fields[chan] = chan < numChannels ? (POWER | VOLTAGE | CURRENT) : 0;
+        if (gSessionData.mResistors[chan] <= 0) {
+            gSessionData.mResistors[chan] = 20;
+        }
+    }
+    for (int i = 0; i < rows * numChannels * 2; i++) {
+        data[i] = (i & 1) ? 0.01 + (i % 7) * 0.001 : 3.3 + (i % 5) * 0.01;
+    }
+
+    const int iterations = (int) (scale * 1000);
+    uint64_t bytes = 0;
+    const uint64_t start = getTime();
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        for (int row = 0; row < rows; row++) {
+            bytes += NiDaq::convertRow(&data[row * numChannels * 2], fields, gSessionData.mResistors, outbuf);
+        }
+    }
+    const uint64_t elapsed = getTime() - start;
+
+    snprintf(params, sizeof(params), "channels=%d", numChannels);
+    report("nidaq_convert", params, (uint64_t) iterations * rows, bytes, elapsed);
+
+    free(data);
+}
+
+// Device
+
+static void benchDeviceWriteFile(int chunk)
+{
+    char params[64];
+    char path[] = "caiman_bench.apc";
+    FILE * const binfile = fopen(path, "wb");
+    if (binfile == NULL) {
+        logg.logError("Unable to open %s", path);
+        handleException();
+    }
+
+    FileSink sink(binfile);
+    BenchDevice device;
+    device.addSink(&sink);
+    char * const buffer = (char *) malloc(chunk);
+    memset(buffer, 0x5a, chunk);
+
+    const uint64_t total = (uint64_t) (scale * (256ULL << 20));
+    uint64_t written = 0, ops = 0;
+    const uint64_t start = getTime();
+    while (written < total) {
+        device.write(buffer, chunk);
+        written += chunk;
+        ops++;
+    }
+    fflush(binfile);
+    const uint64_t elapsed = getTime() - start;
+
+    snprintf(params, sizeof(params), "chunk=%d", chunk);
+    report("device_write_file", params, ops, written, elapsed);
+
+    fclose(binfile);
+    remove(path);
+    free(buffer);
+}
+
+static void benchGetXML()
+{
+    BenchDevice device;
+    const int iterations = (int) (scale * 100000);
+    uint64_t bytes = 0;
+
+    const uint64_t start = getTime();
+    for (int i = 0; i < iterations; i++) {
+        int length;
+        char * const xml = device.getXML(&length);
+        bytes += length;
+        free(xml);
+    }
+    const uint64_t elapsed = getTime() - start;
+
+    report("get_xml", "channels=3", iterations, bytes, elapsed);
+}
+
+static void printHelp()
+{
+    logg.logError("Usage: caiman_bench [options]\n"
+            "-f <name>\tonly run benchmarks whose name contains name\n"
+            "-s <scale>\tscale the amount of work done by each benchmark; default is 1.0\n"
+            "-h/--help\tthis help page\n");
+    handleException();
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+            if (scale <= 0) {
+                printHelp();
+            }
+        }
+        else {
+            printHelp();
+        }
+    }
+
+#if defined(WIN32)
+    DWORD hostLength = sizeof(host);
+    if (!GetComputerNameA(host, &hostLength)) {
+#else
+    if (gethostname(host, sizeof(host)) != 0) {
+#endif
+        strcpy(host, "unknown");
+    }
+    host[sizeof(host) - 1] = '\0';
+
+    // Missing frames are expected, do not let logging dominate the decoder
+    logg.setDebug(false);
+
+    // Configure the three Energy Probe channels
+    for (int chan = 0; chan < MAX_EPROBE_CHANNELS; chan++) {
+        gSessionData.mResistors[chan] = 20 + chan;
+    }
+    gSessionData.compileData();
+
+    if (selected("fifo_throughput")) {
+        benchFifoThroughput(128);
+        benchFifoThroughput(4096);
+    }
+    if (selected("fifo_wakeup")) {
+        benchFifoWakeup();
+    }
+    if (selected("eprobe_decode")) {
+        for (int channels = 1; channels <= MAX_EPROBE_CHANNELS; channels++) {
+            benchEnergyProbeDecode(channels, 0);
+        }
+        benchEnergyProbeDecode(MAX_EPROBE_CHANNELS, 100);
+    }
+    if (selected("nidaq_convert")) {
+        benchNiDaqConvert(1);
+        benchNiDaqConvert(4);
+        benchNiDaqConvert(16);
+        benchNiDaqConvert(MAX_CHANNELS);
+    }
+    if (selected("device_write_file")) {
+        benchDeviceWriteFile(128);
+        benchDeviceWriteFile(4096);
+    }
+    if (selected("get_xml")) {
+        benchGetXML();
+    }
+
+    return 0;
+}
@@ -0,0 +1,647 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// caiman_loadclient connects to caiman the way Streamline does, captures for a fixed time
+// and reports throughput, arrival gaps and jitter. It can also behave as a slow reader to
+// exercise the fifo and the sender thread.
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Latency.h"
+#include "Logging.h"
+#include "OlySocket.h"
+#include "OlyUtility.h"
+
+#define DEFAULT_PORT 8081
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_GAP_MS 50
+#define DEFAULT_CHUNK (1 << 16)
+
+// Must match main.cpp
+enum
+{
+    COMMAND_REQUEST_XML = 0,
+    COMMAND_APC_START = 2,
+    COMMAND_APC_STOP = 3,
+    COMMAND_REQUEST_STATS = 6,
+    COMMAND_REQUEST_LATEST = 7,
+    COMMAND_REQUEST_SEGMENTS = 8
+};
+
+enum
+{
+    RESPONSE_XML = 1,
+    RESPONSE_APC_DATA = 3,
+    RESPONSE_ACK = 4,
+    RESPONSE_NAK = 5,
+    RESPONSE_ERROR = 0xFF
+};
+
+struct options_t
+{
+    const char *host;
+    int port;
+    int duration;
+    int chunk;
+    int rcvbuf;
+    long long readRate;
+    int stallMs;
+    int stallPeriodMs;
+    int gapMs;
+    int intervalMs;
+    const char *xmlFile;
+    const char *statsFile;
+    const char *latestFile;
+    const char *segmentsFile;
+    const char *outFile;
+    bool verify;
+};
+
+volatile bool gQuit = false;
+static int fd = -1;
+static FILE *outfile = NULL;
+
+[[noreturn]] void handleException()
+{
+    logg.stopAsync();
+    fprintf(stderr, "%s", logg.getLastError());
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (outfile) {
+        fclose(outfile);
+    }
+
+    exit(1);
+}
+
+static int connectTo(const char *host, int port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    char service[16];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        logg.logError("Unable to resolve %s", host);
+        handleException();
+    }
+
+    int sock = -1;
+    for (struct addrinfo *ai = result; ai != NULL && sock < 0; ai = ai->ai_next) {
+        sock = socket_cloexec(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (sock < 0) {
+        logg.logError("Unable to connect to %s:%d, is caiman running?", host, port);
+        handleException();
+    }
+    return sock;
+}
+
+static void sendAll(const char *buffer, int size)
+{
+    while (size > 0) {
+        const ssize_t n = send(fd, buffer, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logg.logError("Socket send error");
+            handleException();
+        }
+        buffer += n;
+        size -= n;
+    }
+}
+
+static void sendCommand(int type)
+{
+    const char header[5] = { (char) type, 0, 0, 0, 0 };
+    sendAll(header, sizeof(header));
+}
+
+// Waits until data is available or timeoutMs passes, returns false on timeout
+static bool waitReadable(int timeoutMs)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    const int result = poll(&pfd, 1, timeoutMs);
+    if (result < 0 && errno != EINTR) {
+        logg.logError("poll failed");
+        handleException();
+    }
+    return result > 0;
+}
+
+// Returns the number of bytes received, 0 if the timeout passed first or -1 once caiman disconnects
+static int receiveSome(char *buffer, int size, int timeoutMs)
+{
+    if (!waitReadable(timeoutMs)) {
+        return 0;
+    }
+
+    const ssize_t bytes = recv(fd, buffer, size, 0);
+    if (bytes < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return 0;
+        }
+        if (errno == ECONNRESET) {
+            return -1;
+        }
+        logg.logError("Socket receive error");
+        handleException();
+    }
+    return bytes == 0 ? -1 : (int) bytes;
+}
+
+static void receiveExactly(char *buffer, int size)
+{
+    while (size > 0) {
+        const int bytes = receiveSome(buffer, size, -1);
+        if (bytes < 0) {
+            logg.logError("caiman disconnected unexpectedly");
+            handleException();
+        }
+        buffer += bytes;
+        size -= bytes;
+    }
+}
+
+// Reads a complete response during setup, returning its body which must be freed by the caller
+static char *receiveResponse(int *type, int *length)
+{
+    unsigned char header[5];
+    receiveExactly((char *) header, sizeof(header));
+    *type = header[0];
+    *length = header[1] | (header[2] << 8) | (header[3] << 16) | (header[4] << 24);
+    if (*length < 0 || *length > 1024 * 1024) {
+        logg.logError("Invalid response length %d", *length);
+        handleException();
+    }
+
+    char * const body = (char *) malloc(*length + 1);
+    receiveExactly(body, *length);
+    body[*length] = '\0';
+    if (*type == RESPONSE_ERROR) {
+        logg.logError("caiman reported an error: %s", body);
+        handleException();
+    }
+    return body;
+}
+
+static int getAttribute(const char *xml, const char *name)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), " %s=\"", name);
+    const char * const found = strstr(xml, pattern);
+    return found != NULL ? atoi(found + strlen(pattern)) : 0;
+}
+
+static void saveFile(const char *path, const char *data)
+{
+    if (path != NULL && writeToDisk(path, data) < 0) {
+        logg.logError("Unable to write %s", path);
+        handleException();
+    }
+}
+
+struct Totals
+{
+    uint64_t bytes;
+    uint64_t messages;
+    uint64_t gaps;
+    uint64_t stalls;
+    uint64_t verifyErrors;
+    uint64_t missingValues;
+    double sumIntervals;
+    double sumSquares;
+};
+
+// Checks data continues the sequence of values generated by SyntheticDevice
+class Verifier
+{
+public:
+    Verifier()
+            : mStarted(false),
+              mExpected(0),
+              mPartialLength(0)
+    {
+    }
+
+    void check(const unsigned char *data, int length, Totals *totals)
+    {
+        for (int i = 0; i < length; i++) {
+            mPartial[mPartialLength++] = data[i];
+            if (mPartialLength < 4) {
+                continue;
+            }
+            mPartialLength = 0;
+
+            const uint32_t value = mPartial[0] | (mPartial[1] << 8) | (mPartial[2] << 16) | ((uint32_t) mPartial[3] << 24);
+            if (mStarted && value != mExpected) {
+                totals->verifyErrors++;
+                totals->missingValues += (value - mExpected) & 0x7FFFFFFF;
+            }
+            mStarted = true;
+            mExpected = (value + 1) & 0x7FFFFFFF;
+        }
+    }
+
+private:
+    bool mStarted;
+    uint32_t mExpected;
+    unsigned char mPartial[4];
+    int mPartialLength;
+};
+
+static void printInterval(const Totals &now, const Totals &last, uint64_t elapsedNs)
+{
+    const double seconds = elapsedNs / 1e9;
+    printf("{\"interval_s\":%.3f,\"bytes\":%llu,\"messages\":%llu,\"gaps\":%llu,\"mb_per_s\":%.3f}\n", seconds,
+           (unsigned long long) (now.bytes - last.bytes), (unsigned long long) (now.messages - last.messages),
+           (unsigned long long) (now.gaps - last.gaps), seconds > 0 ? (now.bytes - last.bytes) / seconds / 1e6 : 0.0);
+    fflush(stdout);
+}
+
+static void printHelp()
+{
+    logg.logError("Usage: caiman_loadclient [options]\n"
+            "-H <host>\thost running caiman; default is localhost\n"
+            "-p <port>\tport caiman is listening on; default is %d\n"
+            "-t <seconds>\tlength of the capture; default is %d\n"
+            "-i <ms>\t\tprint throughput every ms milliseconds\n"
+            "-o <file>\twrite the received APC data to file\n"
+            "--xml <file>\twrite the captured XML to file\n"
+            "--stats <file>\trequest caiman's pipeline counters before stopping and write them to file\n"
+            "--latest <file>\trequest the latest value of each field before stopping and write them to file\n"
+            "--segments <file>\trequest the segments passed on by caiman --gate before stopping and write them to file\n"
+            "--gap <ms>\tcount arrivals more than ms milliseconds apart as gaps; default is %d\n"
+            "--chunk <bytes>\tmaximum bytes to consume per read; default is %d\n"
+            "--rcvbuf <bytes>\tsocket receive buffer size\n"
+            "--read-rate <bytes/s>\tconsume data no faster than this to simulate a slow reader\n"
+            "--stall <ms>:<period>\tstop reading for ms milliseconds every period milliseconds\n"
+            "--verify\tcheck the data is the sequence generated by caiman --synthetic\n"
+            "-h/--help\tthis help page\n", DEFAULT_PORT, DEFAULT_DURATION_S, DEFAULT_GAP_MS, DEFAULT_CHUNK);
+    handleException();
+}
+
+static void parseInt(int *value, const char *arg, const char *name, int min)
+{
+    if (!stringToInt(value, arg, 10) || *value < min) {
+        logg.logError("%s must be an integer of at least %d", name, min);
+        handleException();
+    }
+}
+
+static struct options_t parseCommandLine(int argc, char *argv[])
+{
+    struct options_t options;
+    options.host = "localhost";
+    options.port = DEFAULT_PORT;
+    options.duration = DEFAULT_DURATION_S;
+    options.chunk = DEFAULT_CHUNK;
+    options.rcvbuf = 0;
+    options.readRate = 0;
+    options.stallMs = 0;
+    options.stallPeriodMs = 0;
+    options.gapMs = DEFAULT_GAP_MS;
+    options.intervalMs = 0;
+    options.xmlFile = NULL;
+    options.statsFile = NULL;
+    options.latestFile = NULL;
+    options.segmentsFile = NULL;
+    options.outFile = NULL;
+    options.verify = false;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-H") == 0 && hasValue) {
+            options.host = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0 && hasValue) {
+            parseInt(&options.port, argv[++i], "Port", 1);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && hasValue) {
+            parseInt(&options.duration, argv[++i], "Duration", 1);
+        }
+        else if (strcmp(argv[i], "-i") == 0 && hasValue) {
+            parseInt(&options.intervalMs, argv[++i], "Interval", 1);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && hasValue) {
+            options.outFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--xml") == 0 && hasValue) {
+            options.xmlFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && hasValue) {
+            options.statsFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--latest") == 0 && hasValue) {
+            options.latestFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--segments") == 0 && hasValue) {
+            options.segmentsFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--gap") == 0 && hasValue) {
+            parseInt(&options.gapMs, argv[++i], "Gap", 1);
+        }
+        else if (strcmp(argv[i], "--chunk") == 0 && hasValue) {
+            parseInt(&options.chunk, argv[++i], "Chunk size", 1);
+        }
+        else if (strcmp(argv[i], "--rcvbuf") == 0 && hasValue) {
+            parseInt(&options.rcvbuf, argv[++i], "Receive buffer size", 1);
+        }
+        else if (strcmp(argv[i], "--read-rate") == 0 && hasValue) {
+            int rate;
+            parseInt(&rate, argv[++i], "Read rate", 1);
+            options.readRate = rate;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            options.verify = true;
+        }
+        else if (strcmp(argv[i], "--stall") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%d:%d", &options.stallMs, &options.stallPeriodMs) != 2 || options.stallMs <= 0 ||
+                options.stallPeriodMs <= options.stallMs) {
+                logg.logError("Stall must be <ms>:<period> with period greater than ms");
+                handleException();
+            }
+        }
+        else {
+            printHelp();
+        }
+    }
+
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct options_t options = parseCommandLine(argc, argv);
+
+    if (options.outFile != NULL && (outfile = fopen(options.outFile, "wb")) == NULL) {
+        logg.logError("Unable to open %s", options.outFile);
+        handleException();
+    }
+
+    // Handshake, as performed by Streamline
+    const uint64_t connectStart = getTime();
+    fd = connectTo(options.host, options.port);
+    if (options.rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf)) != 0) {
+        logg.logError("Unable to set the receive buffer size");
+        handleException();
+    }
+    sendAll("STREAMLINE\n", strlen("STREAMLINE\n"));
+    char magic[64];
+    int pos = 0;
+    while (pos < (int) sizeof(magic) - 1) {
+        receiveExactly(&magic[pos], 1);
+        if (magic[pos] == '\n') {
+            break;
+        }
+        pos++;
+    }
+    magic[pos] = '\0';
+    if (strncmp(magic, "CAIMAN ", 7) != 0) {
+        logg.logError("Unexpected magic sequence '%s'", magic);
+        handleException();
+    }
+
+    int type, length;
+    sendCommand(COMMAND_REQUEST_XML);
+    char * const xml = receiveResponse(&type, &length);
+    if (type != RESPONSE_XML) {
+        logg.logError("Expected captured XML but received response type %d", type);
+        handleException();
+    }
+    saveFile(options.xmlFile, xml);
+    const int sampleRate = getAttribute(xml, "sample_rate");
+    const int sampleSize = getAttribute(xml, "sources") * getAttribute(xml, "size");
+    free(xml);
+
+    sendCommand(COMMAND_APC_START);
+    const uint64_t start = getTime();
+    const uint64_t setupNs = start - connectStart;
+
+    // Consume responses until caiman disconnects
+    const uint64_t stopTime = start + options.duration * 1000000000ULL;
+    const uint64_t gapNs = options.gapMs * 1000000ULL;
+    char * const buffer = (char *) malloc(options.chunk);
+    LatencyHistogram * const intervals = new LatencyHistogram;
+    Verifier verifier;
+    Totals totals, lastTotals;
+    memset(&totals, 0, sizeof(totals));
+    lastTotals = totals;
+    unsigned char header[5];
+    int headerPos = 0;
+    int remaining = 0;
+    int responseType = 0;
+    char *response = NULL;
+    int responseLength = 0;
+    uint64_t firstData = 0, lastData = 0, lastArrival = 0;
+    uint64_t nextStall = options.stallPeriodMs > 0 ? start + options.stallPeriodMs * 1000000ULL : 0;
+    uint64_t nextInterval = options.intervalMs > 0 ? start + options.intervalMs * 1000000ULL : 0;
+    uint64_t lastIntervalTime = start;
+    bool stopSent = false;
+    // Files for the XML responses still to come, in the order they were requested
+    const char *pendingXml[3];
+    int numPendingXml = 0, nextPendingXml = 0;
+
+    for (;;) {
+        uint64_t now = getTime();
+
+        if (!stopSent && now >= stopTime) {
+            if (options.latestFile != NULL) {
+                sendCommand(COMMAND_REQUEST_LATEST);
+                pendingXml[numPendingXml++] = options.latestFile;
+            }
+            if (options.segmentsFile != NULL) {
+                sendCommand(COMMAND_REQUEST_SEGMENTS);
+                pendingXml[numPendingXml++] = options.segmentsFile;
+            }
+            if (options.statsFile != NULL) {
+                sendCommand(COMMAND_REQUEST_STATS);
+                pendingXml[numPendingXml++] = options.statsFile;
+            }
+            sendCommand(COMMAND_APC_STOP);
+            stopSent = true;
+        }
+        if (nextInterval != 0 && now >= nextInterval) {
+            printInterval(totals, lastTotals, now - lastIntervalTime);
+            lastTotals = totals;
+            lastIntervalTime = now;
+            nextInterval += options.intervalMs * 1000000ULL;
+        }
+        if (nextStall != 0 && now >= nextStall && !stopSent) {
+            usleep(options.stallMs * 1000);
+            totals.stalls++;
+            nextStall += options.stallPeriodMs * 1000000ULL;
+            continue;
+        }
+
+        // Read no more than the header or the rest of the current response
+        int want = headerPos < (int) sizeof(header) ? (int) sizeof(header) - headerPos : remaining;
+        if (want > options.chunk) {
+            want = options.chunk;
+        }
+        char * const target = headerPos < (int) sizeof(header) ? (char *) &header[headerPos] : buffer;
+        const int bytes = receiveSome(target, want, 100);
+        if (bytes < 0) {
+            break;
+        }
+        if (bytes == 0) {
+            continue;
+        }
+
+        now = getTime();
+        if (headerPos < (int) sizeof(header)) {
+            headerPos += bytes;
+            if (headerPos < (int) sizeof(header)) {
+                continue;
+            }
+            responseType = header[0];
+            remaining = header[1] | (header[2] << 8) | (header[3] << 16) | (header[4] << 24);
+            if (remaining < 0) {
+                logg.logError("Invalid response length %d", remaining);
+                handleException();
+            }
+            if (responseType == RESPONSE_APC_DATA) {
+                if (firstData == 0) {
+                    firstData = now;
+                }
+                else {
+                    const uint64_t interval = now - lastArrival;
+                    intervals->record(interval);
+                    totals.sumIntervals += interval;
+                    totals.sumSquares += (double) interval * interval;
+                    if (interval > gapNs) {
+                        totals.gaps++;
+                    }
+                }
+                lastArrival = now;
+                totals.messages++;
+            }
+            else {
+                response = (char *) malloc(remaining + 1);
+                responseLength = 0;
+            }
+        }
+        else {
+            remaining -= bytes;
+            if (responseType == RESPONSE_APC_DATA) {
+                totals.bytes += bytes;
+                lastData = now;
+                if (outfile != NULL && fwrite(buffer, 1, bytes, outfile) != (size_t) bytes) {
+                    logg.logError("Unable to write %s", options.outFile);
+                    handleException();
+                }
+                if (options.verify) {
+                    verifier.check((const unsigned char *) buffer, bytes, &totals);
+                }
+                if (options.readRate > 0) {
+                    // Sleep until the data consumed so far would have taken this long at readRate
+                    const uint64_t due = start + (uint64_t) (totals.bytes * 1e9 / options.readRate);
+                    if (due > now) {
+                        usleep((due - now) / 1000);
+                    }
+                }
+            }
+            else {
+                memcpy(&response[responseLength], buffer, bytes);
+                responseLength += bytes;
+            }
+        }
+
+        if (remaining == 0) {
+            if (response != NULL) {
+                response[responseLength] = '\0';
+                if (responseType == RESPONSE_ERROR) {
+                    logg.logError("caiman reported an error: %s", response);
+                    handleException();
+                }
+                if ((responseType == RESPONSE_XML || responseType == RESPONSE_NAK) && nextPendingXml < numPendingXml) {
+                    const char * const path = pendingXml[nextPendingXml++];
+                    if (responseType == RESPONSE_NAK) {
+                        // e.g. --latest was not given to caiman, which should not stop the load being measured
+                        fprintf(stderr, "Warning: caiman declined the request for %s\n", path);
+                    }
+                    else {
+                        saveFile(path, response);
+                    }
+                }
+                free(response);
+                response = NULL;
+            }
+            headerPos = 0;
+        }
+    }
+
+    const uint64_t end = getTime();
+    if (headerPos != 0) {
+        logg.logMessage("caiman disconnected part way through a response");
+    }
+
+    // Summary
+    const double dataSeconds = lastData > firstData ? (lastData - firstData) / 1e9 : 0.0;
+    const double captureSeconds = (end - start) / 1e9;
+    const uint64_t intervalCount = intervals->getCount();
+    const double mean = intervalCount > 0 ? totals.sumIntervals / intervalCount : 0.0;
+    const double variance = intervalCount > 0 ? totals.sumSquares / intervalCount - mean * mean : 0.0;
+    const uint64_t samples = sampleSize > 0 ? totals.bytes / sampleSize : 0;
+    const uint64_t expectedSamples = (uint64_t) (sampleRate * (double) options.duration);
+    printf("{\"setup_ns\":%llu,\"capture_s\":%.3f,\"bytes\":%llu,\"messages\":%llu,\"mb_per_s\":%.3f,"
+           "\"sample_size\":%d,\"samples\":%llu,\"expected_samples\":%llu,\"partial_sample_bytes\":%llu,"
+           "\"verify_errors\":%llu,\"missing_samples\":%llu,\"gaps\":%llu,\"stalls\":%llu,\"interval_mean_ns\":%.0f,\"jitter_ns\":%.0f,"
+           "\"interval_p50_ns\":%llu,\"interval_p99_ns\":%llu,\"interval_max_ns\":%llu}\n",
+           (unsigned long long) setupNs, captureSeconds, (unsigned long long) totals.bytes, (unsigned long long) totals.messages,
+           dataSeconds > 0 ? totals.bytes / dataSeconds / 1e6 : 0.0, sampleSize, (unsigned long long) samples,
+           (unsigned long long) expectedSamples, (unsigned long long) (sampleSize > 0 ? totals.bytes % sampleSize : 0),
+           (unsigned long long) totals.verifyErrors, (unsigned long long) (sampleSize > 0 ? totals.missingValues * 4 / sampleSize : 0),
+           (unsigned long long) totals.gaps, (unsigned long long) totals.stalls, mean, variance > 0 ? sqrt(variance) : 0.0,
+           (unsigned long long) intervals->getPercentile(50.0), (unsigned long long) intervals->getPercentile(99.0),
+           (unsigned long long) intervals->getMax());
+
+    delete intervals;
+    free(buffer);
+    close(fd);
+    if (outfile != NULL) {
+        fclose(outfile);
+    }
+
+    return 0;
+}
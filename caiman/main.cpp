@@ -19,13 +19,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+
 #if defined(WIN32)
 #include <windows.h>
 
-#define tHANDLE    HANDLE
 #define HOST_CDECL __cdecl
-#define THREAD_CREATE(THREAD_ID, THREAD_FUNC) THREAD_ID = CreateThread(NULL, 0, (unsigned long (__stdcall *)(void *))THREAD_FUNC, NULL, 0, NULL)
-#define THREAD_JOIN(THREAD_ID) WaitForSingleObject(THREAD_ID, INFINITE)
+#define THREAD_EXIT() ExitThread(0)
 
 #define unlink _unlink
 
@@ -35,24 +35,55 @@
 #include <unistd.h>
 #include <pthread.h>
 
-#define tHANDLE    pthread_t
 #define HOST_CDECL
-#define THREAD_CREATE(THREAD_ID, THREAD_FUNC) pthread_create(&THREAD_ID, NULL, THREAD_FUNC, NULL)
-#define THREAD_JOIN(THREAD_ID) pthread_join(THREAD_ID, NULL)
+#define THREAD_EXIT() pthread_exit(NULL)
 
 #endif
 
 #include "EnergyProbe.h"
 #include "Fifo.h"
+#include "FlightRecorder.h"
+#include "Gate.h"
+#include "IioDevice.h"
+#include "Latency.h"
 #include "Logging.h"
+#include "Markers.h"
+#include "MergeDevice.h"
+#include "NetworkDevice.h"
 #include "NiDaq.h"
 #include "OlySocket.h"
 #include "OlyUtility.h"
+#include "Pipeline.h"
+#include "PluginDevice.h"
+#include "Realtime.h"
 #include "SessionData.h"
+#include "Sinks.h"
+#include "Stats.h"
+#include "PowercapDevice.h"
+#include "SyntheticDevice.h"
+#include "Thread.h"
+#include "Trigger.h"
 
 #define DEBUG false
 
 #define DEFAULT_PORT 8081
+#define DEFAULT_STATS_INTERVAL_MS 1000
+#define DEFAULT_SYNTHETIC_RATE 10000
+#define DEFAULT_SYNTHETIC_RESISTANCE 100
+#define DEFAULT_POWERCAP_RATE 1000
+#define DEFAULT_NET_JITTER_MS 20
+// Longest time --net waits for the sender's first packet, except in daemon mode
+#define NET_FIRST_PACKET_TIMEOUT_S 10
+#define DEFAULT_MERGE_LATENCY_MS 100
+// Gives a scale factor of 1, for devices whose values need none
+#define UNSCALED_RESISTANCE 100
+// Samples kept in shared memory by --shm
+#define SHM_SECONDS 10
+#define DEFAULT_POST_TRIGGER 1
+#define DEFAULT_GATE_PRE_MS 100
+#define DEFAULT_GATE_POST_MS 100
+// Largest message used to send a capture kept in RAM
+#define ARENA_SEND_SIZE (1 << 20)
 
 // Commands from Streamline, from StreamlineSetup.h
 enum
@@ -62,7 +93,14 @@ enum
     COMMAND_APC_START = 2,
     COMMAND_APC_STOP = 3,
     COMMAND_DISCONNECT = 4,
-    COMMAND_PING = 5
+    COMMAND_PING = 5,
+    // caiman extension, never sent by Streamline: responds with RESPONSE_XML containing the pipeline counters
+    COMMAND_REQUEST_STATS = 6,
+    // caiman extension: responds with RESPONSE_XML containing the latest value and moving average of each field, or
+    // RESPONSE_NAK if the device does not support it
+    COMMAND_REQUEST_LATEST = 7,
+    // caiman extension: responds with RESPONSE_XML listing the segments passed on by --gate, or RESPONSE_NAK without it
+    COMMAND_REQUEST_SEGMENTS = 8
 };
 
 // Responses to Streamline, from Sender.h
@@ -80,18 +118,86 @@ struct cmdline_t
     int port;
     char* path;
     char* device;
+    char* tap;
+    char* statsFile;
+    char* shm;
+    char* markers;
+    int statsInterval;
+    int preroll;
+    int flightRecorder;
+    int postTrigger;
+    int gatePre;
+    int gatePost;
+    int gateHoldoff;
+    int captureToRam;
+    int syntheticRate;
+    int syntheticChannels;
+    int syntheticFields;
+    int powercapRate;
+    const char *iio;
+    int iioRate;
+    const char *sysfsRoot;
+    const char *devRoot;
+    const char *plugin;
+    const char *pluginArgs;
+    int netPort;
+    bool netTcp;
+    int netJitter;
+    bool merge;
+    bool energyProbe;
+    int mergeRate;
+    int mergeLatency;
+    ThreadPolicy acquisitionPolicy;
+    ThreadPolicy senderPolicy;
+    TriggerCondition trigger;
+    bool hasTrigger;
+    TriggerCondition gate;
+    bool hasGate;
     bool isdaq;
+    bool synthetic;
+    bool powercap;
+    bool serialInit;
+    bool daemon;
+    bool mlock;
+    bool staged;
+    bool record;
+    bool sampleStats;
+    bool latest;
     bool local;
 };
 
 volatile bool gQuit = false;
+// gQuit ends a capture, this ends caiman
+static volatile bool shutdownRequested = false;
+static bool daemonMode = false;
 static bool waitingOnCommand = false;
 static bool waitingOnConnection = false;
 static OlySocket* sock = NULL;
 static FILE * binfile = NULL;
+static FILE * tapfile = NULL;
 static Fifo * fifo = NULL;
-static sem_t senderSem, senderThreadStarted;
-tHANDLE stopThreadID, senderThreadID;
+static FifoSink * fifoSink = NULL;
+static FileSink * fileSink = NULL;
+static StatsSink * statsSink = NULL;
+static ShmSink * shmSink = NULL;
+static MarkerSink * markerSink = NULL;
+static LatestSink * latestSink = NULL;
+static FlightRecorderSink * flightRecorder = NULL;
+static GateSink * gateSink = NULL;
+static ArenaSink * arenaSink = NULL;
+static Device * device = NULL;
+static Pipeline * pipeline = NULL;
+static const char * deviceName = NULL;
+static ThreadPolicy acquisitionPolicy, senderPolicy;
+static sem_t senderSem, senderThreadStarted, sendLock;
+// The stop thread responds to commands while the sender thread is sending data
+static thread_local bool sendLockHeld = false;
+// Device initialization may run while waiting for Streamline to connect. An error there is kept for the main thread to
+// report, as it owns the connection to Streamline.
+static thread_local bool isInitThread = false;
+static std::atomic<bool> initFailed(false);
+static char initError[4096];
+tHANDLE stopThreadID, senderThreadID, acquisitionThreadID, initThreadID;
 
 static void HOST_CDECL sigintHandler(int sig)
 {
@@ -104,12 +210,23 @@ static void HOST_CDECL sigintHandler(int sig)
     }
     logg.logMessage("Caiman is shutting down.");
     beenHere = true;
+    shutdownRequested = true;
     gQuit = true;
     if (waitingOnConnection) {
         exit(1);
     }
 }
 
+#if !defined(WIN32)
+static void triggerHandler(int sig)
+{
+    (void) sig;
+    if (flightRecorder != NULL) {
+        flightRecorder->trigger("signal");
+    }
+}
+#endif
+
 static void writeData(const char* data, uint32_t length, int type)
 {
     // Send data over the socket, sending the type and size first
@@ -119,11 +236,57 @@ static void writeData(const char* data, uint32_t length, int type)
     header[2] = (length >> 8) & 0xff;
     header[3] = (length >> 16) & 0xff;
     header[4] = (length >> 24) & 0xff;
+
+    // A send error calls handleException, which sends the error from this thread
+    const bool lock = !sendLockHeld;
+    if (lock) {
+        sem_wait(&sendLock);
+        sendLockHeld = true;
+    }
     sock->send((char*) &header, sizeof(header));
     sock->send((const char*) data, length);
+    if (lock) {
+        sendLockHeld = false;
+        sem_post(&sendLock);
+    }
 }
 
-[[noreturn]] void handleException()
+static void writeStats()
+{
+    int length;
+    char * const xml = gStats.getXML(&length);
+    writeData(xml, length, RESPONSE_XML);
+    free(xml);
+}
+
+static void writeSegments()
+{
+    if (gateSink == NULL) {
+        writeData(NULL, 0, RESPONSE_NAK);
+        return;
+    }
+
+    int length;
+    char * const xml = gateSink->getXML(&length);
+    writeData(xml, length, RESPONSE_XML);
+    free(xml);
+}
+
+static void writeLatest()
+{
+    if (latestSink == NULL) {
+        writeData(NULL, 0, RESPONSE_NAK);
+        return;
+    }
+
+    char xml[1 << 13];
+    int pos = snprintf(xml, sizeof(xml), "<?xml version=\"1.0\" encoding='UTF-8'?>\n");
+    pos = latestSink->appendXML(xml, pos, sizeof(xml));
+    writeData(xml, pos, RESPONSE_XML);
+}
+
+// Reports error to the user and Streamline, then exits
+[[noreturn]] static void reportError(const char *error)
 {
     static int numExceptions = 0;
     if (numExceptions++ > 0) {
@@ -131,11 +294,13 @@ static void writeData(const char* data, uint32_t length, int type)
         logg.logMessage("Received multiple exceptions, terminating caiman");
         exit(1);
     }
-    fprintf(stderr, "%s", logg.getLastError());
+    // Output any deferred messages leading up to the error first
+    logg.stopAsync();
+    fprintf(stderr, "%s", error);
 
     if (sock) {
         // send the error, regardless of the command sent by Streamline
-        writeData(logg.getLastError(), strlen(logg.getLastError()), RESPONSE_ERROR);
+        writeData(error, strlen(error), RESPONSE_ERROR);
 
         // cannot close the socket before Streamline issues the command, so wait for the command before exiting
         if (waitingOnCommand) {
@@ -150,13 +315,39 @@ static void writeData(const char* data, uint32_t length, int type)
         fclose(binfile);
     }
 
+    // Keep the tap up to the failure so it can be replayed
+    if (tapfile) {
+        fclose(tapfile);
+    }
+
     exit(1);
 }
 
+[[noreturn]] void handleException()
+{
+    if (isInitThread) {
+        // Copied now, before another thread can log an error of its own
+        strncpy(initError, logg.getLastError(), sizeof(initError) - 1);
+        initError[sizeof(initError) - 1] = '\0';
+        initFailed.store(true, std::memory_order_release);
+        THREAD_EXIT();
+    }
+    reportError(logg.getLastError());
+}
+
+// Reports an error from device initialization, once connected to Streamline
+static void checkInitError()
+{
+    if (initFailed.load(std::memory_order_acquire)) {
+        reportError(initError);
+    }
+}
+
 static void* stopThread(void* pVoid)
 {
     (void) pVoid;
     logg.logMessage("Launch stop thread");
+    gStats.registerThread("stop");
     while (!gQuit) {
         // This thread will stall until the APC_STOP or PING command is received over the socket or the socket is disconnected
         unsigned char header[5];
@@ -164,7 +355,8 @@ static void* stopThread(void* pVoid)
         const char type = header[0];
         const int length = (header[1] << 0) | (header[2] << 8) | (header[3] << 16) | (header[4] << 24);
         if (result > 0) {
-            if ((type != COMMAND_APC_STOP) && (type != COMMAND_PING)) {
+            if ((type != COMMAND_APC_STOP) && (type != COMMAND_PING) && (type != COMMAND_REQUEST_STATS) && (type != COMMAND_REQUEST_LATEST) &&
+                (type != COMMAND_REQUEST_SEGMENTS)) {
                 logg.logMessage("INVESTIGATE: Received unknown command type %d", type);
             }
             else {
@@ -174,17 +366,31 @@ static void* stopThread(void* pVoid)
                         logg.logMessage("Stop command received.");
                         gQuit = true;
                     }
-                    else {
+                    else if (type == COMMAND_PING) {
                         // Ping is used to make sure caiman is alive and requires an ACK as the response
                         logg.logMessage("Ping command received.");
                         writeData(NULL, 0, RESPONSE_ACK);
                     }
+                    else if (type == COMMAND_REQUEST_LATEST) {
+                        writeLatest();
+                    }
+                    else if (type == COMMAND_REQUEST_SEGMENTS) {
+                        writeSegments();
+                    }
+                    else {
+                        writeStats();
+                    }
                 }
                 else {
                     logg.logMessage("INVESTIGATE: Received stop command but with length = %d", length);
                 }
             }
         }
+        else {
+            // Streamline has gone away without sending APC_STOP, or the connection was shut down
+            logg.logMessage("Socket disconnected, ending the capture");
+            gQuit = true;
+        }
     }
 
     logg.logMessage("Exit stop thread");
@@ -196,13 +402,19 @@ static void* senderThread(void* pVoid)
     int length = 1;
     (void) pVoid;
 
+    gStats.registerThread("sender");
+    applyThreadPolicy("sender", senderPolicy);
     sem_post(&senderThreadStarted);
 
     while (length > 0 && !gQuit) {
         sem_wait(&senderSem);
         char *data = fifo->read(&length);
         if (data != NULL) {
+            const uint64_t sendStart = getTime();
             writeData(data, length, RESPONSE_APC_DATA);
+            Stats::add(gStats.mSendStallNs, getTime() - sendStart);
+            Stats::add(gStats.mBytesSent, length);
+            gLatency.markSent(length);
             fifo->release();
         }
     }
@@ -211,7 +423,81 @@ static void* senderThread(void* pVoid)
     return 0;
 }
 
-static void streamlineSetup(Device * const device)
+// Writes out a capture kept in RAM, once acquisition has stopped
+static void flushArena()
+{
+    const char * const data = arenaSink->getData();
+    const size_t size = arenaSink->getUsed();
+    logg.logMessage("Writing %llu bytes captured to RAM", (unsigned long long) size);
+
+    if (fileSink != NULL) {
+        fileSink->write(data, size);
+    }
+    if (sock) {
+        for (size_t pos = 0; pos < size; pos += ARENA_SEND_SIZE) {
+            const size_t length = size - pos < ARENA_SEND_SIZE ? size - pos : ARENA_SEND_SIZE;
+            writeData(&data[pos], length, RESPONSE_APC_DATA);
+            Stats::add(gStats.mBytesSent, length);
+        }
+    }
+}
+
+// Adds a sink for the samples that are streamed or recorded, which are the ones gated by --gate
+static void addOutput(Sink *sink)
+{
+    if (gateSink != NULL) {
+        gateSink->addSink(sink);
+    }
+    else {
+        device->addSink(sink);
+    }
+}
+
+static void acquire()
+{
+    // Only this thread gets the policy, so threads created later by the main thread, such as for the next capture in
+    // daemon mode, keep the default scheduling and CPUs
+    applyThreadPolicy("acquisition", acquisitionPolicy);
+    prefaultStack();
+    if (pipeline != NULL) {
+        pipeline->run();
+    }
+    else {
+        while (!gQuit) {
+            device->processBuffer(); // May (now) block thread for up to 1s (NiDaq)
+        }
+    }
+    logg.logMessage("Get data loop finished; caiman is shutting down");
+}
+
+// Runs each capture, started before Streamline connects with pre-roll or once it starts the capture otherwise
+static void* acquisitionThread(void* pVoid)
+{
+    (void) pVoid;
+    gStats.registerThread("acquisition");
+    acquire();
+    return 0;
+}
+
+static void* initThread(void* pVoid)
+{
+    (void) pVoid;
+    isInitThread = true;
+    device->init(deviceName);
+    logg.logMessage("Device initialized");
+    return 0;
+}
+
+static void startSender()
+{
+    if (!THREAD_CREATE(senderThreadID, senderThread, NULL)) {
+        logg.logError("Failed to create sender thread");
+        handleException();
+    }
+}
+
+// Returns true once Streamline starts a capture, or false in daemon mode if Streamline disconnects first
+static bool streamlineSetup()
 {
     bool ready = false;
     unsigned char header[5];
@@ -230,6 +516,10 @@ static void streamlineSetup(Device * const device)
         waitingOnCommand = false;
 
         if (response < 0) {
+            if (daemonMode) {
+                logg.logMessage("Socket disconnected before the capture started");
+                return false;
+            }
             logg.logError("Unexpected socket disconnect");
             handleException();
         }
@@ -263,6 +553,9 @@ static void streamlineSetup(Device * const device)
             data[length] = 0;
         }
 
+        // The command is answered by any error initializing the device
+        checkInitError();
+
         // parse and handle data
         switch (type) {
         case COMMAND_REQUEST_XML: {
@@ -276,6 +569,15 @@ static void streamlineSetup(Device * const device)
         case COMMAND_DELIVER_XML:
             logg.logError("Deliver XML command not supported");
             handleException();
+        case COMMAND_REQUEST_STATS:
+            writeStats();
+            break;
+        case COMMAND_REQUEST_LATEST:
+            writeLatest();
+            break;
+        case COMMAND_REQUEST_SEGMENTS:
+            writeSegments();
+            break;
         case COMMAND_APC_START:
             logg.logMessage("Received apc start request");
             ready = true;
@@ -285,6 +587,12 @@ static void streamlineSetup(Device * const device)
             handleException();
             break;
         case COMMAND_DISCONNECT:
+            if (daemonMode) {
+                // Streamline only wanted the captured XML, wait for the next connection
+                logg.logMessage("Received disconnect command");
+                free(data);
+                return false;
+            }
             // Clear error log so no text appears on console and exit
             logg.logMessage("Received disconnect command");
             logg.logError("");
@@ -297,6 +605,8 @@ static void streamlineSetup(Device * const device)
 
         free(data);
     }
+
+    return true;
 }
 
 static void handleMagicSequence()
@@ -327,9 +637,29 @@ static void handleMagicSequence()
 #define DAQ_HELP ""
 #endif
 
-static void printHelp(const char* const msg, const char* const version_string)
+// Returns input, or merge with input added to it when merging, after appending the fields of the input's sources
+template <class T>
+static Device *addSourceDevice(T *input, const char *name, MergeDevice *merge, int *numSources, int *sourceFields)
+{
+    const int inputSources = input->getNumSources();
+    if (merge != NULL) {
+        merge->addInput(input, name, inputSources);
+    }
+    for (int source = 0; source < inputSources; source++) {
+        sourceFields[*numSources + source] = input->getSourceField(source);
+    }
+    *numSources += inputSources;
+
+    if (merge != NULL) {
+        return merge;
+    }
+    return input;
+}
+
+[[noreturn]] static void printHelp(const char* const msg, const char* const version_string)
 {
-    logg.logError("%s"
+    // Written directly, as the help is longer than the buffer logError formats into
+    fprintf(stderr, "%s"
             "%s\n"
             "At least one channel must be specified, all other parameters are optional:\n"
             "outputpath\tpath to store the apc data; default is current dir\n"
@@ -338,9 +668,59 @@ static void printHelp(const char* const msg, const char* const version_string)
             "-l\t\tenable local mode and disable communication with Streamline\n"
             "%s"
             "-d <device>\tdevice name, eg 'COM4', '/dev/ttyACM0', overrides auto detect\n"
+            "--tap <file>\twrite the raw Energy Probe byte stream to file for use with caiman_replay\n"
+            "--stats-file <file>\tperiodically write pipeline counters to file\n"
+            "--stats-interval <ms>\tperiod between writes to the stats file; default is %d\n"
+            "--sample-stats\tadd the count, minimum, maximum and mean of each field to the stats\n"
+            "--latest\tkeep the latest value and moving average of each field for clients to request\n"
+            "--record\talso write the capture to outputpath while streaming it to Streamline\n"
+            "--markers <path>\treceive labelled markers as datagrams on a Unix socket at path and report the energy between them\n"
+            "--shm <name>\tpublish the last %d seconds of samples in POSIX shared memory, e.g. /caiman\n"
+            "--serial-init\tinitialize the device after Streamline starts the capture rather than while it connects\n"
+            "--daemon\tkeep the device initialized and accept successive captures until interrupted\n"
+            "--flight-recorder <s>\tkeep the last s seconds of samples in memory, writing them with the following samples to a\n"
+            "\t\tnew directory in outputpath on SIGUSR1, a marker from --markers or a --trigger condition\n"
+            "--post-trigger <s>\tseconds of samples after a flight recorder trigger to write; default is %d\n"
+            "--trigger <cond>\ttrigger when a field crosses a level, e.g. p0>1500 for channel 0 power rising above 1500\n"
+            "\t\tor v1<4900 for channel 1 voltage falling below 4900\n"
+            "--gate <cond>\tonly stream or record samples once a field crosses a level, as for --trigger, until it stops\n"
+            "\t\tbeing past the level, listing each stretch of samples in segments.xml\n"
+            "--gate-pre <ms>\tmilliseconds of samples before the gate opens to include; default is %d\n"
+            "--gate-post <ms>\tmilliseconds the gate stays open after the level is no longer passed; default is %d\n"
+            "--gate-holdoff <ms>\tmilliseconds after the gate closes during which crossings are ignored; default is 0\n"
+            "--capture-to-ram <s>\tkeep up to s seconds of samples in memory and write or send them only once the capture stops\n"
+            "--preroll <s>\tstart the device immediately and send up to s seconds of samples from before the capture starts\n"
+            "--synthetic\tgenerate a deterministic sample stream instead of using a device\n"
+            "--synthetic-rate <n>\tsamples per second generated by --synthetic, 0 for as fast as possible; default is %d\n"
+            "--synthetic-channels <n>\tenable channels 0 to n-1 with a resistance of %d milliohm unless given by -r\n"
+            "--synthetic-fields <mask>\tfields generated for each channel: 1 power, 2 voltage, 4 current; default is 7\n"
+            "--powercap\tsample Linux powercap zones, such as Intel RAPL, and hwmon sensors instead of using a device\n"
+            "--powercap-rate <n>\tsamples per second taken by --powercap; default is %d\n"
+            "--iio <device>\tread the voltage, current and power channels of a Linux IIO device, e.g. 'iio:device0' or 'ina226'\n"
+            "--iio-rate <n>\tset the sampling frequency of the --iio device; default keeps the device's own\n"
+            "--sysfs-root <path>\twhere sysfs is mounted, for --powercap and --iio; default is /sys\n"
+            "--dev-root <path>\twhere the --iio device's character device is; default is /dev\n"
+            "--plugin <path>\tread samples from a source plugin, a shared library implementing CaimanPlugin.h\n"
+            "--plugin-args <text>\tconfiguration passed to the --plugin when it is created\n"
+            "--net <udp|tcp>:<port>\treceive samples pushed over the network in the format of CaimanNet.h, e.g. udp:9000\n"
+            "--net-jitter <ms>\tmilliseconds --net waits for late packets before counting them as missing; default is %d\n"
+            "--merge\t\tcombine two or more of --energy-probe or --daq, --powercap, --iio, --plugin and --net, in that order, into one\n"
+            "\t\tcapture\n"
+            "--energy-probe\tinclude the Arm Energy Probe in a --merge capture, on the channels given with -r\n"
+            "--merge-rate <n>\tsamples per second of the --merge capture; default is the fastest device's rate\n"
+            "--merge-latency <ms>\tmilliseconds --merge waits for a device that is behind the others; default is %d\n"
+            "--rt-priority <n>\trun the acquisition thread at real-time priority n, from 1 to 99\n"
+            "--rt-sender-priority <n>\trun the thread sending data to Streamline at real-time priority n\n"
+            "--rt-policy <fifo|rr>\treal-time scheduling policy for the above; default is fifo\n"
+            "--cpu-acquisition <cpus>\trun the acquisition thread on the given CPUs, e.g. '3' or '2,4-5'\n"
+            "--cpu-sender <cpus>\trun the thread sending data to Streamline on the given CPUs\n"
+            "--staged\tread the device on one thread and decode on another, so decoding cannot delay reads\n"
+            "--mlock\t\tlock caiman's memory into RAM so page faults cannot delay acquisition\n"
             "-v/--version\tversion information\n"
-            "-h/--help\tthis help page\n", msg, version_string, DEFAULT_PORT, DAQ_HELP);
-    handleException();
+            "-h/--help\tthis help page\n", msg, version_string, DEFAULT_PORT, DAQ_HELP, DEFAULT_STATS_INTERVAL_MS, SHM_SECONDS, DEFAULT_POST_TRIGGER,
+            DEFAULT_GATE_PRE_MS, DEFAULT_GATE_POST_MS, DEFAULT_SYNTHETIC_RATE, DEFAULT_SYNTHETIC_RESISTANCE,
+            DEFAULT_POWERCAP_RATE, DEFAULT_NET_JITTER_MS, DEFAULT_MERGE_LATENCY_MS);
+    exit(1);
 }
 
 static struct cmdline_t parseCommandLine(int argc, char** argv)
@@ -350,7 +730,51 @@ static struct cmdline_t parseCommandLine(int argc, char** argv)
     cmdline.port = DEFAULT_PORT;
     cmdline.path = NULL;
     cmdline.device = NULL;
+    cmdline.tap = NULL;
+    cmdline.statsFile = NULL;
+    cmdline.shm = NULL;
+    cmdline.markers = NULL;
+    cmdline.statsInterval = DEFAULT_STATS_INTERVAL_MS;
+    cmdline.preroll = 0;
+    cmdline.flightRecorder = 0;
+    cmdline.postTrigger = DEFAULT_POST_TRIGGER;
+    cmdline.hasTrigger = false;
+    cmdline.gatePre = DEFAULT_GATE_PRE_MS;
+    cmdline.gatePost = DEFAULT_GATE_POST_MS;
+    cmdline.gateHoldoff = 0;
+    cmdline.hasGate = false;
+    cmdline.captureToRam = 0;
+    cmdline.syntheticRate = DEFAULT_SYNTHETIC_RATE;
+    cmdline.syntheticChannels = 0;
+    cmdline.syntheticFields = POWER | VOLTAGE | CURRENT;
+    cmdline.powercapRate = DEFAULT_POWERCAP_RATE;
+    cmdline.iio = NULL;
+    cmdline.iioRate = 0;
+    cmdline.sysfsRoot = "/sys";
+    cmdline.devRoot = "/dev";
+    cmdline.plugin = NULL;
+    cmdline.pluginArgs = NULL;
+    cmdline.netPort = 0;
+    cmdline.netTcp = false;
+    cmdline.netJitter = DEFAULT_NET_JITTER_MS;
+    cmdline.merge = false;
+    cmdline.energyProbe = false;
+    cmdline.mergeRate = 0;
+    cmdline.mergeLatency = DEFAULT_MERGE_LATENCY_MS;
+    cmdline.acquisitionPolicy.priority = 0;
+    cmdline.acquisitionPolicy.roundRobin = false;
+    cmdline.acquisitionPolicy.cpus = NULL;
+    cmdline.senderPolicy = cmdline.acquisitionPolicy;
     cmdline.isdaq = false;
+    cmdline.synthetic = false;
+    cmdline.powercap = false;
+    cmdline.serialInit = false;
+    cmdline.daemon = false;
+    cmdline.mlock = false;
+    cmdline.staged = false;
+    cmdline.record = false;
+    cmdline.sampleStats = false;
+    cmdline.latest = false;
     cmdline.local = false;
 
     {
@@ -420,6 +844,317 @@ static struct cmdline_t parseCommandLine(int argc, char** argv)
             }
             cmdline.device = argv[i];
         }
+        else if (strcmp(argv[i], "--tap") == 0) {
+            if (++i == argc) {
+                logg.logError("No file name provided on command line after --tap option");
+                handleException();
+            }
+            cmdline.tap = argv[i];
+        }
+        else if (strcmp(argv[i], "--stats-file") == 0) {
+            if (++i == argc) {
+                logg.logError("No file name provided on command line after --stats-file option");
+                handleException();
+            }
+            cmdline.statsFile = argv[i];
+        }
+        else if (strcmp(argv[i], "--stats-interval") == 0) {
+            if (++i == argc) {
+                logg.logError("No interval provided on command line after --stats-interval option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.statsInterval, argv[i], 10) || cmdline.statsInterval <= 0) {
+                logg.logError("Stats interval must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--sample-stats") == 0) {
+            cmdline.sampleStats = true;
+        }
+        else if (strcmp(argv[i], "--latest") == 0) {
+            cmdline.latest = true;
+        }
+        else if (strcmp(argv[i], "--record") == 0) {
+            cmdline.record = true;
+        }
+        else if (strcmp(argv[i], "--flight-recorder") == 0) {
+            if (++i == argc) {
+                logg.logError("No duration provided on command line after --flight-recorder option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.flightRecorder, argv[i], 10) || cmdline.flightRecorder <= 0) {
+                logg.logError("Flight recorder duration must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--post-trigger") == 0) {
+            if (++i == argc) {
+                logg.logError("No duration provided on command line after --post-trigger option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.postTrigger, argv[i], 10) || cmdline.postTrigger < 0) {
+                logg.logError("Post-trigger duration must be a non-negative integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--trigger") == 0) {
+            if (++i == argc) {
+                logg.logError("No condition provided on command line after --trigger option");
+                handleException();
+            }
+            if (!cmdline.trigger.parse(argv[i])) {
+                logg.logError("Invalid trigger condition '%s', expected e.g. p0>1500 or v1<4900", argv[i]);
+                handleException();
+            }
+            cmdline.hasTrigger = true;
+        }
+        else if (strcmp(argv[i], "--gate") == 0) {
+            if (++i == argc) {
+                logg.logError("No condition provided on command line after --gate option");
+                handleException();
+            }
+            if (!cmdline.gate.parse(argv[i])) {
+                logg.logError("Invalid gate condition '%s', expected e.g. p0>1500 or v1<4900", argv[i]);
+                handleException();
+            }
+            cmdline.hasGate = true;
+        }
+        else if (strcmp(argv[i], "--gate-pre") == 0 || strcmp(argv[i], "--gate-post") == 0 || strcmp(argv[i], "--gate-holdoff") == 0) {
+            int &value = strcmp(argv[i], "--gate-pre") == 0 ? cmdline.gatePre : strcmp(argv[i], "--gate-post") == 0 ? cmdline.gatePost : cmdline.gateHoldoff;
+            if (++i == argc) {
+                logg.logError("No duration provided on command line after %s option", argv[i - 1]);
+                handleException();
+            }
+            if (!stringToInt(&value, argv[i], 10) || value < 0) {
+                logg.logError("The %s duration must be a non-negative number of milliseconds", argv[i - 1]);
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--capture-to-ram") == 0) {
+            if (++i == argc) {
+                logg.logError("No duration provided on command line after --capture-to-ram option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.captureToRam, argv[i], 10) || cmdline.captureToRam <= 0) {
+                logg.logError("Capture to RAM duration must be a positive number of seconds");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--markers") == 0) {
+            if (++i == argc) {
+                logg.logError("No socket path provided on command line after --markers option");
+                handleException();
+            }
+            cmdline.markers = argv[i];
+        }
+        else if (strcmp(argv[i], "--shm") == 0) {
+            if (++i == argc) {
+                logg.logError("No name provided on command line after --shm option");
+                handleException();
+            }
+            cmdline.shm = argv[i];
+        }
+        else if (strcmp(argv[i], "--daemon") == 0) {
+            cmdline.daemon = true;
+        }
+        else if (strcmp(argv[i], "--serial-init") == 0) {
+            cmdline.serialInit = true;
+        }
+        else if (strcmp(argv[i], "--preroll") == 0) {
+            if (++i == argc) {
+                logg.logError("No duration provided on command line after --preroll option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.preroll, argv[i], 10) || cmdline.preroll <= 0) {
+                logg.logError("Pre-roll must be a positive number of seconds");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--synthetic") == 0) {
+            cmdline.synthetic = true;
+        }
+        else if (strcmp(argv[i], "--synthetic-rate") == 0) {
+            if (++i == argc) {
+                logg.logError("No rate provided on command line after --synthetic-rate option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.syntheticRate, argv[i], 10) || cmdline.syntheticRate < 0) {
+                logg.logError("Synthetic rate must be a non-negative integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--synthetic-channels") == 0) {
+            if (++i == argc) {
+                logg.logError("No channel count provided on command line after --synthetic-channels option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.syntheticChannels, argv[i], 10) || cmdline.syntheticChannels <= 0 ||
+                cmdline.syntheticChannels > MAX_CHANNELS) {
+                logg.logError("Synthetic channel count must be between 1 and %d", MAX_CHANNELS);
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--synthetic-fields") == 0) {
+            if (++i == argc) {
+                logg.logError("No field mask provided on command line after --synthetic-fields option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.syntheticFields, argv[i], 0) || cmdline.syntheticFields <= 0 ||
+                (cmdline.syntheticFields & ~(POWER | VOLTAGE | CURRENT)) != 0) {
+                logg.logError("Synthetic field mask must be a combination of 1 (power), 2 (voltage) and 4 (current)");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--powercap") == 0) {
+            cmdline.powercap = true;
+        }
+        else if (strcmp(argv[i], "--powercap-rate") == 0) {
+            if (++i == argc) {
+                logg.logError("No rate provided on command line after --powercap-rate option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.powercapRate, argv[i], 10) || cmdline.powercapRate <= 0) {
+                logg.logError("Powercap rate must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--sysfs-root") == 0) {
+            if (++i == argc) {
+                logg.logError("No path provided on command line after --sysfs-root option");
+                handleException();
+            }
+            cmdline.sysfsRoot = argv[i];
+        }
+        else if (strcmp(argv[i], "--iio") == 0) {
+            if (++i == argc) {
+                logg.logError("No device provided on command line after --iio option");
+                handleException();
+            }
+            cmdline.iio = argv[i];
+        }
+        else if (strcmp(argv[i], "--iio-rate") == 0) {
+            if (++i == argc) {
+                logg.logError("No rate provided on command line after --iio-rate option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.iioRate, argv[i], 10) || cmdline.iioRate <= 0) {
+                logg.logError("IIO rate must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--dev-root") == 0) {
+            if (++i == argc) {
+                logg.logError("No path provided on command line after --dev-root option");
+                handleException();
+            }
+            cmdline.devRoot = argv[i];
+        }
+        else if (strcmp(argv[i], "--plugin") == 0) {
+            if (++i == argc) {
+                logg.logError("No path provided on command line after --plugin option");
+                handleException();
+            }
+            cmdline.plugin = argv[i];
+        }
+        else if (strcmp(argv[i], "--plugin-args") == 0) {
+            if (++i == argc) {
+                logg.logError("No text provided on command line after --plugin-args option");
+                handleException();
+            }
+            cmdline.pluginArgs = argv[i];
+        }
+        else if (strcmp(argv[i], "--net") == 0) {
+            if (++i == argc) {
+                logg.logError("No protocol and port provided on command line after --net option");
+                handleException();
+            }
+            if (strncmp(argv[i], "udp:", 4) == 0 || strncmp(argv[i], "tcp:", 4) == 0) {
+                cmdline.netTcp = argv[i][0] == 't';
+                if (!stringToInt(&cmdline.netPort, argv[i] + 4, 10) || cmdline.netPort <= 0 || cmdline.netPort > 65535) {
+                    cmdline.netPort = 0;
+                }
+            }
+            if (cmdline.netPort == 0) {
+                logg.logError("Network source must be udp:<port> or tcp:<port>, e.g. udp:9000");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--net-jitter") == 0) {
+            if (++i == argc) {
+                logg.logError("No time provided on command line after --net-jitter option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.netJitter, argv[i], 10) || cmdline.netJitter < 0) {
+                logg.logError("Network jitter must be a non-negative integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--merge") == 0) {
+            cmdline.merge = true;
+        }
+        else if (strcmp(argv[i], "--energy-probe") == 0) {
+            cmdline.energyProbe = true;
+        }
+        else if (strcmp(argv[i], "--merge-rate") == 0) {
+            if (++i == argc) {
+                logg.logError("No rate provided on command line after --merge-rate option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.mergeRate, argv[i], 10) || cmdline.mergeRate <= 0) {
+                logg.logError("Merge rate must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--merge-latency") == 0) {
+            if (++i == argc) {
+                logg.logError("No time provided on command line after --merge-latency option");
+                handleException();
+            }
+            if (!stringToInt(&cmdline.mergeLatency, argv[i], 10) || cmdline.mergeLatency < 0) {
+                logg.logError("Merge latency must be a non-negative integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--rt-priority") == 0 || strcmp(argv[i], "--rt-sender-priority") == 0) {
+            ThreadPolicy &policy = strcmp(argv[i], "--rt-priority") == 0 ? cmdline.acquisitionPolicy : cmdline.senderPolicy;
+            if (++i == argc) {
+                logg.logError("No priority provided on command line after %s option", argv[i - 1]);
+                handleException();
+            }
+            if (!stringToInt(&policy.priority, argv[i], 10) || policy.priority < 1 || policy.priority > 99) {
+                logg.logError("Real-time priority must be between 1 and 99");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "--rt-policy") == 0) {
+            if (++i == argc) {
+                logg.logError("No policy provided on command line after --rt-policy option");
+                handleException();
+            }
+            if (strcmp(argv[i], "fifo") != 0 && strcmp(argv[i], "rr") != 0) {
+                logg.logError("Real-time policy must be fifo or rr");
+                handleException();
+            }
+            cmdline.acquisitionPolicy.roundRobin = cmdline.senderPolicy.roundRobin = strcmp(argv[i], "rr") == 0;
+        }
+        else if (strcmp(argv[i], "--cpu-acquisition") == 0 || strcmp(argv[i], "--cpu-sender") == 0) {
+            ThreadPolicy &policy = strcmp(argv[i], "--cpu-acquisition") == 0 ? cmdline.acquisitionPolicy : cmdline.senderPolicy;
+            if (++i == argc) {
+                logg.logError("No CPUs provided on command line after %s option", argv[i - 1]);
+                handleException();
+            }
+            if (!isValidCpuList(argv[i])) {
+                logg.logError("CPUs must be a list of CPU numbers or ranges below %d, e.g. '3' or '2,4-5'", MAX_CPUS);
+                handleException();
+            }
+            policy.cpus = argv[i];
+        }
+        else if (strcmp(argv[i], "--mlock") == 0) {
+            cmdline.mlock = true;
+        }
+        else if (strcmp(argv[i], "--staged") == 0) {
+            cmdline.staged = true;
+        }
         else if (strcmp(argv[i], "--daq") == 0) {
 #if defined(SUPPORT_DAQ)
             cmdline.isdaq = true;
@@ -457,9 +1192,18 @@ int HOST_CDECL main(int argc, char *argv[])
     char* binaryPath = (char*) malloc(CAIMAN_PATH_MAX + 1);
 
     logg.setDebug(DEBUG); // Set up global thread-safe logging
+    logg.startAsync(); // Format and output messages from the acquisition thread in the background
 
     // Parse the command line parameters
     struct cmdline_t cmdline = parseCommandLine(argc, argv);
+    acquisitionPolicy = cmdline.acquisitionPolicy;
+    senderPolicy = cmdline.senderPolicy;
+
+    if (sem_init(&sendLock, 0, 1)) {
+        logg.logError("sem_init() failed");
+        handleException();
+    }
+    gStats.registerThread("main");
 
 #if !defined(WIN32)
     if (geteuid() == 0) {
@@ -490,32 +1234,234 @@ int HOST_CDECL main(int argc, char *argv[])
 
     // Create a string representing the path to the binary output file and open it
     snprintf(binaryPath, CAIMAN_PATH_MAX, "%s0000000000", outputPath);
-    if (cmdline.local) {
+    if (cmdline.flightRecorder > 0) {
+        if (cmdline.record || cmdline.daemon || cmdline.preroll > 0) {
+            logg.logError("The --flight-recorder option cannot be used with --record, --daemon or --preroll");
+            handleException();
+        }
+        // Nothing is sent to Streamline
+        cmdline.local = true;
+    }
+    else if (cmdline.hasTrigger) {
+        logg.logError("The --trigger option requires --flight-recorder");
+        handleException();
+    }
+    if (cmdline.hasGate && (cmdline.flightRecorder > 0 || cmdline.preroll > 0)) {
+        logg.logError("The --gate option cannot be used with --flight-recorder or --preroll");
+        handleException();
+    }
+    if (cmdline.captureToRam > 0 && (cmdline.flightRecorder > 0 || cmdline.preroll > 0)) {
+        logg.logError("The --capture-to-ram option cannot be used with --flight-recorder or --preroll");
+        handleException();
+    }
+    if (cmdline.record && (cmdline.local || cmdline.daemon)) {
+        logg.logError("The --record option cannot be used with -l or --daemon");
+        handleException();
+    }
+    if ((cmdline.local && cmdline.flightRecorder == 0) || cmdline.record) {
         if ((binfile = fopen(binaryPath, "wb")) == 0) {
             logg.logError("Unable to open output file: %s0000000000\nPlease check write permissions on this file.", outputPath);
             handleException();
         }
+        fileSink = new FileSink(binfile);
     }
-    else {
+    if (!cmdline.local) {
         if (sem_init(&senderSem, 0, 0) || sem_init(&senderThreadStarted, 0, 0)) {
             logg.logError("sem_init() failed");
             handleException();
         }
         fifo = new Fifo(1 << 15, 1 << 20, &senderSem);
-        THREAD_CREATE(senderThreadID, senderThread);
-        if (!senderThreadID) {
-            logg.logError("Failed to create sender thread");
+        fifoSink = new FifoSink(fifo);
+        gStats.setFifo(fifo);
+        startSender();
+    }
+
+    if (cmdline.statsFile != NULL) {
+        gStats.startFileWriter(cmdline.statsFile, cmdline.statsInterval);
+    }
+
+    const int numSourceDevices = (cmdline.powercap ? 1 : 0) + (cmdline.iio != NULL ? 1 : 0) + (cmdline.plugin != NULL ? 1 : 0) +
+            (cmdline.netPort != 0 ? 1 : 0);
+    // An Energy Probe or DAQ is configured with -r, so at most one is merged and its channels come first
+    const int numShuntDevices = (cmdline.energyProbe ? 1 : 0) + (cmdline.isdaq ? 1 : 0);
+    if ((cmdline.synthetic ? 1 : 0) + (cmdline.merge && numSourceDevices + numShuntDevices > 0 ? 1 : numSourceDevices + numShuntDevices) > 1) {
+        logg.logError("Only one of the --synthetic, --daq, --powercap, --iio, --plugin and --net options can be used, unless --merge\n"
+                      "combines all but the first");
+        handleException();
+    }
+    if (cmdline.energyProbe && !cmdline.merge) {
+        logg.logError("The --energy-probe option requires --merge, as the Energy Probe is used by default otherwise");
+        handleException();
+    }
+    if (cmdline.merge && numShuntDevices > 1) {
+        logg.logError("Only one of the --energy-probe and --daq options can be used with --merge");
+        handleException();
+    }
+    if (cmdline.merge && numSourceDevices + numShuntDevices < 2) {
+        logg.logError("The --merge option requires at least two of --energy-probe or --daq, --powercap, --iio, --plugin and --net");
+        handleException();
+    }
+    if (!cmdline.merge && (cmdline.mergeRate != 0 || cmdline.mergeLatency != DEFAULT_MERGE_LATENCY_MS)) {
+        logg.logError("The --merge-rate and --merge-latency options require --merge");
+        handleException();
+    }
+    if (cmdline.synthetic) {
+        for (int channel = 0; channel < cmdline.syntheticChannels; channel++) {
+            if (gSessionData.mResistors[channel] <= 0) {
+                gSessionData.mResistors[channel] = DEFAULT_SYNTHETIC_RESISTANCE;
+            }
+        }
+    }
+    else if (cmdline.syntheticChannels > 0 || cmdline.syntheticFields != (POWER | VOLTAGE | CURRENT)) {
+        logg.logError("The --synthetic-channels and --synthetic-fields options require --synthetic");
+        handleException();
+    }
+
+    // Devices that find their own sources decide which channels there are, so they are created before the channels are
+    // checked. Each source is one channel with a single field; merged devices' channels follow one another.
+    Device *sourceDevice = NULL;
+    NetworkDevice *network = NULL;
+    MergeDevice *merge = NULL;
+    int numSources = 0;
+    int sourceFields[MAX_CHANNELS];
+    // Channels of a merged Energy Probe or DAQ, up to the last given a resistance with -r
+    int numShuntChannels = 0;
+    if (cmdline.merge) {
+        merge = new MergeDevice(outputPath, cmdline.mergeRate, cmdline.mergeLatency);
+    }
+    if (cmdline.merge && numShuntDevices > 0) {
+        for (int channel = 0; channel < MAX_CHANNELS; channel++) {
+            if (gSessionData.mResistors[channel] > 0) {
+                numShuntChannels = channel + 1;
+            }
+        }
+        if (numShuntChannels == 0) {
+            logg.logError("No channels enabled for the %s, please ensure resistance values are set", cmdline.isdaq ? "DAQ" : "Energy Probe");
+            handleException();
+        }
+        Device *shuntDevice;
+        if (cmdline.isdaq) {
+#if defined(SUPPORT_DAQ)
+            shuntDevice = new NiDaq(outputPath);
+#else
+            logg.logError("National Instruments DAQ is not supported in this build.");
             handleException();
+#endif
+        }
+        else {
+            shuntDevice = new EnergyProbe(outputPath);
+        }
+        merge->addInput(shuntDevice, cmdline.isdaq ? "daq" : "energy_probe", numShuntChannels);
+        for (int channel = 0; channel < numShuntChannels; channel++) {
+            sourceFields[channel] = POWER | VOLTAGE | CURRENT;
+        }
+        numSources = numShuntChannels;
+        sourceDevice = merge;
+    }
+    if (cmdline.powercap) {
+        sourceDevice = addSourceDevice(new PowercapDevice(outputPath, cmdline.sysfsRoot, cmdline.powercapRate), "powercap", merge,
+                                       &numSources, sourceFields);
+    }
+    if (cmdline.iio != NULL) {
+        sourceDevice = addSourceDevice(new IioDevice(outputPath, cmdline.sysfsRoot, cmdline.devRoot, cmdline.iio, cmdline.iioRate), "iio",
+                                       merge, &numSources, sourceFields);
+    }
+    if (cmdline.plugin != NULL) {
+        sourceDevice = addSourceDevice(new PluginDevice(outputPath, cmdline.plugin, cmdline.pluginArgs), "plugin", merge, &numSources,
+                                       sourceFields);
+    }
+    if (cmdline.netPort != 0) {
+        network = new NetworkDevice(outputPath, cmdline.netTcp, cmdline.netPort, cmdline.netJitter);
+        // A daemon waits for as long as the sender takes to start
+        network->waitForFirstPacket(cmdline.daemon ? 0 : NET_FIRST_PACKET_TIMEOUT_S);
+        gStats.setNetwork(network);
+        sourceDevice = addSourceDevice(network, "net", merge, &numSources, sourceFields);
+    }
+    if (!cmdline.powercap && cmdline.powercapRate != DEFAULT_POWERCAP_RATE) {
+        logg.logError("The --powercap-rate option requires --powercap");
+        handleException();
+    }
+    if (cmdline.iio == NULL && cmdline.iioRate != 0) {
+        logg.logError("The --iio-rate option requires --iio");
+        handleException();
+    }
+    if (cmdline.plugin == NULL && cmdline.pluginArgs != NULL) {
+        logg.logError("The --plugin-args option requires --plugin");
+        handleException();
+    }
+    if (cmdline.netPort == 0 && cmdline.netJitter != DEFAULT_NET_JITTER_MS) {
+        logg.logError("The --net-jitter option requires --net");
+        handleException();
+    }
+    if (numShuntChannels > 0) {
+        // Every source of the other merged devices follows the channels of the Energy Probe or DAQ
+        for (int channel = numShuntChannels; channel < numSources; channel++) {
+            gSessionData.mResistors[channel] = UNSCALED_RESISTANCE;
+        }
+    }
+    else if (sourceDevice != NULL) {
+        bool channelsGiven = false;
+        for (int channel = 0; channel < MAX_CHANNELS; channel++) {
+            if (gSessionData.mResistors[channel] > 0 && channel >= numSources) {
+                logg.logError("Channel %d was given but there are only %d sources", channel, numSources);
+                handleException();
+            }
+            channelsGiven = channelsGiven || gSessionData.mResistors[channel] > 0;
+        }
+        // Every source is used unless some are chosen with -r. Values are already in the usual units, so none are scaled.
+        for (int channel = 0; channel < MAX_CHANNELS; channel++) {
+            if (gSessionData.mResistors[channel] > 0 || (!channelsGiven && channel < numSources)) {
+                gSessionData.mResistors[channel] = UNSCALED_RESISTANCE;
+            }
         }
     }
 
     // Verify data
     gSessionData.compileData();
+    if (cmdline.synthetic) {
+        gSessionData.restrictFields(cmdline.syntheticFields);
+    }
+    else if (sourceDevice != NULL) {
+        int channelFieldMasks[MAX_CHANNELS];
+        for (int channel = 0; channel < MAX_CHANNELS; channel++) {
+            channelFieldMasks[channel] = channel < numSources ? sourceFields[channel] : 0;
+        }
+        gSessionData.restrictFields(channelFieldMasks);
+    }
 
-    Device *device;
-    if (cmdline.isdaq) {
+    if (cmdline.tap != NULL) {
+        if (cmdline.isdaq || cmdline.synthetic || sourceDevice != NULL) {
+            logg.logError("The --tap option is only supported with the Arm Energy Probe");
+            handleException();
+        }
+        if ((tapfile = fopen(cmdline.tap, "wb")) == NULL) {
+            logg.logError("Unable to open tap file: %s\nPlease check write permissions on this file.", cmdline.tap);
+            handleException();
+        }
+    }
+
+    if (cmdline.preroll > 0 && (cmdline.local || cmdline.markers != NULL)) {
+        logg.logError("The --preroll option cannot be used in local mode or with --markers");
+        handleException();
+    }
+
+    if (cmdline.daemon) {
+        if (cmdline.local || cmdline.preroll > 0 || cmdline.tap != NULL) {
+            logg.logError("The --daemon option cannot be used with -l, --preroll or --tap");
+            handleException();
+        }
+        daemonMode = true;
+    }
+
+    if (cmdline.synthetic) {
+        device = new SyntheticDevice(outputPath, cmdline.syntheticRate);
+    }
+    else if (sourceDevice != NULL) {
+        device = sourceDevice;
+    }
+    else if (cmdline.isdaq) {
 #if defined(SUPPORT_DAQ)
-        device = new NiDaq(outputPath, binfile, fifo);
+        device = new NiDaq(outputPath);
 #else
         // Intentionally redundant: CLI blocks isdaq if !SUPPORT_DAQ
         logg.logError("National Instruments DAQ is not supported in this build.");
@@ -523,66 +1469,291 @@ int HOST_CDECL main(int argc, char *argv[])
 #endif
     }
     else {
-        device = new EnergyProbe(outputPath, binfile, fifo);
+        EnergyProbe *energyProbe = new EnergyProbe(outputPath);
+        energyProbe->setTapFile(tapfile);
+        device = energyProbe;
     }
 
     device->prepareChannels();
-
-    // Create a socket as long as local was not specified
-    if (!cmdline.local) {
-        waitingOnConnection = true;
-        logg.logMessage("Waiting on connection...");
-        OlyServerSocket server(cmdline.port);
-        sock = new OlySocket(server.acceptConnection());
-        server.closeServerSocket();
-        waitingOnConnection = false;
-        handleMagicSequence();
+    if (merge != NULL) {
+        gStats.setMerge(merge);
     }
 
-    if (sock) {
-        // Wait for start command from Streamline
-        streamlineSetup(device);
+    // The stream comes first so the other sinks add as little as possible to its latency
+    if (cmdline.hasGate) {
+        if (device->getDataSize() != (int) sizeof(int32_t)) {
+            logg.logError("The --gate option is not supported with this device");
+            handleException();
+        }
+        if (!cmdline.gate.resolve(device->getNumFields())) {
+            logg.logError("The gate condition %s refers to a field that is not captured", cmdline.gate.getSpec());
+            handleException();
+        }
+        gateSink = new GateSink(&cmdline.gate, device->getSampleRate(), device->getNumFields(), cmdline.gatePre, cmdline.gatePost,
+                                cmdline.gateHoldoff);
+        device->addSink(gateSink);
+        gStats.setGate(gateSink);
+    }
+    // The stream and the recording are written from the arena once the capture stops
+    if (cmdline.captureToRam > 0) {
+        const size_t capacity = (size_t) cmdline.captureToRam * device->getSampleRate() * device->getNumFields() * device->getDataSize();
+        arenaSink = new ArenaSink(capacity);
+        addOutput(arenaSink);
+        gStats.setArena(arenaSink);
+    }
+    else {
+        if (fifoSink != NULL) {
+            addOutput(fifoSink);
+        }
+        if (fileSink != NULL) {
+            addOutput(fileSink);
+        }
+    }
 
-        // Create stop thread
-        THREAD_CREATE(stopThreadID, stopThread);
-        if (!stopThreadID) {
-            logg.logError("Failed to create stop thread");
+    if (cmdline.sampleStats) {
+        if (device->getDataSize() != (int) sizeof(int32_t)) {
+            logg.logError("The --sample-stats option is not supported with this device");
+            handleException();
+        }
+        statsSink = new StatsSink(device->getNumFields());
+        device->addSink(statsSink);
+        gStats.setSampleStats(statsSink);
+    }
+    if (cmdline.shm != NULL) {
+        shmSink = new ShmSink(cmdline.shm, device->getSampleRate(), device->getNumFields(), device->getDataSize(), SHM_SECONDS);
+        device->addSink(shmSink);
+    }
+    // The latest values are also published in the shared memory
+    if (cmdline.latest && device->getDataSize() != (int) sizeof(int32_t)) {
+        logg.logError("The --latest option is not supported with this device");
+        handleException();
+    }
+    if ((cmdline.latest || cmdline.shm != NULL) && device->getDataSize() == (int) sizeof(int32_t)) {
+        latestSink = new LatestSink(device->getSampleRate(), device->getNumFields(),
+                                    shmSink != NULL ? shmSink->getLatestValues() : NULL);
+        device->addSink(latestSink);
+    }
+    if (cmdline.markers != NULL) {
+        if (device->getDataSize() != (int) sizeof(int32_t)) {
+            logg.logError("The --markers option is not supported with this device");
+            handleException();
+        }
+        markerSink = new MarkerSink(cmdline.markers, device->getSampleRate(), device->getNumFields());
+        device->addSink(markerSink);
+        gStats.setMarkers(markerSink);
+    }
+    char *flightXML = NULL;
+    if (cmdline.flightRecorder > 0) {
+        if (device->getDataSize() != (int) sizeof(int32_t)) {
+            logg.logError("The --flight-recorder option is not supported with this device");
+            handleException();
+        }
+        if (cmdline.hasTrigger && !cmdline.trigger.resolve(device->getNumFields())) {
+            logg.logError("The trigger condition %s refers to a field that is not captured", cmdline.trigger.getSpec());
             handleException();
         }
+        int length;
+        flightXML = device->getXML(&length);
+        flightRecorder = new FlightRecorderSink(outputPath, flightXML, device->getSampleRate(), device->getNumFields(),
+                                                cmdline.flightRecorder, cmdline.postTrigger);
+        if (cmdline.hasTrigger) {
+            flightRecorder->setCondition(&cmdline.trigger);
+        }
+        // Listed after the markers, so a marker triggers in the same write it is stamped in
+        if (markerSink != NULL) {
+            flightRecorder->setMarkers(markerSink);
+        }
+        device->addSink(flightRecorder);
+        gStats.setFlightRecorder(flightRecorder);
+#if !defined(WIN32)
+        signal(SIGUSR1, &triggerHandler);
+#endif
+    }
 
-        // Wait until thread has started
-        sem_wait(&senderThreadStarted);
+    if (cmdline.staged) {
+        pipeline = new Pipeline(device, PIPELINE_BLOCKS);
+        gStats.setPipeline(pipeline);
     }
-    else {
-        device->writeXML();
+
+    // The fifo and device buffers now exist, so all of them are made resident
+    if (cmdline.mlock) {
+        lockMemory();
     }
 
-    device->init(cmdline.device);
+    if (cmdline.preroll > 0) {
+        // Samples are kept until Streamline starts the capture
+        device->startPreroll(cmdline.preroll);
+        device->init(cmdline.device);
+        device->start();
+        if (!THREAD_CREATE(acquisitionThreadID, acquisitionThread, NULL)) {
+            logg.logError("Failed to create acquisition thread");
+            handleException();
+        }
+    }
 
-    // Start the device
-    device->start();
+    // Initialize the device while Streamline connects and configures the capture
+    bool parallelInit = !cmdline.local && cmdline.preroll == 0 && !cmdline.serialInit;
+    if (parallelInit) {
+        deviceName = cmdline.device;
+        if (!THREAD_CREATE(initThreadID, initThread, NULL)) {
+            // initThreadID is not valid, so initialize on this thread once the capture starts
+            logg.logMessage("Failed to create device initialization thread, initializing serially");
+            parallelInit = false;
+        }
+    }
 
-    // Get the data
-    while (!gQuit) {
-        device->processBuffer(); // May (now) block thread for up to 1s (NiDaq)
+    // Create a socket as long as local was not specified; in daemon mode it accepts each capture in turn
+    OlyServerSocket *server = NULL;
+    if (!cmdline.local) {
+        server = new OlyServerSocket(cmdline.port);
     }
-    logg.logMessage("Get data loop finished; caiman is shutting down");
+    bool initialized = cmdline.preroll > 0;
+
+    do {
+        if (server != NULL) {
+            waitingOnConnection = true;
+            logg.logMessage("Waiting on connection...");
+            sock = new OlySocket(server->acceptConnection());
+            if (!daemonMode) {
+                server->closeServerSocket();
+            }
+            waitingOnConnection = false;
+            handleMagicSequence();
+        }
 
-    device->stop();
+        if (sock) {
+            // Wait for start command from Streamline
+            if (!streamlineSetup()) {
+                delete sock;
+                sock = NULL;
+                continue;
+            }
 
-    // Shutting down the connection should break the stop thread which is stalling on the socket recv() function
-    if (sock) {
-        fifo->write(0);
-        THREAD_JOIN(senderThreadID);
-        sock->shutdownConnection();
-        THREAD_JOIN(stopThreadID);
+            // Create stop thread
+            if (!THREAD_CREATE(stopThreadID, stopThread, NULL)) {
+                logg.logError("Failed to create stop thread");
+                handleException();
+            }
+
+            // Wait until thread has started
+            sem_wait(&senderThreadStarted);
+        }
+        if (binfile != NULL) {
+            device->writeXML();
+        }
+
+        if (cmdline.preroll > 0) {
+            device->flushPreroll();
+            THREAD_JOIN(acquisitionThreadID);
+        }
+        else {
+            if (initialized) {
+                logg.logMessage("Device already initialized");
+            }
+            else if (parallelInit) {
+                const uint64_t waitStart = getTime();
+                THREAD_JOIN(initThreadID);
+                checkInitError();
+                logg.logMessage("Waited %llu ns for device initialization to complete", (unsigned long long) (getTime() - waitStart));
+            }
+            else {
+                device->init(cmdline.device);
+            }
+            initialized = true;
+
+            // Start the device
+            device->start();
+
+            // Get the data
+            if (!THREAD_CREATE(acquisitionThreadID, acquisitionThread, NULL)) {
+                logg.logError("Failed to create acquisition thread");
+                handleException();
+            }
+            THREAD_JOIN(acquisitionThreadID);
+        }
+
+        if (daemonMode) {
+            device->pause();
+        }
+        else {
+            device->stop();
+        }
+
+        // Shutting down the connection should break the stop thread which is stalling on the socket recv() function
+        if (sock) {
+            fifo->write(0);
+            THREAD_JOIN(senderThreadID);
+            if (arenaSink != NULL) {
+                flushArena();
+            }
+            sock->shutdownConnection();
+            THREAD_JOIN(stopThreadID);
+        }
+
+        if (daemonMode) {
+            delete sock;
+            sock = NULL;
+            if (!shutdownRequested) {
+                // Get ready for the next capture
+                fifo->reset();
+                device->resetOutput();
+                gLatency.resetStream();
+                gQuit = false;
+                startSender();
+            }
+        }
+    } while (daemonMode && !shutdownRequested);
+
+    if (daemonMode) {
+        device->stop();
     }
+    delete server;
 
     if (binfile) {
+        // A streamed capture was recorded as it was sent
+        if (arenaSink != NULL && sock == NULL) {
+            flushArena();
+        }
         fclose(binfile);
+        // Record the markers and segments alongside the capture
+        if (markerSink != NULL) {
+            markerSink->writeXML(outputPath);
+        }
+        if (gateSink != NULL) {
+            gateSink->writeXML(outputPath);
+        }
     }
+    if (tapfile) {
+        fclose(tapfile);
+    }
+    if (flightRecorder != NULL) {
+        flightRecorder->finish();
+    }
+    gStats.stopFileWriter();
+    gLatency.printSummary();
+    gStats.setPipeline(NULL);
+    gStats.setSampleStats(NULL);
+    gStats.setMarkers(NULL);
+    gStats.setFlightRecorder(NULL);
+    gStats.setGate(NULL);
+    gStats.setArena(NULL);
+    gStats.setNetwork(NULL);
+    gStats.setMerge(NULL);
+    delete pipeline;
     delete device;
+    delete fifoSink;
+    delete fileSink;
+    delete statsSink;
+    delete shmSink;
+    delete markerSink;
+    delete latestSink;
+    delete flightRecorder;
+    delete gateSink;
+    delete arenaSink;
+    free(flightXML);
     delete sock;
 
+    logg.stopAsync();
+
     return 0;
 }
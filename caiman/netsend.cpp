@@ -0,0 +1,290 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// caiman_netsend pushes samples to caiman --net in the format of CaimanNet.h. As with caiman --synthetic, every value
+// it sends is one more than the previous one, so caiman_loadclient --verify can check the capture. It can drop or
+// reorder packets to exercise caiman's jitter buffer.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "CaimanNet.h"
+#include "Logging.h"
+#include "OlySocket.h"
+#include "OlyUtility.h"
+
+#define DEFAULT_PORT 9000
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_RATE 10000
+#define DEFAULT_SOURCES 3
+#define DEFAULT_SAMPLES 32
+
+struct options_t
+{
+    const char *host;
+    int port;
+    bool tcp;
+    int duration;
+    int rate;
+    int sources;
+    int samples;
+    int drop;
+    int reorder;
+};
+
+volatile bool gQuit = false;
+static int fd = -1;
+
+[[noreturn]] void handleException()
+{
+    logg.stopAsync();
+    fprintf(stderr, "%s", logg.getLastError());
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    exit(1);
+}
+
+static int connectTo(const char *host, int port, bool tcp)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    char service[16];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        logg.logError("Unable to resolve %s", host);
+        handleException();
+    }
+
+    // A connected UDP socket sends every datagram to the same place
+    int sock = -1;
+    for (struct addrinfo *ai = result; ai != NULL && sock < 0; ai = ai->ai_next) {
+        sock = socket_cloexec(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (sock < 0) {
+        logg.logError("Unable to connect to %s:%d, is caiman running with --net?", host, port);
+        handleException();
+    }
+    return sock;
+}
+
+static void sendPacket(const unsigned char *packet, int size, bool tcp)
+{
+    while (size > 0) {
+        const ssize_t n = send(fd, packet, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nobody listening yet is not an error for a datagram
+            if (!tcp && errno == ECONNREFUSED) {
+                return;
+            }
+            logg.logError("Socket send error: %s", strerror(errno));
+            handleException();
+        }
+        packet += n;
+        size -= n;
+    }
+}
+
+static void sleepUntil(uint64_t time)
+{
+    const uint64_t now = getTime();
+    if (time <= now) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time - now) / 1000000000;
+    ts.tv_nsec = (time - now) % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+static void printHelp()
+{
+    logg.logError("Usage: caiman_netsend [options]\n"
+            "-H <host>\thost running caiman --net; default is localhost\n"
+            "-p <port>\tport caiman is listening on; default is %d\n"
+            "--tcp\t\tsend over TCP rather than UDP\n"
+            "-t <seconds>\ttime to send for; default is %d\n"
+            "-r <n>\t\tsamples per second; default is %d\n"
+            "-n <n>\t\tsources, whose fields are power, voltage and current in turn; default is %d\n"
+            "-s <n>\t\tsamples per packet; default is %d\n"
+            "--drop <n>\tdrop every nth packet\n"
+            "--reorder <n>\tsend every nth packet after the one following it\n"
+            "-h/--help\tthis help page\n", DEFAULT_PORT, DEFAULT_DURATION_S, DEFAULT_RATE, DEFAULT_SOURCES, DEFAULT_SAMPLES);
+    handleException();
+}
+
+static void parseInt(int *value, const char *arg, const char *name, int min)
+{
+    if (!stringToInt(value, arg, 10) || *value < min) {
+        logg.logError("%s must be an integer of at least %d", name, min);
+        handleException();
+    }
+}
+
+static struct options_t parseCommandLine(int argc, char *argv[])
+{
+    struct options_t options;
+    options.host = "localhost";
+    options.port = DEFAULT_PORT;
+    options.tcp = false;
+    options.duration = DEFAULT_DURATION_S;
+    options.rate = DEFAULT_RATE;
+    options.sources = DEFAULT_SOURCES;
+    options.samples = DEFAULT_SAMPLES;
+    options.drop = 0;
+    options.reorder = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-H") == 0 && hasValue) {
+            options.host = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0 && hasValue) {
+            parseInt(&options.port, argv[++i], "Port", 1);
+        }
+        else if (strcmp(argv[i], "--tcp") == 0) {
+            options.tcp = true;
+        }
+        else if (strcmp(argv[i], "-t") == 0 && hasValue) {
+            parseInt(&options.duration, argv[++i], "Duration", 1);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+            parseInt(&options.rate, argv[++i], "Rate", 1);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && hasValue) {
+            parseInt(&options.sources, argv[++i], "Sources", 1);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+            parseInt(&options.samples, argv[++i], "Samples per packet", 1);
+        }
+        else if (strcmp(argv[i], "--drop") == 0 && hasValue) {
+            parseInt(&options.drop, argv[++i], "Drop", 2);
+        }
+        else if (strcmp(argv[i], "--reorder") == 0 && hasValue) {
+            parseInt(&options.reorder, argv[++i], "Reorder", 2);
+        }
+        else {
+            printHelp();
+        }
+    }
+
+    const int headerSize = sizeof(struct caiman_net_header) + ((options.sources + 3) & ~3);
+    if (options.sources > 255 || headerSize + options.samples * options.sources * (int) sizeof(int32_t) > CAIMAN_NET_MAX_PACKET) {
+        logg.logError("%d samples of %d sources do not fit in a packet of %d bytes", options.samples, options.sources,
+                      CAIMAN_NET_MAX_PACKET);
+        handleException();
+    }
+
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    const struct options_t options = parseCommandLine(argc, argv);
+    fd = connectTo(options.host, options.port, options.tcp);
+
+    unsigned char packets[2][CAIMAN_NET_MAX_PACKET];
+    struct caiman_net_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CAIMAN_NET_MAGIC;
+    header.version = CAIMAN_NET_VERSION;
+    header.num_sources = options.sources;
+    header.num_samples = options.samples;
+    header.rate = options.rate;
+    const int fieldsSize = (options.sources + 3) & ~3;
+    const int size = sizeof(header) + fieldsSize + options.samples * options.sources * sizeof(int32_t);
+
+    const int fields[] = { CAIMAN_NET_POWER, CAIMAN_NET_VOLTAGE, CAIMAN_NET_CURRENT };
+    unsigned char * const sourceFields = packets[0] + sizeof(header);
+    memset(sourceFields, 0, fieldsSize);
+    for (int source = 0; source < options.sources; source++) {
+        sourceFields[source] = fields[source % 3];
+    }
+    memcpy(packets[1] + sizeof(header), sourceFields, fieldsSize);
+
+    const uint64_t start = getTime();
+    const uint64_t stopTime = start + options.duration * 1000000000ULL;
+    uint32_t value = 0;
+    uint64_t sequence = 0;
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+    uint64_t reordered = 0;
+    bool held = false;
+    for (uint64_t packet = 1; getTime() < stopTime; packet++) {
+        // Paced by the time its last sample is taken
+        sleepUntil(start + (sequence + options.samples) * 1000000000 / options.rate);
+
+        unsigned char * const data = packets[held ? 1 : 0];
+        header.sequence = sequence;
+        memcpy(data, &header, sizeof(header));
+        int32_t * const values = (int32_t *) (data + sizeof(header) + fieldsSize);
+        for (int i = 0; i < options.samples * options.sources; i++) {
+            values[i] = (int32_t) value;
+            value = (value + 1) & 0x7FFFFFFF;
+        }
+        sequence += options.samples;
+
+        if (options.drop > 0 && packet % options.drop == 0) {
+            dropped++;
+            continue;
+        }
+        if (options.reorder > 0 && packet % options.reorder == 0 && !held) {
+            held = true;
+            continue;
+        }
+        sendPacket(data, size, options.tcp);
+        sent++;
+        if (held) {
+            sendPacket(packets[0], size, options.tcp);
+            sent++;
+            reordered++;
+            held = false;
+        }
+    }
+    if (held) {
+        sendPacket(packets[0], size, options.tcp);
+        sent++;
+    }
+
+    printf("{\"packets\":%llu,\"samples\":%llu,\"dropped\":%llu,\"reordered\":%llu}\n", (unsigned long long) sent,
+           (unsigned long long) sequence, (unsigned long long) dropped, (unsigned long long) reordered);
+    close(fd);
+    return 0;
+}
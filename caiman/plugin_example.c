@@ -0,0 +1,172 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// An example source plugin for caiman, and a starting point for new ones. It has one source of each field and, like
+// --synthetic, every value it generates is one more than the previous one, so caiman_loadclient --verify can check the
+// stream. The argument is the rate in samples per second, 10000 by default.
+//
+//   caiman --plugin ./libcaiman_plugin_example.so --plugin-args 1000
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "CaimanPlugin.h"
+
+#define NUM_SOURCES 3
+
+struct example
+{
+    uint32_t rate;
+    int sources[NUM_SOURCES];
+    int num_sources;
+    uint64_t start_time;
+    uint64_t samples;
+    uint32_t value;
+    const char *error;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *example_create(const char *args)
+{
+    struct example *example = (struct example *) calloc(1, sizeof(*example));
+    if (example == NULL) {
+        return NULL;
+    }
+    example->rate = args[0] != '\0' ? (uint32_t) strtoul(args, NULL, 10) : 10000;
+    if (example->rate == 0) {
+        example->error = "the rate must be a positive number of samples per second";
+    }
+    return example;
+}
+
+static void example_destroy(void *instance)
+{
+    free(instance);
+}
+
+static const char *example_get_error(void *instance)
+{
+    return instance != NULL ? ((struct example *) instance)->error : "out of memory";
+}
+
+static int example_describe(void *instance, int *fields, int max_sources, uint32_t *rate)
+{
+    struct example *example = (struct example *) instance;
+    if (example->error != NULL || max_sources < NUM_SOURCES) {
+        return -1;
+    }
+    fields[0] = CAIMAN_PLUGIN_POWER;
+    fields[1] = CAIMAN_PLUGIN_VOLTAGE;
+    fields[2] = CAIMAN_PLUGIN_CURRENT;
+    *rate = example->rate;
+    return NUM_SOURCES;
+}
+
+static int example_prepare(void *instance, const int *sources, int num_sources)
+{
+    struct example *example = (struct example *) instance;
+    memcpy(example->sources, sources, num_sources * sizeof(*sources));
+    example->num_sources = num_sources;
+    return 0;
+}
+
+static int example_init(void *instance)
+{
+    // A real plugin would open its hardware here
+    (void) instance;
+    return 0;
+}
+
+static int example_start(void *instance)
+{
+    struct example *example = (struct example *) instance;
+    example->start_time = now_ns();
+    example->samples = 0;
+    example->value = 0;
+    return 0;
+}
+
+static void example_stop(void *instance)
+{
+    (void) instance;
+}
+
+static int example_read(void *instance, int32_t *samples, int max_samples, int timeout_ms, uint64_t *lost)
+{
+    struct example *example = (struct example *) instance;
+    (void) lost;
+
+    // Wait for the next sample, but no longer than timeout_ms
+    uint64_t due = (now_ns() - example->start_time) / 1000 * example->rate / 1000000;
+    if (due <= example->samples) {
+        const uint64_t wake = example->start_time + (example->samples + 1) * 1000000000 / example->rate;
+        const uint64_t now = now_ns();
+        uint64_t wait = wake > now ? wake - now : 0;
+        if (wait > (uint64_t) timeout_ms * 1000000) {
+            wait = (uint64_t) timeout_ms * 1000000;
+        }
+        struct timespec ts;
+        ts.tv_sec = wait / 1000000000;
+        ts.tv_nsec = wait % 1000000000;
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+        due = (now_ns() - example->start_time) / 1000 * example->rate / 1000000;
+    }
+
+    int count = 0;
+    while (example->samples < due && count < max_samples) {
+        for (int i = 0; i < example->num_sources; i++) {
+            *samples++ = (int32_t) example->value;
+            example->value = (example->value + 1) & 0x7fffffff;
+        }
+        example->samples++;
+        count++;
+    }
+    return count;
+}
+
+static const struct caiman_plugin example_plugin = {
+    CAIMAN_PLUGIN_ABI_VERSION,
+    sizeof(struct caiman_plugin),
+    "caiman example plugin",
+    example_create,
+    example_destroy,
+    example_get_error,
+    example_describe,
+    example_prepare,
+    example_init,
+    example_start,
+    example_stop,
+    example_read,
+};
+
+#if defined(_WIN32)
+__declspec(dllexport)
+#else
+__attribute__((visibility("default")))
+#endif
+const struct caiman_plugin *caiman_plugin_entry(uint32_t abi_version)
+{
+    return abi_version >= 1 ? &example_plugin : NULL;
+}
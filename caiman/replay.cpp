@@ -0,0 +1,153 @@
+/**
+ * Copyright (C) 2024 by Arm Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// caiman_replay feeds a tap recorded with 'caiman --tap' through the Energy Probe
+// decoder at full speed, optionally writing the decoded .apc data to a file
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EnergyProbe.h"
+#include "Logging.h"
+#include "OlyUtility.h"
+#include "SessionData.h"
+#include "Sinks.h"
+
+volatile bool gQuit = false;
+static FILE * binfile = NULL;
+
+[[noreturn]] void handleException()
+{
+    logg.stopAsync();
+    fprintf(stderr, "%s", logg.getLastError());
+
+    if (binfile) {
+        fclose(binfile);
+    }
+
+    exit(1);
+}
+
+static void printHelp()
+{
+    logg.logError("Usage: caiman_replay [options] <tapfile>\n"
+            "-o <file>\twrite the decoded .apc data to file; default is to discard it\n"
+            "-c <bytes>\tnumber of bytes passed to the decoder at a time; default is %d, as read by caiman\n"
+            "-n <count>\tnumber of times to decode the tap; default is 1\n"
+            "-q\t\tdo not print decoder messages such as missing frames\n"
+            "-h/--help\tthis help page\n", EMETER_BUFFER_SIZE);
+    handleException();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tapPath = NULL;
+    const char *outPath = NULL;
+    int chunkSize = EMETER_BUFFER_SIZE;
+    int iterations = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printHelp();
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            // The decoder consumes two bytes at a time
+            if (!stringToInt(&chunkSize, argv[++i], 10) || chunkSize <= 0 || (chunkSize & 1) != 0) {
+                logg.logError("Chunk size must be a positive even integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            if (!stringToInt(&iterations, argv[++i], 10) || iterations <= 0) {
+                logg.logError("Count must be a positive integer");
+                handleException();
+            }
+        }
+        else if (strcmp(argv[i], "-q") == 0) {
+            logg.setDebug(false);
+        }
+        else if (argv[i][0] == '-' || tapPath != NULL) {
+            printHelp();
+        }
+        else {
+            tapPath = argv[i];
+        }
+    }
+
+    if (tapPath == NULL) {
+        printHelp();
+    }
+
+    unsigned int size;
+    char *tap = readFromDisk(tapPath, &size, false);
+    if (tap == NULL) {
+        logg.logError("Unable to read tap file %s", tapPath);
+        handleException();
+    }
+
+    const int headerSize = EnergyProbe::readTapHeader(tap, size);
+    if (headerSize < 0) {
+        logg.logError("%s is not a valid energy probe tap", tapPath);
+        handleException();
+    }
+
+    if (outPath != NULL && (binfile = fopen(outPath, "wb")) == NULL) {
+        logg.logError("Unable to open output file: %s", outPath);
+        handleException();
+    }
+
+    // Log from the decoder in the background, as caiman does
+    logg.startAsync();
+
+    // Configure the decoder exactly as caiman did when the tap was recorded
+    gSessionData.compileData();
+    EnergyProbe energyProbe("./");
+    FileSink sink(binfile);
+    if (binfile != NULL) {
+        energyProbe.addSink(&sink);
+    }
+    energyProbe.prepareChannels();
+
+    const char * const data = tap + headerSize;
+    // A tap cut short by shutdown may end mid sample, the decoder consumes two bytes at a time
+    const unsigned int length = (size - headerSize) & ~1U;
+
+    const uint64_t startTime = getTime();
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        energyProbe.resetDecoder();
+        for (unsigned int pos = 0; pos < length; pos += chunkSize) {
+            const unsigned int remain = length - pos;
+            energyProbe.decodeBuffer(data + pos, remain < (unsigned int) chunkSize ? remain : chunkSize);
+        }
+    }
+    const uint64_t elapsed = getTime() - startTime;
+
+    const double seconds = elapsed / 1e9;
+    const double bytes = (double) length * iterations;
+    printf("decoded %.0f bytes in %.6f s: %.3f GB/s\n", bytes, seconds, seconds > 0 ? bytes / seconds / 1e9 : 0.0);
+
+    logg.stopAsync();
+    if (binfile) {
+        fclose(binfile);
+    }
+    free(tap);
+
+    return 0;
+}